@@ -0,0 +1,63 @@
+#include "gtest/gtest.h"
+#include "../src/Arena.h"
+#include "../src/Memory.h"
+
+#include <thread>
+
+
+TEST(tests, ArenaReusesFreedChunks) {
+    Arena arena;
+    void* first = arena.Allocate(40);
+    arena.Deallocate(first, 40);
+    void* second = arena.Allocate(48);
+
+    ASSERT_EQ(first, second);
+    ASSERT_EQ(2u, arena.GetStats().allocations);
+    ASSERT_EQ(1u, arena.GetStats().reused);
+    ASSERT_EQ(48u, arena.GetStats().usedBytes);
+}
+
+TEST(tests, ArenaResetReturnsBlocks) {
+    Arena::Options options;
+    options.blockSize = 4096;
+    Arena arena(options);
+    for (int i = 0; i < 100; i++)
+        arena.Allocate(1024);
+    ASSERT_GT(arena.GetStats().reservedBytes, 4096u);
+
+    arena.Reset();
+
+    ASSERT_EQ(4096u, arena.GetStats().reservedBytes);
+    ASSERT_EQ(0u, arena.GetStats().usedBytes);
+    ASSERT_EQ(102400u, arena.GetStats().peakBytes);
+    ASSERT_EQ(1u, arena.GetStats().resets);
+}
+
+TEST(tests, ArenaSharedBetweenThreads) {
+    Arena::Options options;
+    options.threadSafe = true;
+    Arena arena(options);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+        threads.emplace_back([&arena] {
+            for (int i = 0; i < 1000; i++)
+                arena.Deallocate(arena.Allocate(32 + i % 200), 32 + i % 200);
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    ASSERT_EQ(4000u, arena.GetStats().allocations);
+    ASSERT_EQ(0u, arena.GetStats().usedBytes);
+}
+
+TEST(tests, CachedMemFlushReleasesLines) {
+    MemoryStorage mem;
+    CachedMem cache = CachedMem (mem);
+    cache.Request(0x200);
+    ASSERT_GT(cache.getArenaStats().usedBytes, 0u);
+
+    cache.Flush();
+
+    ASSERT_EQ(0u, cache.getArenaStats().usedBytes);
+    ASSERT_TRUE(cache.getCodeList().empty());
+}
@@ -0,0 +1,161 @@
+#include "gtest/gtest.h"
+#include "../src/Decoder.h"
+#include "../src/Memory.h"
+
+
+static Word EncodeAmo(AmoFunc func, Word rd, Word rs1, Word rs2)
+{
+    return (Word(func) << 27u) | (rs2 << 20u) | (rs1 << 15u) | (fnAMOW << 12u) | (rd << 7u) | Word(Opcode::Amo);
+}
+
+TEST(tests, DecodeAmo) {
+    Decoder decoder;
+
+    Instruction amoadd = decoder.Decode(EncodeAmo(AmoFunc::Add, 5, 10, 11));
+    Instruction lr = decoder.Decode(EncodeAmo(AmoFunc::Lr, 5, 10, 0));
+    Instruction sc = decoder.Decode(EncodeAmo(AmoFunc::Sc, 5, 10, 11));
+
+    ASSERT_EQ(IType::Amo, amoadd._type);
+    ASSERT_EQ(AmoFunc::Add, amoadd._amoFunc);
+    ASSERT_EQ(5, amoadd._dst);
+    ASSERT_EQ(10, amoadd._src1);
+    ASSERT_EQ(11, amoadd._src2);
+    ASSERT_EQ(IType::Lr, lr._type);
+    ASSERT_EQ(IType::Sc, sc._type);
+}
+
+TEST(tests, AmoDataResp) {
+    MemoryStorage mem;
+    CachedMem cache = CachedMem (mem);
+    Word ip1 = 576;
+    Word data1 = 5;
+    mem.Write(ip1, 10);
+
+    cache.Request(ip1, IType::Amo, AmoFunc::Add);
+    while (!cache.Response(ip1, IType::Amo, data1))
+        cache.Clock();
+
+    ASSERT_EQ(10, data1);
+    ASSERT_EQ(15, mem.Read(ip1));
+}
+
+// Clocks an amoadd on a line already in the cache to completion
+static int AmoCycles(unsigned atomicLatency)
+{
+    MemoryStorage mem;
+    CacheConfig config;
+    config.atomicLatency = atomicLatency;
+    CachedMem cache(mem, nullptr, config);
+    Word addr = 576;
+    Word data = 1;
+    cache.Request(addr, IType::Ld);
+    while (!cache.Response(addr, IType::Ld, data))
+        cache.Clock();
+
+    int cycles = 0;
+    cache.Request(addr, IType::Amo, AmoFunc::Add);
+    for (; !cache.Response(addr, IType::Amo, data); cycles++)
+        cache.Clock();
+    return cycles;
+}
+
+TEST(tests, AmoLatencyIsConfigurable) {
+    ASSERT_EQ(AmoCycles(4) + 16, AmoCycles(20));
+}
+
+TEST(tests, LrScDataResp) {
+    MemoryStorage mem;
+    CachedMem cache = CachedMem (mem);
+    Word ip1 = 576;
+    Word data1 = 0;
+    Word data2 = 7;
+    Word data3 = 8;
+
+    cache.Request(ip1, IType::Lr, AmoFunc::Lr);
+    while (!cache.Response(ip1, IType::Lr, data1))
+        cache.Clock();
+    cache.Request(ip1, IType::Sc, AmoFunc::Sc);
+    while (!cache.Response(ip1, IType::Sc, data2))
+        cache.Clock();
+    cache.Request(ip1, IType::Sc, AmoFunc::Sc);
+    while (!cache.Response(ip1, IType::Sc, data3))
+        cache.Clock();
+
+    ASSERT_EQ(0, data2);
+    ASSERT_EQ(1, data3);
+    ASSERT_EQ(7, mem.Read(ip1));
+}
+
+TEST(tests, AmoAcrossHarts) {
+    MemoryStorage mem;
+    CoherenceDirectory directory(2, 20);
+    StoreBuffer stores0;
+    StoreBuffer stores1;
+    CachedMem cache0 = CachedMem (mem, &stores0);
+    CachedMem cache1 = CachedMem (mem, &stores1);
+    cache0.AttachCoherence(&directory, 0);
+    cache1.AttachCoherence(&directory, 1);
+    std::vector<CachedMem*> caches{&cache0, &cache1};
+    Word ip1 = 576;
+    Word data1 = 1;
+    Word data2 = 1;
+
+    cache0.Request(ip1, IType::Amo, AmoFunc::Add);
+    cache1.Request(ip1, IType::Amo, AmoFunc::Add);
+    int i = 0;
+    while (i < 10) {
+        cache0.Clock();
+        cache1.Clock();
+        cache0.Response(ip1, IType::Amo, data1);
+        cache1.Response(ip1, IType::Amo, data2);
+        i++;
+    }
+    directory.Commit(caches);
+    cache0.CommitAtomic(caches);
+    cache1.CommitAtomic(caches);
+
+    ASSERT_EQ(true, cache0.Response(ip1, IType::Amo, data1));
+    ASSERT_EQ(true, cache1.Response(ip1, IType::Amo, data2));
+    ASSERT_EQ(0, data1);
+    ASSERT_EQ(1, data2);
+    ASSERT_EQ(2, mem.Read(ip1));
+}
+
+TEST(tests, ScFailsAfterPeerWrite) {
+    MemoryStorage mem;
+    CoherenceDirectory directory(2, 20);
+    StoreBuffer stores0;
+    StoreBuffer stores1;
+    CachedMem cache0 = CachedMem (mem, &stores0);
+    CachedMem cache1 = CachedMem (mem, &stores1);
+    cache0.AttachCoherence(&directory, 0);
+    cache1.AttachCoherence(&directory, 1);
+    std::vector<CachedMem*> caches{&cache0, &cache1};
+    Word ip1 = 576;
+    Word data1 = 0;
+    Word data2 = 3;
+    Word data3 = 9;
+
+    cache0.Request(ip1, IType::Lr, AmoFunc::Lr);
+    cache0.Clock();
+    cache0.Response(ip1, IType::Lr, data1);
+    cache1.Request(ip1, IType::St);
+    cache1.Clock();
+    while (!cache1.Response(ip1, IType::St, data2))
+        cache1.Clock();
+    cache0.Request(ip1, IType::Sc, AmoFunc::Sc);
+    int i = 0;
+    while (i < 10) {
+        cache0.Clock();
+        cache0.Response(ip1, IType::Sc, data3);
+        i++;
+    }
+    stores0.Drain(mem);
+    stores1.Drain(mem);
+    directory.Commit(caches);
+    cache0.CommitAtomic(caches);
+
+    ASSERT_EQ(true, cache0.Response(ip1, IType::Sc, data3));
+    ASSERT_EQ(1, data3);
+    ASSERT_EQ(3, mem.Read(ip1));
+}
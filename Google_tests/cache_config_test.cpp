@@ -0,0 +1,114 @@
+#include "gtest/gtest.h"
+#include "../src/Memory.h"
+
+
+TEST(tests, CacheConfigSetsEvictWithinTheirSet) {
+    MemoryStorage mem;
+    CacheConfig config;
+    config.lineBytes = 32;
+    config.dataSets = 2;
+    config.dataWays = 2;
+    CachedMem cache(mem, nullptr, config);
+
+    // lines 0, 2 and 4 map to set 0, line 1 to set 1
+    cache.Request(0 * 32, IType::Ld);
+    cache.Request(1 * 32, IType::Ld);
+    cache.Request(2 * 32, IType::Ld);
+    ASSERT_EQ(3, cache.getDataTables().size());
+    cache.Request(4 * 32, IType::Ld);
+    ASSERT_EQ(0 * 32, cache.getEraseTag());
+    ASSERT_EQ(3, cache.getDataTables().size());
+    ASSERT_EQ(8, cache.getLine().size());
+
+    // a hit refreshes line 2, so line 4 goes next
+    cache.Request(2 * 32, IType::Ld);
+    cache.Request(6 * 32, IType::Ld);
+    ASSERT_EQ(4 * 32, cache.getEraseTag());
+    ASSERT_EQ(5, cache.getDataStats().misses);
+}
+
+TEST(tests, CacheConfigFifoIgnoresHits) {
+    MemoryStorage mem;
+    CacheConfig config;
+    config.dataWays = 2;
+    config.replacement = Replacement::Fifo;
+    CachedMem cache(mem, nullptr, config);
+
+    cache.Request(0, IType::Ld);
+    cache.Request(64, IType::Ld);
+    cache.Request(0, IType::Ld);
+    cache.Request(128, IType::Ld);
+    ASSERT_EQ(0, cache.getEraseTag());
+}
+
+TEST(tests, CacheConfigExactLatency) {
+    MemoryStorage mem;
+    CacheConfig config;
+    config.missLatency = 5;
+    config.exactLatency = true;
+    CachedMem cache(mem, nullptr, config);
+
+    Word data = 0;
+    cache.Request(0x100, IType::Ld);
+    for (int cycle = 0; cycle < 5; cycle++)
+    {
+        ASSERT_FALSE(cache.Response(0x100, IType::Ld, data));
+        cache.Clock();
+    }
+    ASSERT_TRUE(cache.Response(0x100, IType::Ld, data));
+}
+
+static Word Fetch(CachedMem& cache, Word ip)
+{
+    cache.Request(ip);
+    std::optional<Word> word;
+    while (!(word = cache.Response()))
+        cache.Clock();
+    cache.Clock();
+    return *word;
+}
+
+// addi a0, zero, 1 at 0x3e, the last halfword of the first line
+static void LoadCrossingInstruction(MemoryStorage& mem)
+{
+    mem.Write(0x3c, 0x05130001);
+    mem.Write(0x40, 0x00010010);
+}
+
+TEST(tests, CacheConfigFifoKeepsTheLineBeingFetched) {
+    MemoryStorage mem;
+    LoadCrossingInstruction(mem);
+    CacheConfig config;
+    config.replacement = Replacement::Fifo;
+    CachedMem cache(mem, nullptr, config);
+
+    // the first line is the oldest of a full cache when its instruction
+    // spills into the next one
+    Fetch(cache, 0x0);
+    for (Word i = 0; i < 6; i++)
+        Fetch(cache, 0x80 + i * 0x40);
+    ASSERT_EQ(0x00100513, Fetch(cache, 0x3e));
+    std::list<Word> lines = cache.getCodeList();
+    ASSERT_NE(lines.end(), std::find(lines.begin(), lines.end(), 0x0));
+    ASSERT_NE(lines.end(), std::find(lines.begin(), lines.end(), 0x40));
+}
+
+TEST(tests, CacheConfigRandomKeepsTheLineBeingFetched) {
+    MemoryStorage mem;
+    LoadCrossingInstruction(mem);
+    CacheConfig config;
+    config.codeWays = 2;
+    config.replacement = Replacement::Random;
+    CachedMem cache(mem, nullptr, config);
+
+    for (Word i = 0; i < 200; i++)
+    {
+        Fetch(cache, 0x1000 + i * 0x40);
+        ASSERT_EQ(0x00100513, Fetch(cache, 0x3e));
+    }
+
+    // with one way the first line stays while the second is filled
+    config.codeWays = 1;
+    CachedMem direct(mem, nullptr, config);
+    ASSERT_EQ(0x00100513, Fetch(direct, 0x3e));
+}
@@ -0,0 +1,114 @@
+#include "gtest/gtest.h"
+#include "../src/Memory.h"
+
+// Clocks `cache` until the data access it was asked for completes
+static Word Access(CachedMem& cache, Word addr, IType type, Word data = 0)
+{
+    cache.Request(addr, type);
+    for (int cycle = 0; cycle < 1000 && !cache.Response(addr, type, data); cycle++)
+        cache.Clock();
+    return data;
+}
+
+
+TEST(tests, CoherenceFillExclusiveThenShared) {
+    MemoryStorage mem;
+    CoherenceDirectory directory(2, 20);
+    CachedMem cache0 = CachedMem (mem);
+    CachedMem cache1 = CachedMem (mem);
+    cache0.AttachCoherence(&directory, 0);
+    cache1.AttachCoherence(&directory, 1);
+    std::vector<CachedMem*> caches{&cache0, &cache1};
+    Word ip1 = 576;
+
+    cache0.Request(ip1, IType::Ld);
+    directory.Commit(caches);
+    cache1.Request(ip1, IType::Ld);
+    directory.Commit(caches);
+
+    ASSERT_EQ(Mesi::Shared, cache0.getLineState(ip1));
+    ASSERT_EQ(Mesi::Shared, cache1.getLineState(ip1));
+}
+
+TEST(tests, CoherenceUpgradeInvalidatesPeer) {
+    MemoryStorage mem;
+    CoherenceDirectory directory(2, 20);
+    CachedMem cache0 = CachedMem (mem);
+    CachedMem cache1 = CachedMem (mem);
+    cache0.AttachCoherence(&directory, 0);
+    cache1.AttachCoherence(&directory, 1);
+    std::vector<CachedMem*> caches{&cache0, &cache1};
+    Word ip1 = 576;
+    Word data1 = 5;
+
+    cache0.Request(ip1, IType::Ld);
+    cache1.Request(ip1, IType::Ld);
+    directory.Commit(caches);
+    cache1.Request(ip1, IType::St);
+    cache1.setWaitCycles(0);
+
+    ASSERT_EQ(false, cache1.Response(ip1, IType::St, data1));
+    directory.Commit(caches);
+    ASSERT_EQ(Mesi::Modified, cache1.getLineState(ip1));
+    ASSERT_EQ(Mesi::Invalid, cache0.getLineState(ip1));
+
+    cache0.Request(ip1, IType::Ld);
+    directory.Commit(caches);
+    const CoherenceDirectory::LineStats& stats = directory.Lines().at(ToLineAddr(ip1));
+    ASSERT_EQ(1, stats.upgrades);
+    ASSERT_EQ(1, stats.invalidations);
+    ASSERT_EQ(1, stats.coherenceMisses);
+}
+
+TEST(tests, CoherenceUpgradeLatency) {
+    MemoryStorage mem;
+    CoherenceDirectory directory(2, 20);
+    CachedMem cache0 = CachedMem (mem);
+    CachedMem cache1 = CachedMem (mem);
+    cache0.AttachCoherence(&directory, 0);
+    cache1.AttachCoherence(&directory, 1);
+    std::vector<CachedMem*> caches{&cache0, &cache1};
+    Word ip1 = 576;
+    Word data1 = 5;
+
+    cache0.Request(ip1, IType::Ld);
+    directory.Commit(caches);
+    cache1.Request(ip1, IType::Ld);
+    cache1.Clock();
+    cache1.Request(ip1, IType::St);
+    int i = 0;
+    while (i < 20) {
+        cache1.Clock();
+        i++;
+    }
+
+    ASSERT_EQ(true, cache1.Response(ip1, IType::St, data1));
+}
+
+TEST(tests, CoherenceFillBeforePeerWriteInSameQuantum) {
+    MemoryStorage mem;
+    CoherenceDirectory directory(2, 20);
+    CachedMem cache0 = CachedMem (mem);
+    CachedMem cache1 = CachedMem (mem);
+    cache0.AttachCoherence(&directory, 0);
+    cache1.AttachCoherence(&directory, 1);
+    std::vector<CachedMem*> caches{&cache0, &cache1};
+    Word flag = 576;
+
+    Access(cache0, flag, IType::Ld);
+    directory.Commit(caches);
+
+    // one quantum: hart 1 reads the flag, then hart 0 sets it; the log of
+    // hart 0 is replayed first
+    ASSERT_EQ(0, Access(cache1, flag, IType::Ld));
+    Access(cache0, flag, IType::St, 1);
+    directory.Commit(caches);
+    ASSERT_EQ(1, mem.Read(flag));
+    ASSERT_EQ(Mesi::Invalid, cache1.getLineState(flag));
+
+    ASSERT_EQ(1, Access(cache1, flag, IType::Ld));
+    directory.Commit(caches);
+    const CoherenceDirectory::LineStats& stats = directory.Lines().at(ToLineAddr(flag));
+    ASSERT_EQ(1, stats.invalidations);
+    ASSERT_EQ(1, stats.coherenceMisses);
+}
@@ -0,0 +1,50 @@
+#include "gtest/gtest.h"
+#include "../src/Decoder.h"
+#include "../src/Memory.h"
+
+
+TEST(tests, ExpandCompressed) {
+    ASSERT_EQ(0x00150513, Decoder::Expand(0x0505));  // c.addi a0, 1
+    ASSERT_EQ(0xfff00793, Decoder::Expand(0x57fd));  // c.li a5, -1
+    ASSERT_EQ(0x0045a503, Decoder::Expand(0x41c8));  // c.lw a0, 4(a1)
+    ASSERT_EQ(0x00112623, Decoder::Expand(0xc606));  // c.swsp ra, 12(sp)
+    ASSERT_EQ(0x00b00533, Decoder::Expand(0x852e));  // c.mv a0, a1
+    ASSERT_EQ(0x40b50533, Decoder::Expand(0x8d0d));  // c.sub a0, a1
+    ASSERT_EQ(0x40155513, Decoder::Expand(0x8505));  // c.srai a0, 1
+    ASSERT_EQ(0xff010113, Decoder::Expand(0x1141));  // c.addi16sp -16
+    ASSERT_EQ(0x00810513, Decoder::Expand(0x0028));  // c.addi4spn a0, sp, 8
+    ASSERT_EQ(0x00001537, Decoder::Expand(0x6505));  // c.lui a0, 1
+    ASSERT_EQ(0x00008067, Decoder::Expand(0x8082));  // c.jr ra
+    ASSERT_EQ(0x010000ef, Decoder::Expand(0x2801));  // c.jal 16
+    ASSERT_EQ(0x00051463, Decoder::Expand(0xe501));  // c.bnez a0, 8
+    ASSERT_EQ(0, Decoder::Expand(0x0000));           // illegal
+}
+
+TEST(tests, DecodeCompressed) {
+    Decoder decoder;
+
+    Instruction instr = decoder.Decode(0x0505);
+
+    ASSERT_EQ(2, instr._size);
+    ASSERT_EQ(IType::Alu, instr._type);
+    ASSERT_EQ(10, instr._dst);
+    ASSERT_EQ(1, instr._imm);
+}
+
+TEST(tests, HalfwordCodeReq) {
+    MemoryStorage mem;
+    CachedMem cache = CachedMem (mem);
+    mem.Write(0x23c, 0x05130001);  // c.nop, low half of addi a0, a0, 1
+    mem.Write(0x240, 0x00000015);  // high half in the next line
+
+    cache.Request(0x23e);
+    cache.Clock();
+
+    ASSERT_EQ(0x00150513, cache.Response());
+    ASSERT_EQ(2, cache.getCodeStats().misses);
+    ASSERT_EQ(1, cache.getCodeStats().lineCrossings);
+
+    cache.Request(0x23c);
+
+    ASSERT_EQ(0x05130001, cache.Response());
+}
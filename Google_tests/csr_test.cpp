@@ -0,0 +1,99 @@
+#include "gtest/gtest.h"
+#include "../src/Cpu.h"
+#include "../src/CsrFile.h"
+#include "../src/Decoder.h"
+
+#include <limits>
+#include <vector>
+
+
+static Word ReadCsr(CsrFile& csrf, Word csr)
+{
+    Decoder decoder;
+    Instruction instr = decoder.Decode(csr << 20u | 0b010u << 12u | 5u << 7u | Word(Opcode::System));
+    InstrState state;
+    csrf.Read(instr, state);
+    return state._csrVal;
+}
+
+static void WriteCsr(CsrFile& csrf, Word csr, Word value)
+{
+    Decoder decoder;
+    Instruction instr = decoder.Decode(csr << 20u | 5u << 15u | 0b001u << 12u | Word(Opcode::System));
+    InstrState state;
+    state._data = value;
+    csrf.Write(instr, state);
+}
+
+TEST(tests, CsrCycleIs64Bit) {
+    CsrFile csrf;
+    csrf.Reset();
+    WriteCsr(csrf, Word(CsrIdx::Mcycle), 0xfffffffe);
+    csrf.Clock();
+    csrf.Clock();
+    csrf.Clock();
+
+    ASSERT_EQ(1, ReadCsr(csrf, Word(CsrIdx::CycleH)));
+    ASSERT_EQ(1, ReadCsr(csrf, Word(CsrIdx::McycleH)));
+    ASSERT_EQ(1, ReadCsr(csrf, Word(CsrIdx::Cycle)));
+
+    WriteCsr(csrf, Word(CsrIdx::MinstretH), 2);
+    csrf.InstructionExecuted();
+    ASSERT_EQ(2, ReadCsr(csrf, Word(CsrIdx::InstretH)));
+    ASSERT_EQ(1, ReadCsr(csrf, Word(CsrIdx::Instret)));
+}
+
+TEST(tests, CsrHpmCounters) {
+    CsrFile csrf;
+    csrf.Reset();
+    csrf.CountEvent(HpmEvent::Branches, 7);
+    WriteCsr(csrf, Word(CsrIdx::Mhpmevent3) + 1, Word(HpmEvent::Branches));
+    csrf.CountEvent(HpmEvent::Branches, 2);
+    csrf.CountEvent(HpmEvent::StallCycles, 10);
+
+    // counter 4 counts from the selection on, in both banks
+    ASSERT_EQ(Word(HpmEvent::Branches), ReadCsr(csrf, Word(CsrIdx::Mhpmevent3) + 1));
+    ASSERT_EQ(2, ReadCsr(csrf, Word(CsrIdx::Mhpmcounter3) + 1));
+    ASSERT_EQ(2, ReadCsr(csrf, Word(CsrIdx::Hpmcounter3) + 1));
+    ASSERT_EQ(0, ReadCsr(csrf, Word(CsrIdx::Mhpmcounter3)));
+
+    WriteCsr(csrf, Word(CsrIdx::Mhpmcounter3H) + 1, 1);
+    csrf.CountEvent(HpmEvent::Branches);
+    ASSERT_EQ(1, ReadCsr(csrf, Word(CsrIdx::Hpmcounter3H) + 1));
+    ASSERT_EQ(3, ReadCsr(csrf, Word(CsrIdx::Hpmcounter3) + 1));
+}
+
+// Counts `event` over a loop of three backward branches and a divide the
+// next instruction waits for, and exits with the count
+static Word CountLoopEvent(HpmEvent event)
+{
+    const std::vector<Word> program = {
+        0x00000293 | Word(event) << 20u,  // li t0, event
+        0x32329073,  // csrw mhpmevent3, t0
+        0x00300313,  // li t1, 3
+        0xfff30313,  // loop: addi t1, t1, -1
+        0xfe031ee3,  // bnez t1, loop
+        0x0252ce33,  // div t3, t0, t0
+        0x01ce0eb3,  // add t4, t3, t3
+        0xc03023f3,  // csrr t2, hpmcounter3
+        0x78039073,  // csrw mtohost, t2
+        0x0000006f,  // j .
+    };
+    MemoryStorage mem;
+    for (size_t i = 0; i < program.size(); i++)
+        mem.Write(0x200 + 4 * i, program[i]);
+    CachedMem cache(mem);
+    Cpu cpu(cache);
+    cpu.Reset(0x200);
+    EXPECT_EQ(StopReason::Exit, cpu.Run(100000));
+    return cpu.GetMessage()->payload;
+}
+
+TEST(tests, CsrHpmEventsFromCore) {
+    ASSERT_EQ(3, CountLoopEvent(HpmEvent::Branches));
+    // the loop exit is a backward branch falling through
+    ASSERT_EQ(1, CountLoopEvent(HpmEvent::Mispredicts));
+    ASSERT_LT(0, CountLoopEvent(HpmEvent::StallCycles));
+    // the program fits in a line, fetched before the counter starts
+    ASSERT_EQ(0, CountLoopEvent(HpmEvent::ICacheMisses));
+}
@@ -0,0 +1,88 @@
+#include "gtest/gtest.h"
+#include "../src/Decoder.h"
+
+#include <cstring>
+#include <vector>
+
+
+TEST(tests, DecodeImmediateFormats) {
+    Decoder decoder;
+
+    ASSERT_EQ(Word(-3), decoder.Decode(0xffd30293)._imm);      // addi t0, t1, -3
+    ASSERT_EQ(Word(-8), decoder.Decode(0xfe712c23)._imm);      // sw t2, -8(sp)
+    ASSERT_EQ(Word(-16), decoder.Decode(0xfe2088e3)._imm);     // beq ra, sp, -16
+    ASSERT_EQ(Word(4094), decoder.Decode(0x7e20ffe3)._imm);    // bgeu ra, sp, 4094
+    ASSERT_EQ(Word(-1048576), decoder.Decode(0x800000ef)._imm); // jal ra, -1048576
+    ASSERT_EQ(Word(0x7fffe), decoder.Decode(0x7ff7f06f)._imm); // j 0x7fffe
+    ASSERT_EQ(0xfffff000, decoder.Decode(0xfffff1b7)._imm);    // lui gp, 0xfffff
+    ASSERT_EQ(Word(3), decoder.Decode(0x4030d093)._imm);       // srai ra, ra, 3
+}
+
+TEST(tests, DecodeHandlersAndOperands) {
+    Decoder decoder;
+
+    Instruction sw = decoder.Decode(0xfe712c23);
+    ASSERT_EQ(Handler::Sw, sw._handler);
+    ASSERT_EQ(0, sw._dst);
+    ASSERT_EQ(2, sw._src1);
+    ASSERT_EQ(7, sw._src2);
+
+    Instruction sub = decoder.Decode(0x403100b3);
+    ASSERT_EQ(Handler::Sub, sub._handler);
+    ASSERT_EQ(AluFunc::Sub, sub._aluFunc);
+    ASSERT_EQ(0, sub._flags & HasImm);
+
+    Instruction srai = decoder.Decode(0x4030d093);
+    ASSERT_EQ(Handler::Srai, srai._handler);
+    ASSERT_EQ(0, srai._src2);
+
+    ASSERT_EQ(Handler::Mulhu, decoder.Decode(0x023130b3)._handler);
+}
+
+TEST(tests, DecodeCsrAndAmo) {
+    Decoder decoder;
+
+    Instruction csrr = decoder.Decode(0xf10022f3);  // csrr t0, mhartid
+    ASSERT_EQ(Handler::Csrrs, csrr._handler);
+    ASSERT_EQ(IType::Csrr, csrr._type);
+    ASSERT_EQ(CsrIdx::Mhartid, csrr._csr);
+    ASSERT_EQ(5, csrr._dst);
+
+    Instruction amo = decoder.Decode(0x0021a0af);   // amoadd.w ra, sp, (gp)
+    ASSERT_EQ(Handler::AmoaddW, amo._handler);
+    ASSERT_EQ(IType::Amo, amo._type);
+    ASSERT_EQ(AmoFunc::Add, amo._amoFunc);
+    ASSERT_EQ(3, amo._src1);
+
+    Instruction unknown = decoder.Decode(0x0000007f);
+    ASSERT_EQ(Handler::Unsupported, unknown._handler);
+    ASSERT_EQ(IType::Unsupported, unknown._type);
+    ASSERT_EQ(0, unknown._dst);
+}
+
+TEST(tests, DecodeBlockMatchesDecode) {
+    std::vector<Word> words = {0xffd30293, 0xfe712c23, 0xfe2088e3, 0x7e20ffe3, 0x800000ef, 0x7ff7f06f,
+                               0xfffff1b7, 0x4030d093, 0x403100b3, 0x023130b3, 0xf10022f3, 0x0021a0af,
+                               0x0505, 0x57fd, 0x8d0d, 0x0000};
+    uint32_t seed = 1;
+    for (int i = 0; i < 1000; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        words.push_back(seed);
+    }
+    Decoder decoder;
+    std::vector<Instruction> expected;
+    for (Word word : words)
+        expected.push_back(decoder.Decode(word));
+
+    std::vector<Instruction> scalar(words.size());
+    Decoder::DecodeBlockScalar(words.data(), words.size(), scalar.data());
+    std::vector<Instruction> block(words.size());
+    Decoder::DecodeBlock(words.data(), words.size(), block.data());
+
+    for (size_t i = 0; i < words.size(); i++)
+    {
+        ASSERT_EQ(0, memcmp(&expected[i], &scalar[i], sizeof(Instruction))) << std::hex << words[i];
+        ASSERT_EQ(0, memcmp(&expected[i], &block[i], sizeof(Instruction))) << std::hex << words[i];
+    }
+}
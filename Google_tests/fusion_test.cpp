@@ -0,0 +1,130 @@
+#include "gtest/gtest.h"
+#include "../src/Cpu.h"
+#include "../src/DecodedText.h"
+
+#include <vector>
+
+
+static std::vector<uint16_t> ToParcels(const std::vector<Word>& words)
+{
+    std::vector<uint16_t> parcels;
+    for (Word word : words)
+    {
+        parcels.push_back(word & 0xffffu);
+        parcels.push_back(word >> 16u);
+    }
+    return parcels;
+}
+
+static const std::vector<Word> fusible = {
+    0x123452b7,  // lui t0, 0x12345
+    0x67828293,  // addi t0, t0, 0x678
+    0x01039313,  // slli t1, t2, 16
+    0x01835313,  // srli t1, t1, 24
+    0x00a4b433,  // sltu s0, s1, a0
+    0x00041463,  // bnez s0, 8
+    0x00000317,  // auipc t1, 0
+    0x010300e7,  // jalr ra, 16(t1)
+    0x123452b7,  // lui t0, 0x12345
+    0x67830293,  // addi t0, t1, 0x678
+};
+
+TEST(tests, FusionPairsDetected) {
+    DecodedText text(0x200, ToParcels(fusible));
+
+    ASSERT_EQ(Fusion::LuiAddi, text.FusionAt(0x200));
+    ASSERT_EQ(Fusion::None, text.FusionAt(0x204));
+    ASSERT_EQ(Fusion::ShiftPair, text.FusionAt(0x208));
+    ASSERT_EQ(Fusion::CompareBranch, text.FusionAt(0x210));
+    ASSERT_EQ(Fusion::AuipcJalr, text.FusionAt(0x218));
+    // addi reads another register than lui wrote
+    ASSERT_EQ(Fusion::None, text.FusionAt(0x220));
+
+    const Instruction* partner = text.FusedPartner(0x200);
+    ASSERT_NE(nullptr, partner);
+    ASSERT_EQ(Handler::Addi, partner->_handler);
+    ASSERT_EQ(nullptr, text.FusedPartner(0x204));
+}
+
+// Runs lui/addi, at 0x204 and 0x208, followed by csrw mtohost, t0 and
+// returns the cycles to the message
+static uint64_t RunConstant(bool fusion, Word& result, uint64_t& fused, const CacheConfig& config = CacheConfig(),
+                            bool predecode = true)
+{
+    const std::vector<Word> program = {
+        0x00000013,  // nop
+        0x123452b7,  // lui t0, 0x12345
+        0x67828293,  // addi t0, t0, 0x678
+        0x78029073,  // csrw mtohost, t0
+        0x0000006f,  // j .
+    };
+    MemoryStorage mem;
+    for (size_t i = 0; i < program.size(); i++)
+        mem.Write(0x200 + 4 * i, program[i]);
+    DecodedText text(0x200, ToParcels(program));
+
+    TimingConfig timing;
+    timing.fusion = fusion;
+    CachedMem cache(mem, nullptr, config);
+    Cpu cpu(cache, 0, timing);
+    cpu.UsePredecoded(predecode ? &text : nullptr);
+    cpu.Reset(0x200);
+    for (uint64_t cycle = 1; cycle < 10000; cycle++)
+    {
+        cpu.Clock();
+        cache.Clock();
+        if (std::optional<CpuToHostData> msg = cpu.GetMessage())
+        {
+            result = msg->payload;
+            fused = cpu.FusedPairs();
+            return cycle;
+        }
+    }
+    return 0;
+}
+
+TEST(tests, FusionExecutesPairAsOne) {
+    Word plain = 0;
+    Word fusedResult = 0;
+    uint64_t plainPairs = 0;
+    uint64_t fusedPairs = 0;
+    uint64_t plainCycles = RunConstant(false, plain, plainPairs);
+    uint64_t fusedCycles = RunConstant(true, fusedResult, fusedPairs);
+
+    ASSERT_EQ(0x12345678, plain);
+    ASSERT_EQ(0x12345678, fusedResult);
+    ASSERT_EQ(0, plainPairs);
+    ASSERT_EQ(1, fusedPairs);
+    ASSERT_NE(0, fusedCycles);
+    ASSERT_LT(fusedCycles, plainCycles);
+}
+
+TEST(tests, FusionStopsAtConfiguredLineBoundary) {
+    // 8-byte lines put lui and addi in different lines
+    CacheConfig config;
+    config.lineBytes = 8;
+    Word result = 0;
+    uint64_t fused = 0;
+    ASSERT_NE(0, RunConstant(true, result, fused, config));
+    ASSERT_EQ(0x12345678, result);
+    ASSERT_EQ(0, fused);
+
+    config.lineBytes = 16;
+    ASSERT_NE(0, RunConstant(true, result, fused, config));
+    ASSERT_EQ(1, fused);
+}
+
+TEST(tests, UnfusedPairKeepsItsTiming) {
+    // the pair is found, but without fusion the second instruction costs
+    // what it does when nothing is predecoded
+    Word predecoded = 0;
+    Word decoded = 0;
+    uint64_t fused = 0;
+    uint64_t predecodedCycles = RunConstant(false, predecoded, fused);
+    uint64_t decodedCycles = RunConstant(false, decoded, fused, CacheConfig(), false);
+
+    ASSERT_EQ(0x12345678, predecoded);
+    ASSERT_EQ(0x12345678, decoded);
+    ASSERT_EQ(decodedCycles, predecodedCycles);
+    ASSERT_EQ(0, fused);
+}
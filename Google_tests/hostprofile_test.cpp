@@ -0,0 +1,49 @@
+#include "gtest/gtest.h"
+#include "../src/HostProfile.h"
+
+#include <sstream>
+
+
+static volatile uint64_t sink;
+
+static void Spin(int n)
+{
+    for (int i = 0; i < n; i++)
+        sink = sink + i;
+}
+
+TEST(tests, HostProfileChargesScopes) {
+    HostProfiler& profiler = HostProfiler::Instance();
+    profiler.Start();
+    Spin(1000);
+    {
+        HostScope execute(HostComponent::Execute);
+        Spin(1000);
+        {
+            HostScope memory(HostComponent::Memory);
+            Spin(1000);
+        }
+        Spin(1000);
+    }
+    profiler.Stop();
+    // scopes outside Start()/Stop() are not counted
+    {
+        HostScope decode(HostComponent::Decode);
+        Spin(1000);
+    }
+
+    ASSERT_EQ(1, profiler.At(HostComponent::Execute).scopes);
+    ASSERT_EQ(1, profiler.At(HostComponent::Memory).scopes);
+    ASSERT_EQ(0, profiler.At(HostComponent::Decode).scopes);
+    ASSERT_GT(profiler.At(HostComponent::Loop).ticks, 0);
+    ASSERT_GT(profiler.At(HostComponent::Execute).ticks, 0);
+    ASSERT_GT(profiler.At(HostComponent::Memory).ticks, 0);
+    ASSERT_EQ(0, profiler.At(HostComponent::Decode).ticks);
+    HostProfiler::Counters total = profiler.Total();
+    ASSERT_EQ(total.ticks, profiler.At(HostComponent::Loop).ticks + profiler.At(HostComponent::Execute).ticks +
+                           profiler.At(HostComponent::Memory).ticks);
+
+    std::ostringstream report;
+    profiler.Report(report, 100);
+    ASSERT_NE(std::string::npos, report.str().find("execute"));
+}
@@ -0,0 +1,102 @@
+#include "gtest/gtest.h"
+#include "../src/Cpu.h"
+#include "../src/IntervalStats.h"
+
+#include <limits>
+#include <sstream>
+#include <vector>
+
+
+TEST(tests, IntervalsMergeWhenFull) {
+    IntervalStats intervals(10, 4);
+    IntervalStats::Totals totals;
+    uint64_t end = intervals.Interval();
+    for (uint64_t i = 1; i <= 4; i++)
+    {
+        ASSERT_EQ(10 * i, end);
+        totals.cycles = end;
+        totals.instructions = 5 * i;
+        end = intervals.Record(totals);
+    }
+    // four intervals of 10 cycles became two of 20
+    ASSERT_EQ(2, intervals.Size());
+    ASSERT_EQ(20, intervals.Interval());
+    ASSERT_EQ(60, end);
+    ASSERT_EQ(20, intervals.At(IntervalStats::EndCycle, 0));
+    ASSERT_EQ(40, intervals.At(IntervalStats::EndCycle, 1));
+    ASSERT_EQ(20, intervals.At(IntervalStats::Cycles, 1));
+    ASSERT_EQ(10, intervals.At(IntervalStats::Instructions, 1));
+
+    // a partial interval at the end
+    totals.cycles = 45;
+    totals.instructions = 22;
+    intervals.Record(totals);
+    ASSERT_EQ(3, intervals.Size());
+    ASSERT_EQ(5, intervals.At(IntervalStats::Cycles, 2));
+    ASSERT_EQ(2, intervals.At(IntervalStats::Instructions, 2));
+
+    std::ostringstream csv;
+    intervals.WriteCsv(csv);
+    std::string text = csv.str();
+    ASSERT_EQ(4, std::count(text.begin(), text.end(), '\n'));
+    ASSERT_NE(std::string::npos, text.find("\n45,5,2,0.4000,"));
+
+    std::ostringstream binary;
+    intervals.WriteBinary(binary);
+    ASSERT_EQ(32 + 8 * IntervalStats::ColumnCount * 3, binary.str().size());
+    ASSERT_EQ("RVIS", binary.str().substr(0, 4));
+}
+
+TEST(tests, IntervalsUseTheCacheLineSize) {
+    IntervalStats intervals(10, 4, 32);
+    IntervalStats::Totals totals;
+    totals.cycles = 10;
+    totals.icacheMisses = 1;
+    totals.dcacheMisses = 2;
+    intervals.Record(totals);
+
+    std::ostringstream csv;
+    intervals.WriteCsv(csv);
+    // three line fills of 32 bytes
+    ASSERT_NE(std::string::npos, csv.str().find(",96,9.6000\n"));
+
+    std::ostringstream binary;
+    intervals.WriteBinary(binary);
+    ASSERT_EQ(32, uint8_t(binary.str()[12]));
+}
+
+TEST(tests, IntervalsCoverTheRun) {
+    const std::vector<Word> program = {
+        0x3e800293,  // li t0, 1000
+        0xfff28293,  // 1: addi t0, t0, -1
+        0xfe029ee3,  // bnez t0, 1b
+        0x78001073,  // csrw mtohost, zero: exit 0
+        0x0000006f,  // j .
+    };
+    MemoryStorage mem;
+    for (size_t i = 0; i < program.size(); i++)
+        mem.Write(0x200 + 4 * i, program[i]);
+    CachedMem cache(mem);
+    Cpu cpu(cache);
+    IntervalStats intervals(100);
+    cpu.UseIntervals(&intervals);
+    cpu.Reset(0x200);
+    ASSERT_EQ(StopReason::Exit, cpu.Run(std::numeric_limits<uint64_t>::max()));
+    cpu.SampleIntervals();
+
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t misses = 0;
+    for (size_t i = 0; i < intervals.Size(); i++)
+    {
+        cycles += intervals.At(IntervalStats::Cycles, i);
+        instructions += intervals.At(IntervalStats::Instructions, i);
+        misses += intervals.At(IntervalStats::ICacheMisses, i);
+    }
+    ASSERT_EQ(cpu.Cycles() / 100 + 1, intervals.Size());
+    ASSERT_EQ(cpu.Cycles(), cycles);
+    ASSERT_EQ(cpu.Instructions(), instructions);
+    ASSERT_EQ(cache.getCodeStats().misses, misses);
+    // the cold misses all fall into the first interval
+    ASSERT_EQ(misses, intervals.At(IntervalStats::ICacheMisses, 0));
+}
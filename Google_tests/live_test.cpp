@@ -0,0 +1,44 @@
+#include "gtest/gtest.h"
+#include "../src/LiveStats.h"
+
+#include <filesystem>
+
+
+TEST(tests, LiveStatsPublish) {
+    std::string dir = std::filesystem::temp_directory_path().string();
+    std::string path;
+    {
+        LiveStats live;
+        ASSERT_TRUE(live.Open("dir/prog.riscv", dir));
+        path = live.Path();
+        ASSERT_TRUE(std::filesystem::exists(path));
+
+        int fd = open(path.c_str(), O_RDONLY);
+        ASSERT_GE(fd, 0);
+        void* mapping = mmap(nullptr, sizeof(LiveStats::Segment), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        ASSERT_NE(MAP_FAILED, mapping);
+        const auto& segment = *static_cast<const LiveStats::Segment*>(mapping);
+        ASSERT_EQ(0, memcmp(segment.magic, LiveStats::magic, sizeof(LiveStats::magic)));
+        ASSERT_STREQ("dir/prog.riscv", segment.program);
+
+        uint64_t values[LiveStats::FieldCount];
+        ASSERT_TRUE(LiveStats::Read(segment, values));
+        ASSERT_EQ(uint64_t(getpid()), values[LiveStats::Pid]);
+        ASSERT_EQ(0, values[LiveStats::Cycles]);
+
+        live.Set(LiveStats::Cycles, 1000);
+        live.Set(LiveStats::Instructions, 750);
+        live.Set(LiveStats::Ip, 0x200);
+        live.Publish();
+        ASSERT_TRUE(LiveStats::Read(segment, values));
+        ASSERT_EQ(1000, values[LiveStats::Cycles]);
+        ASSERT_EQ(750, values[LiveStats::Instructions]);
+        ASSERT_EQ(0x200, values[LiveStats::Ip]);
+        ASSERT_GE(values[LiveStats::UpdateNs], values[LiveStats::StartNs]);
+        // even once the update is done
+        ASSERT_EQ(0, segment.sequence.load() % 2);
+        munmap(mapping, sizeof(LiveStats::Segment));
+    }
+    ASSERT_FALSE(std::filesystem::exists(path));
+}
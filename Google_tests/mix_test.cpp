@@ -0,0 +1,53 @@
+#include "gtest/gtest.h"
+#include "../src/Cpu.h"
+#include "../src/InstrMix.h"
+
+#include <limits>
+#include <sstream>
+#include <vector>
+
+
+TEST(tests, InstrMixCountsRetired) {
+    const std::vector<Word> program = {
+        0x00300293,  // li t0, 3
+        0xfff28293,  // 1: addi t0, t0, -1
+        0xfe029ee3,  // bnez t0, 1b
+        0x00001537,  // lui a0, 1
+        0x00552023,  // sw t0, 0(a0)
+        0x00052303,  // lw t1, 0(a0)
+        0x78031073,  // csrw mtohost, t1: exit 0
+        0x0000006f,  // j .
+    };
+    MemoryStorage mem;
+    for (size_t i = 0; i < program.size(); i++)
+        mem.Write(0x200 + 4 * i, program[i]);
+    FlatMem flat(mem);
+    Cpu cpu(flat);
+    InstrMix mix;
+    cpu.UseInstrMix(&mix);
+    cpu.Reset(0x200);
+    ASSERT_EQ(StopReason::Exit, cpu.Run(std::numeric_limits<uint64_t>::max()));
+
+    ASSERT_EQ(11, mix.Instructions());
+    ASSERT_EQ(cpu.Instructions(), mix.Instructions());
+    ASSERT_EQ(4, mix.Count(Handler::Addi));
+    ASSERT_EQ(3, mix.Count(Handler::Bne));
+    ASSERT_EQ(2, mix.Taken(Handler::Bne));
+    // lui is an ALU op
+    ASSERT_EQ(5, mix.CountType(IType::Alu));
+    ASSERT_EQ(3, mix.CountType(IType::Br));
+    ASSERT_EQ(1, mix.CountType(IType::Csrw));
+    ASSERT_EQ(4, mix.LoadBytes());
+    ASSERT_EQ(4, mix.StoreBytes());
+
+    // the loop reads t0 one or two instructions after writing it, sw three
+    const std::array<uint64_t, InstrMix::distanceBuckets>& distances = mix.Distances();
+    ASSERT_EQ(6, distances[0]);
+    ASSERT_EQ(3, distances[1]);
+    ASSERT_EQ(1, distances[2]);
+    ASSERT_EQ(0, distances[3]);
+
+    std::ostringstream report;
+    mix.Report(report);
+    ASSERT_NE(std::string::npos, report.str().find("bne"));
+}
@@ -0,0 +1,116 @@
+#include "gtest/gtest.h"
+#include "../src/Decoder.h"
+#include "../src/Executor.h"
+#include "../src/Cpu.h"
+
+#include <limits>
+#include <vector>
+
+
+static Word EncodeMulDiv(Word funct3, Word rd, Word rs1, Word rs2)
+{
+    return (1u << 25u) | (rs2 << 20u) | (rs1 << 15u) | (funct3 << 12u) | (rd << 7u) | Word(Opcode::Op);
+}
+
+static Word MulDiv(Word funct3, Word op1, Word op2)
+{
+    Decoder decoder;
+    Executor exe;
+    Instruction instr = decoder.Decode(EncodeMulDiv(funct3, 5, 6, 7));
+    InstrState state;
+    state._src1Val = op1;
+    state._src2Val = op2;
+    exe.Execute(instr, state, 0x200);
+    return state._data;
+}
+
+static Word EncodeAdd(Word rd, Word rs1, Word rs2)
+{
+    return (rs2 << 20u) | (rs1 << 15u) | (rd << 7u) | Word(Opcode::Op);
+}
+
+// Runs the body and an exit on flat memory, where nothing waits for
+// memory, and returns the cycles the scoreboard held instructions back
+static uint64_t StallCycles(const std::vector<Word>& body, const TimingConfig& timing)
+{
+    std::vector<Word> program = body;
+    program.push_back(0x78001073);  // csrw mtohost, zero: exit 0
+    program.push_back(0x0000006f);  // j .
+    MemoryStorage mem;
+    for (size_t i = 0; i < program.size(); i++)
+        mem.Write(0x200 + 4 * i, program[i]);
+    FlatMem flat(mem);
+    Cpu cpu(flat, 0, timing);
+    cpu.Reset(0x200);
+    EXPECT_EQ(StopReason::Exit, cpu.Run(std::numeric_limits<uint64_t>::max()));
+    return cpu.Cycles() - cpu.Instructions();
+}
+
+TEST(tests, DecodeMulDiv) {
+    Decoder decoder;
+
+    Instruction mul = decoder.Decode(EncodeMulDiv(0b000, 5, 6, 7));
+    Instruction remu = decoder.Decode(EncodeMulDiv(0b111, 5, 6, 7));
+
+    ASSERT_EQ(IType::Alu, mul._type);
+    ASSERT_EQ(AluFunc::Mul, mul._aluFunc);
+    ASSERT_EQ(AluFunc::Remu, remu._aluFunc);
+}
+
+TEST(tests, ExecuteMul) {
+    ASSERT_EQ(42, MulDiv(0b000, 6, 7));
+    ASSERT_EQ(0xffffffff, MulDiv(0b001, (Word)-2, 0x40000000));
+    ASSERT_EQ(0xffffffff, MulDiv(0b010, (Word)-1, 0xffffffff));
+    ASSERT_EQ(0xfffffffe, MulDiv(0b011, 0xffffffff, 0xffffffff));
+}
+
+TEST(tests, ExecuteDiv) {
+    ASSERT_EQ((Word)-3, MulDiv(0b100, (Word)-7, 2));
+    ASSERT_EQ((Word)-1, MulDiv(0b100, 7, 0));
+    ASSERT_EQ(0x80000000, MulDiv(0b100, 0x80000000, (Word)-1));
+    ASSERT_EQ(0xffffffff, MulDiv(0b101, 7, 0));
+    ASSERT_EQ((Word)-1, MulDiv(0b110, (Word)-7, 2));
+    ASSERT_EQ(7, MulDiv(0b110, 7, 0));
+    ASSERT_EQ(0, MulDiv(0b110, 0x80000000, (Word)-1));
+    ASSERT_EQ(1, MulDiv(0b111, 7, 2));
+}
+
+TEST(tests, MulResultWaitsLatency) {
+    TimingConfig timing;
+    timing.mul = {5, true};
+    // mul t1, t2, t3; add t4, t1, t1
+    std::vector<Word> dependent = {EncodeMulDiv(0b000, 6, 7, 28), EncodeAdd(29, 6, 6)};
+    // mul t1, t2, t3; add t4, t2, t2
+    std::vector<Word> independent = {EncodeMulDiv(0b000, 6, 7, 28), EncodeAdd(29, 7, 7)};
+
+    // the add issues the cycle after the mul, latency - 1 cycles early
+    ASSERT_EQ(4, StallCycles(dependent, timing));
+    ASSERT_EQ(0, StallCycles(independent, timing));
+    timing.mul.latency = 15;
+    ASSERT_EQ(14, StallCycles(dependent, timing));
+}
+
+TEST(tests, PipelinedMulAcceptsEveryCycle) {
+    TimingConfig timing;
+    timing.mul = {5, true};
+    // mul t1, t2, t3; mul t4, t2, t3
+    std::vector<Word> muls = {EncodeMulDiv(0b000, 6, 7, 28), EncodeMulDiv(0b000, 29, 7, 28)};
+
+    ASSERT_EQ(0, StallCycles(muls, timing));
+    timing.mul.pipelined = false;
+    ASSERT_EQ(4, StallCycles(muls, timing));
+}
+
+TEST(tests, DividerBlocksNextDiv) {
+    TimingConfig timing;
+    timing.div = {10, false};
+    // div t1, t2, t3; div t4, t2, t3
+    std::vector<Word> divs = {EncodeMulDiv(0b100, 6, 7, 28), EncodeMulDiv(0b100, 29, 7, 28)};
+    // div t1, t2, t3; mul t4, t2, t3: the units are separate
+    std::vector<Word> divMul = {EncodeMulDiv(0b100, 6, 7, 28), EncodeMulDiv(0b000, 29, 7, 28)};
+
+    ASSERT_EQ(9, StallCycles(divs, timing));
+    ASSERT_EQ(0, StallCycles(divMul, timing));
+    timing.div.pipelined = true;
+    ASSERT_EQ(0, StallCycles(divs, timing));
+}
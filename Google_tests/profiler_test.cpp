@@ -0,0 +1,161 @@
+#include "gtest/gtest.h"
+#include "../src/Cpu.h"
+#include "../src/DataProfiler.h"
+#include "../src/Elf.h"
+#include "../src/Profiler.h"
+
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+static const std::vector<Word> callProgram = {
+    0x00c000ef,  // _start: jal ra, f
+    0x78001073,  //         csrw mtohost, zero
+    0x0000006f,  //         j .
+    0x00150513,  // f:      addi a0, a0, 1
+    0x00008067,  //         ret
+};
+
+template <typename T>
+static size_t Append(std::vector<char>& buf, const T* data, size_t size)
+{
+    size_t offset = buf.size();
+    buf.insert(buf.end(), reinterpret_cast<const char*>(data), reinterpret_cast<const char*>(data) + size);
+    return offset;
+}
+
+// An ELF file with callProgram at 0x200, symbols for _start and f and a
+// 64-byte object at 0x1000
+static std::string WriteCallElf()
+{
+    const char strtab[] = "\0_start\0f\0table";
+    const char shstrtab[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+    Elf32_Sym syms[4] = {};
+    syms[1] = {1, 0x200, 12, ELF32_ST_INFO(STB_GLOBAL, STT_FUNC), 0, 1};
+    syms[2] = {8, 0x20c, 8, ELF32_ST_INFO(STB_GLOBAL, STT_FUNC), 0, 1};
+    syms[3] = {10, 0x1000, 64, ELF32_ST_INFO(STB_GLOBAL, STT_OBJECT), 0, SHN_ABS};
+
+    std::vector<char> buf(sizeof(Elf32_Ehdr));
+    size_t text = Append(buf, callProgram.data(), callProgram.size() * sizeof(Word));
+    size_t symtab = Append(buf, syms, sizeof(syms));
+    size_t strings = Append(buf, strtab, sizeof(strtab));
+    size_t names = Append(buf, shstrtab, sizeof(shstrtab));
+
+    Elf32_Shdr shdrs[5] = {};
+    shdrs[1] = {1, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, 0x200, Elf32_Off(text),
+                Word(callProgram.size() * sizeof(Word)), 0, 0, 4, 0};
+    shdrs[2] = {7, SHT_SYMTAB, 0, 0, Elf32_Off(symtab), sizeof(syms), 3, 1, 4, sizeof(Elf32_Sym)};
+    shdrs[3] = {15, SHT_STRTAB, 0, 0, Elf32_Off(strings), sizeof(strtab), 0, 0, 1, 0};
+    shdrs[4] = {23, SHT_STRTAB, 0, 0, Elf32_Off(names), sizeof(shstrtab), 0, 0, 1, 0};
+    size_t shoff = Append(buf, shdrs, sizeof(shdrs));
+
+    Elf32_Ehdr ehdr = {};
+    std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS32;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_type = ET_EXEC;
+    ehdr.e_machine = EM_RISCV;
+    ehdr.e_shoff = shoff;
+    ehdr.e_ehsize = sizeof(Elf32_Ehdr);
+    ehdr.e_shentsize = sizeof(Elf32_Shdr);
+    ehdr.e_shnum = 5;
+    ehdr.e_shstrndx = 4;
+    std::memcpy(buf.data(), &ehdr, sizeof(ehdr));
+
+    std::string path = testing::TempDir() + "profiler_test.elf";
+    FILE* file = fopen(path.c_str(), "wb");
+    fwrite(buf.data(), 1, buf.size(), file);
+    fclose(file);
+    return path;
+}
+
+TEST(tests, ElfSymbols) {
+    ElfFile elf;
+    ASSERT_TRUE(elf.Load(WriteCallElf()));
+
+    ASSERT_EQ(2, elf.Symbols().size());
+    ASSERT_EQ("_start", elf.FindSymbol(0x208)->name);
+    ASSERT_EQ("f", elf.FindSymbol(0x210)->name);
+    ASSERT_EQ(nullptr, elf.FindSymbol(0x214));
+    ASSERT_EQ(nullptr, elf.FindSymbol(0x100));
+    ASSERT_EQ(1, elf.Objects().size());
+    ASSERT_EQ("table", elf.FindObject(0x103c)->name);
+    ASSERT_EQ(nullptr, elf.FindObject(0x1040));
+}
+
+TEST(tests, ProfilerFollowsCalls) {
+    ElfFile elf;
+    ASSERT_TRUE(elf.Load(WriteCallElf()));
+    MemoryStorage mem;
+    for (size_t i = 0; i < callProgram.size(); i++)
+        mem.Write(0x200 + 4 * i, callProgram[i]);
+
+    Profiler profiler(elf);
+    FlatMem flat(mem);
+    Cpu cpu(flat);
+    cpu.UseProfiler(&profiler);
+    cpu.Reset(0x200);
+    ASSERT_EQ(StopReason::Exit, cpu.Run(std::numeric_limits<uint64_t>::max()));
+
+    ASSERT_EQ(4, profiler.Total().instructions);
+    ASSERT_EQ(cpu.Cycles(), profiler.Total().cycles);
+    std::vector<Profiler::FunctionProfile> functions = profiler.Functions();
+    ASSERT_EQ(2, functions.size());
+    for (const Profiler::FunctionProfile& function : functions)
+    {
+        ASSERT_EQ(2, function.self.instructions);
+        ASSERT_EQ(function.name == "_start" ? 4 : 2, function.inclusive.instructions);
+    }
+
+    std::ostringstream stacks;
+    profiler.WriteCollapsed(stacks);
+    ASSERT_NE(std::string::npos, stacks.str().find("_start;f "));
+}
+
+TEST(tests, DataProfilerAttributesObjects) {
+    ElfFile elf;
+    ASSERT_TRUE(elf.Load(WriteCallElf()));
+    Decoder decoder;
+    Instruction load = decoder.Decode(0x0005a503);   // lw a0, 0(a1)
+    Instruction store = decoder.Decode(0x00a5a023);  // sw a0, 0(a1)
+
+    DataProfiler data(elf);
+    // the initial sp, then a frame
+    data.StackPointer(0x8100);
+    data.StackPointer(0x8000);
+    InstrState state;
+    state._addr = 0x1000;
+    data.Access(load, state, 140, 1, 0);
+    state._addr = 0x1004;
+    data.Access(load, state, 2, 0, 0);
+    data.Access(store, state, 1, 0, 0);
+    state._addr = 0x8010;
+    data.Access(store, state, 1, 0, 0);
+    state._addr = 0x4000;
+    data.Access(load, state, 1, 0, 0);
+    // above the stack
+    state._addr = 0x8200;
+    data.Access(load, state, 1, 0, 0);
+
+    std::vector<DataProfiler::ObjectStats> objects = data.Objects();
+    ASSERT_EQ(4, objects.size());
+    ASSERT_EQ("table", objects[0].name);
+    ASSERT_EQ(2, objects[0].loads);
+    ASSERT_EQ(1, objects[0].stores);
+    ASSERT_EQ(1, objects[0].misses);
+    ASSERT_EQ(140, objects[0].stallCycles);
+    ASSERT_EQ(8, objects[0].bytesTouched);
+    ASSERT_EQ(2, objects[0].reuses);
+    ASSERT_EQ(2, objects[0].reuseInterval);
+    ASSERT_EQ("[stack]", objects[1].name);
+    ASSERT_EQ("[heap]", objects[2].name);
+    ASSERT_EQ("[other]", objects[3].name);
+
+    std::ostringstream report;
+    data.Report(report);
+    ASSERT_NE(std::string::npos, report.str().find("         -        -"));
+}
@@ -0,0 +1,45 @@
+#include "gtest/gtest.h"
+#include "../src/ResultCache.h"
+
+#include <filesystem>
+
+
+TEST(tests, ResultCacheRoundTrip) {
+    std::string dir = std::filesystem::temp_directory_path().string() + "/result_cache_test." +
+                      std::to_string(getpid());
+    ResultCache cache(dir, 1);
+    SimOptions options;
+    std::vector<char> elf = {'\x7f', 'E', 'L', 'F', 1, 2, 3};
+    std::string key = ResultCache::Key(elf, options, 1);
+    ASSERT_FALSE(cache.Lookup(key, options).has_value());
+
+    SimResult r;
+    r.status = SimStatus::Failed;
+    r.exitCode = 3;
+    r.cycles = 1234;
+    r.instructions = 1000;
+    r.dataStats.accesses = 40;
+    r.dataStats.misses = 4;
+    r.output = "line one\nline\ttwo\n";
+    cache.Store(key, options, r);
+    std::optional<SimResult> hit = cache.Lookup(key, options);
+    ASSERT_TRUE(hit.has_value());
+    ASSERT_TRUE(hit->cached);
+    ASSERT_TRUE(ResultCache::SameResult(r, *hit));
+
+    // another configuration or build has a key of its own, and an entry
+    // is not taken for the wrong one
+    SimOptions other;
+    other.cache.dataWays = 15;
+    ASSERT_NE(key, ResultCache::Key(elf, other, 1));
+    ASSERT_NE(key, ResultCache::Key(elf, options, 2));
+    ASSERT_FALSE(cache.Lookup(key, other).has_value());
+    ASSERT_FALSE(ResultCache(dir, 2).Lookup(key, options).has_value());
+
+    // nor are runs that depend on the host
+    r.status = SimStatus::TimeBudget;
+    std::string timedOut = ResultCache::Key(elf, other, 1);
+    cache.Store(timedOut, other, r);
+    ASSERT_FALSE(cache.Lookup(timedOut, other).has_value());
+    std::filesystem::remove_all(dir);
+}
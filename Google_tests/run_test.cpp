@@ -0,0 +1,185 @@
+#include "gtest/gtest.h"
+#include "../src/Cpu.h"
+
+#include <limits>
+#include <vector>
+
+
+static void LoadProgram(MemoryStorage& mem)
+{
+    const std::vector<Word> program = {
+        0x000102b7,  // lui t0, 0x10
+        0x04128293,  // addi t0, t0, 0x41
+        0x78029073,  // csrw mtohost, t0: print 'A'
+        0x78001073,  // csrw mtohost, zero: exit 0
+        0x0000006f,  // j .
+    };
+    for (size_t i = 0; i < program.size(); i++)
+        mem.Write(0x200 + 4 * i, program[i]);
+}
+
+TEST(tests, RunStopsOnMessages) {
+    MemoryStorage mem;
+    LoadProgram(mem);
+    CachedMem cache(mem);
+    Cpu cpu(cache);
+    cpu.Reset(0x200);
+
+    ASSERT_EQ(StopReason::Message, cpu.Run(std::numeric_limits<uint64_t>::max()));
+    std::optional<CpuToHostData> msg = cpu.GetMessage();
+    ASSERT_TRUE(msg.has_value());
+    ASSERT_EQ(CpuToHostType::PrintChar, msg->unpacked.type);
+    ASSERT_EQ('A', msg->unpacked.data);
+    ASSERT_EQ(3, cpu.Instructions());
+
+    ASSERT_EQ(StopReason::Exit, cpu.Run(std::numeric_limits<uint64_t>::max()));
+    msg = cpu.GetMessage();
+    ASSERT_TRUE(msg.has_value());
+    ASSERT_EQ(CpuToHostType::ExitCode, msg->unpacked.type);
+    ASSERT_EQ(4, cpu.Instructions());
+}
+
+TEST(tests, RunHonoursBudget) {
+    MemoryStorage mem;
+    LoadProgram(mem);
+    CachedMem cache(mem);
+    Cpu cpu(cache);
+    cpu.Reset(0x200);
+
+    ASSERT_EQ(StopReason::Budget, cpu.Run(std::numeric_limits<uint64_t>::max(), 1));
+    ASSERT_EQ(1, cpu.Instructions());
+    uint64_t cycles = cpu.Cycles();
+
+    ASSERT_EQ(StopReason::Budget, cpu.Run(1));
+    ASSERT_EQ(cycles + 1, cpu.Cycles());
+    ASSERT_FALSE(cpu.GetMessage().has_value());
+}
+
+TEST(tests, RunOnFlatMem) {
+    MemoryStorage mem;
+    LoadProgram(mem);
+    FlatMem flat(mem);
+    Cpu cpu(flat);
+    cpu.Reset(0x200);
+
+    ASSERT_EQ(StopReason::Message, cpu.Run(std::numeric_limits<uint64_t>::max()));
+    ASSERT_EQ('A', cpu.GetMessage()->unpacked.data);
+    ASSERT_EQ(StopReason::Exit, cpu.Run(std::numeric_limits<uint64_t>::max()));
+    // nothing waits for memory
+    ASSERT_EQ(cpu.Instructions(), cpu.Cycles());
+}
+
+TEST(tests, MakeCpuSelectsMemModel) {
+    MemoryStorage mem;
+    LoadProgram(mem);
+    uint64_t unlimited = std::numeric_limits<uint64_t>::max();
+
+    std::unique_ptr<ICpu> cached = MakeCpu(MemModel::Cached, mem);
+    std::unique_ptr<ICpu> flat = MakeCpu(MemModel::Flat, mem);
+    ASSERT_NE(nullptr, cached->Cache());
+    ASSERT_EQ(nullptr, flat->Cache());
+
+    cached->Reset(0x200);
+    flat->Reset(0x200);
+    ASSERT_EQ(StopReason::Message, cached->Run(unlimited, unlimited));
+    ASSERT_EQ(StopReason::Message, flat->Run(unlimited, unlimited));
+    ASSERT_EQ(cached->Instructions(), flat->Instructions());
+    ASSERT_LT(flat->Cycles(), cached->Cycles());
+}
+
+// Returns the cycle count the guest reads after a region of two adds
+static Word RunRoi(bool roi, uint64_t& hostCycles, uint64_t& instructions)
+{
+    const std::vector<Word> program = {
+        0x00100293,  // li t0, 1
+        0x00530313,  // addi t1, t1, 5
+        0x8c029073,  // csrw roi, t0: begin
+        0x00130313,  // addi t1, t1, 1
+        0x00130313,  // addi t1, t1, 1
+        0x8c001073,  // csrw roi, zero: end
+        0xc00023f3,  // csrr t2, cycle
+        0x78039073,  // csrw mtohost, t2
+        0x0000006f,  // j .
+    };
+    MemoryStorage mem;
+    for (size_t i = 0; i < program.size(); i++)
+        mem.Write(0x200 + 4 * i, program[i]);
+    CachedMem cache(mem);
+    Cpu cpu(cache);
+    if (roi)
+        cpu.UseRoi(mem);
+    cpu.Reset(0x200);
+    EXPECT_EQ(StopReason::Exit, cpu.Run(100000));
+    hostCycles = cpu.Cycles();
+    instructions = cpu.Instructions();
+    return cpu.GetMessage()->payload;
+}
+
+TEST(tests, RoiLimitsTiming) {
+    uint64_t fullCycles = 0;
+    uint64_t roiCycles = 0;
+    uint64_t fullInstructions = 0;
+    uint64_t roiInstructions = 0;
+    Word full = RunRoi(false, fullCycles, fullInstructions);
+    Word region = RunRoi(true, roiCycles, roiInstructions);
+
+    ASSERT_EQ(8, fullInstructions);
+    ASSERT_EQ(8, roiInstructions);
+    ASSERT_EQ(region, roiCycles);
+    ASSERT_LT(0, region);
+    ASSERT_LT(region, full);
+
+    // an hpmcounter counting D-cache misses across a reset of the statistics
+    const std::vector<Word> program = {
+        0x00100293,  // li t0, 1
+        0x8c029073,  // csrw roi, t0: begin
+        0x00200293,  // li t0, 2
+        0x32329073,  // csrw mhpmevent3, t0: D-cache misses
+        0x00001337,  // lui t1, 1
+        0x00032383,  // lw t2, 0(t1)
+        0x04032383,  // lw t2, 64(t1)
+        0x8c029073,  // csrw roi, t0: reset the statistics
+        0x08032383,  // lw t2, 128(t1)
+        0xc0302e73,  // csrr t3, hpmcounter3
+        0x780e1073,  // csrw mtohost, t3
+        0x0000006f,  // j .
+    };
+    MemoryStorage mem;
+    for (size_t i = 0; i < program.size(); i++)
+        mem.Write(0x200 + 4 * i, program[i]);
+    CachedMem cache(mem);
+    Cpu cpu(cache);
+    cpu.UseRoi(mem);
+    cpu.Reset(0x200);
+    ASSERT_EQ(StopReason::Exit, cpu.Run(100000));
+    ASSERT_EQ(1, cpu.GetMessage()->payload);
+    ASSERT_EQ(1, cache.getDataStats().misses);
+}
+
+TEST(tests, UnsupportedInstructionDoesNotFallThrough) {
+    MemoryStorage mem;
+    mem.Write(0x200, 0x000102b7);  // lui t0, 0x10
+    mem.Write(0x204, 0xffffffff);  // not an instruction of the core
+    CachedMem cache(mem);
+    Cpu cpu(cache);
+    cpu.Reset(0x200);
+
+    // the core jumps to the poison address, outside memory, rather than
+    // running the previous instruction's next ip again and again
+    ASSERT_EQ(StopReason::Fault, cpu.Run(100000));
+    ASSERT_EQ(0xdeadbeaf, cpu.Ip());
+    ASSERT_EQ(2, cpu.Instructions());
+}
+
+TEST(tests, UnknownCsrReadsZero) {
+    MemoryStorage mem;
+    mem.Write(0x200, 0xc00022f3);  // csrr t0, cycle
+    mem.Write(0x204, 0x7c002373);  // csrr t1, 0x7c0: no such CSR
+    mem.Write(0x208, 0x78031073);  // csrw mtohost, t1: exit t1
+    CachedMem cache(mem);
+    Cpu cpu(cache);
+    cpu.Reset(0x200);
+
+    ASSERT_EQ(StopReason::Exit, cpu.Run(100000));
+    ASSERT_EQ(0, cpu.GetMessage()->unpacked.data);
+}
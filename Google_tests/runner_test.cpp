@@ -0,0 +1,99 @@
+#include "gtest/gtest.h"
+#include "../src/Simulation.h"
+#include "../src/WorkStealingPool.h"
+
+#include <atomic>
+#include <vector>
+
+
+static void LoadProgram(MemoryStorage& mem, Word exitCode)
+{
+    const std::vector<Word> program = {
+        0x000102b7,                 // lui t0, 0x10
+        0x04128293,                 // addi t0, t0, 0x41
+        0x78029073,                 // csrw mtohost, t0: print 'A'
+        (exitCode << 20u) | 0x293,  // addi t0, zero, exitCode
+        0x78029073,                 // csrw mtohost, t0: exit
+        0x0000006f,                 // j .
+    };
+    for (size_t i = 0; i < program.size(); i++)
+        mem.Write(0x200 + 4 * i, program[i]);
+}
+
+TEST(tests, PoolRunsEveryTaskOnce) {
+    std::vector<std::atomic<int>> runs(1000);
+    WorkStealingPool pool(4);
+    pool.Run(runs.size(), [&](size_t i) {
+        runs[i]++;
+    });
+    for (const std::atomic<int>& n : runs)
+        ASSERT_EQ(1, n.load());
+    pool.Run(0, [](size_t) { FAIL(); });
+}
+
+TEST(tests, SimulateReportsExit) {
+    MemoryStorage mem;
+    LoadProgram(mem, 0);
+    SimResult result = Simulate(mem, nullptr);
+    ASSERT_EQ(SimStatus::Passed, result.status);
+    ASSERT_EQ(0, result.exitCode);
+    ASSERT_EQ("A", result.output);
+    ASSERT_EQ(5, result.instructions);
+
+    MemoryStorage failing;
+    LoadProgram(failing, 3);
+    result = Simulate(failing, nullptr);
+    ASSERT_EQ(SimStatus::Failed, result.status);
+    ASSERT_EQ(3, result.exitCode);
+}
+
+TEST(tests, SimulateHonoursBudgets) {
+    MemoryStorage mem;
+    // j .
+    mem.Write(0x200, 0x0000006f);
+    SimOptions options;
+    options.maxCycles = 1000;
+    SimResult result = Simulate(mem, nullptr, options);
+    ASSERT_EQ(SimStatus::CycleBudget, result.status);
+    ASSERT_EQ(1000, result.cycles);
+
+    options.maxCycles = 0;
+    options.maxSeconds = 0.01;
+    result = Simulate(mem, nullptr, options);
+    ASSERT_EQ(SimStatus::TimeBudget, result.status);
+    ASSERT_GE(result.seconds, 0.01);
+
+    ASSERT_EQ(SimStatus::LoadError, SimulateFile("no such program").status);
+}
+
+TEST(tests, SimulateReportsAccessOutsideMemory) {
+    for (MemModel model : {MemModel::Cached, MemModel::Flat})
+    {
+        MemoryStorage mem;
+        mem.Write(0x200, 0x004002b7);  // lui t0, 0x400: the first address past the storage
+        mem.Write(0x204, 0x0082a303);  // lw t1, 8(t0)
+        mem.Write(0x208, 0x0000006f);  // j .
+        ASSERT_FALSE(mem.Faulted());
+        SimOptions options;
+        options.memModel = model;
+        options.maxCycles = 100000;
+        SimResult result = Simulate(mem, nullptr, options);
+        ASSERT_EQ(SimStatus::Fault, result.status);
+        ASSERT_EQ(Word(memSize * sizeof(Word)), result.faultAddress & ~Word(0x3f));
+        ASSERT_EQ(mem.FaultAddress(), result.faultAddress);
+    }
+}
+
+TEST(tests, StorageKeepsTheFirstFault) {
+    MemoryStorage mem;
+    Word end = memSize * sizeof(Word);
+    mem.Write(end - 4, 7);
+    ASSERT_EQ(7, mem.Read(end - 4));
+    ASSERT_EQ(std::nullopt, mem.FaultAddress());
+    mem.Write(end + 8, 1);
+    ASSERT_EQ(0, mem.Read(end + 8));
+    ASSERT_EQ(0, mem.Read(0xfffffffc));
+    ASSERT_EQ(end + 8, mem.FaultAddress());
+    // nothing wrapped around
+    ASSERT_EQ(0, mem.Read(8));
+}
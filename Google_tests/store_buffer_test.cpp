@@ -0,0 +1,44 @@
+#include "gtest/gtest.h"
+#include "../src/Memory.h"
+
+
+TEST(tests, StoreBufferForwardsOwnStores) {
+    MemoryStorage mem;
+    StoreBuffer stores;
+    mem.Write(512, 1);
+
+    stores.Write(512, 7);
+
+    ASSERT_EQ(7, stores.Read(mem, 512));
+    ASSERT_EQ(1, mem.Read(512));
+}
+
+TEST(tests, StoreBufferDrain) {
+    MemoryStorage mem;
+    StoreBuffer stores;
+
+    stores.Write(512, 7);
+    stores.Write(516, 8);
+    stores.Write(512, 9);
+    stores.Drain(mem);
+
+    ASSERT_EQ(9, mem.Read(512));
+    ASSERT_EQ(8, mem.Read(516));
+    ASSERT_EQ(0, stores.Read(mem, 520));
+}
+
+TEST(tests, BufferedStDataResp) {
+    MemoryStorage mem;
+    StoreBuffer stores;
+    CachedMem cache = CachedMem (mem, &stores);
+    Word ip1 = 576;
+    Word data1 = 5;
+
+    cache.Request(ip1, IType::St);
+    cache.setWaitCycles(0);
+
+    ASSERT_EQ(true, cache.Response(ip1, IType::St, data1));
+    ASSERT_EQ(0, mem.Read(ip1));
+    stores.Drain(mem);
+    ASSERT_EQ(5, mem.Read(ip1));
+}
@@ -0,0 +1,132 @@
+#include "../src/Decoder.h"
+#include "../src/Elf.h"
+#include "SwitchDecoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+// Decodes the text of every test program with the table-driven Decoder and
+// with the switch-based one it replaced, checks that they agree and reports
+// the time per instruction of both: once in program order, and once
+// shuffled with a fixed seed, which defeats the branch predictor the way a
+// running program's control flow does. The bulk path that predecodes whole
+// sections is timed as well.
+// usage: decode_bench [program.riscv...]
+
+static bool SameFields(const Instruction& a, const Instruction& b)
+{
+    return a._type == b._type && a._aluFunc == b._aluFunc && a._brFunc == b._brFunc &&
+           a._amoFunc == b._amoFunc && a._dst == b._dst && a._src1 == b._src1 && a._src2 == b._src2 &&
+           a._flags == b._flags && a._csr == b._csr && a._size == b._size && a._imm == b._imm;
+}
+
+// Decoder::DecodeBlock, as used to predecode a text section
+struct BlockDecoder
+{
+    std::vector<Instruction> out;
+
+    double NsPerInstr(const std::vector<Word>& words, Word& sink)
+    {
+        using Clock = std::chrono::steady_clock;
+        out.resize(words.size());
+        size_t decoded = 0;
+        Clock::time_point start = Clock::now();
+        Clock::duration elapsed{};
+        while (elapsed < std::chrono::milliseconds(300))
+        {
+            Decoder::DecodeBlock(words.data(), words.size(), out.data());
+            sink += out.back()._imm;
+            decoded += words.size();
+            elapsed = Clock::now() - start;
+        }
+        return std::chrono::duration<double, std::nano>(elapsed).count() / decoded;
+    }
+};
+
+template <typename DecoderT>
+static double NsPerInstr(DecoderT& decoder, const std::vector<Word>& words, Word& sink)
+{
+    using Clock = std::chrono::steady_clock;
+    size_t decoded = 0;
+    Clock::time_point start = Clock::now();
+    Clock::duration elapsed{};
+    while (elapsed < std::chrono::milliseconds(300))
+    {
+        for (Word word : words)
+        {
+            Instruction instr = decoder.Decode(word);
+            sink += instr._imm ^ instr._dst ^ Word(instr._type);
+        }
+        decoded += words.size();
+        elapsed = Clock::now() - start;
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / decoded;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> programs(argv + 1, argv + argc);
+    if (programs.empty())
+    {
+        for (const auto& dir : std::filesystem::directory_iterator(PROGRAMS_DIR))
+        {
+            std::filesystem::path bin = dir.path() / "bin";
+            if (!std::filesystem::is_directory(bin))
+                continue;
+            for (const auto& file : std::filesystem::directory_iterator(bin))
+            {
+                if (file.path().extension() == ".riscv")
+                    programs.push_back(file.path());
+            }
+        }
+    }
+
+    std::vector<Word> words;
+    for (const std::string& program : programs)
+    {
+        ElfFile elf;
+        if (!elf.Load(program))
+            return 1;
+        std::vector<Word> text = elf.Instructions();
+        words.insert(words.end(), text.begin(), text.end());
+    }
+    if (words.empty())
+    {
+        fprintf(stderr, "no instructions found\n");
+        return 1;
+    }
+
+    Decoder table;
+    SwitchDecoder reference;
+    size_t mismatches = 0;
+    for (Word word : words)
+    {
+        Instruction expected = reference.Decode(word);
+        // the decoders may differ on illegal encodings only
+        if (expected._type != IType::Unsupported && !SameFields(table.Decode(word), expected))
+        {
+            if (mismatches++ < 10)
+                fprintf(stderr, "mismatch on %08x\n", word);
+        }
+    }
+
+    printf("%zu programs, %zu instructions, %zu mismatches\n", programs.size(), words.size(), mismatches);
+    Word sink = 0;
+    std::vector<Word> shuffled = words;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+    for (const auto& [order, input] : {std::make_pair("in order", &words), std::make_pair("shuffled", &shuffled)})
+    {
+        double switchNs = NsPerInstr(reference, *input, sink);
+        double tableNs = NsPerInstr(table, *input, sink);
+        printf("%s: switch decoder %.2f ns/instr, table decoder %.2f ns/instr (%.2fx)\n",
+               order, switchNs, tableNs, switchNs / tableNs);
+    }
+    BlockDecoder block;
+    printf("block decoder: %.2f ns/instr\n", block.NsPerInstr(words, sink));
+    return mismatches != 0 || sink == 0xdeadbeef;
+}
@@ -0,0 +1,227 @@
+#include "../src/Arena.h"
+#include "../src/Decoder.h"
+#include "../src/Elf.h"
+#include "../src/Executor.h"
+#include "../src/Memory.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+// Microbenchmarks of the hot components, each on its own, so a regression
+// shows up in the component that caused it. Inputs are the instructions of
+// the test programs and pseudo-random values from a fixed seed, so every run
+// times the same work.
+
+static constexpr unsigned seed = 42;
+
+// The instruction words of every test program, shuffled, as a realistic mix
+static const std::vector<Word>& ProgramWords()
+{
+    static const std::vector<Word> words = [] {
+        std::vector<Word> all;
+        for (const char* dir : {"assembly", "smallbenchmarks", "bigbenchmarks"})
+        {
+            std::filesystem::path bin = std::filesystem::path(PROGRAMS_DIR) / dir / "bin";
+            if (!std::filesystem::is_directory(bin))
+                continue;
+            std::vector<std::filesystem::path> files;
+            for (const auto& file : std::filesystem::directory_iterator(bin))
+            {
+                if (file.path().extension() == ".riscv")
+                    files.push_back(file.path());
+            }
+            std::sort(files.begin(), files.end());
+            for (const std::filesystem::path& file : files)
+            {
+                ElfFile elf;
+                if (!elf.Load(file.string()))
+                    continue;
+                std::vector<Word> text = elf.Instructions();
+                all.insert(all.end(), text.begin(), text.end());
+            }
+        }
+        std::shuffle(all.begin(), all.end(), std::mt19937(seed));
+        return all;
+    }();
+    return words;
+}
+
+static void BM_Decode(benchmark::State& state)
+{
+    const std::vector<Word>& words = ProgramWords();
+    if (words.empty())
+    {
+        state.SkipWithError("no test programs found");
+        return;
+    }
+    Decoder decoder;
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(decoder.Decode(words[i]));
+        if (++i == words.size())
+            i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Decode);
+
+static void BM_DecodeBlock(benchmark::State& state)
+{
+    const std::vector<Word>& words = ProgramWords();
+    std::vector<Instruction> out(words.size());
+    for (auto _ : state)
+    {
+        Decoder::DecodeBlock(words.data(), words.size(), out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * words.size());
+}
+BENCHMARK(BM_DecodeBlock);
+
+// The decoded program instructions of one IType, with random operands
+static void BM_Execute(benchmark::State& state, IType type)
+{
+    std::vector<Instruction> instrs;
+    Decoder decoder;
+    for (Word word : ProgramWords())
+    {
+        Instruction instr = decoder.Decode(word);
+        if (instr._type == type)
+            instrs.push_back(instr);
+    }
+    if (instrs.empty())
+    {
+        state.SkipWithError("no instructions of this type in the test programs");
+        return;
+    }
+    std::mt19937 random(seed);
+    std::vector<InstrState> states(1024);
+    for (InstrState& s : states)
+    {
+        s._src1Val = random();
+        s._src2Val = random();
+        s._csrVal = random();
+        s._data = random();
+    }
+
+    Executor executor;
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        InstrState s = states[i % states.size()];
+        executor.Execute(instrs[i % instrs.size()], s, 0x200 + 4 * (i % 1024));
+        benchmark::DoNotOptimize(s);
+        i++;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_Execute, alu, IType::Alu);
+BENCHMARK_CAPTURE(BM_Execute, load, IType::Ld);
+BENCHMARK_CAPTURE(BM_Execute, store, IType::St);
+BENCHMARK_CAPTURE(BM_Execute, jump, IType::J);
+BENCHMARK_CAPTURE(BM_Execute, jump_reg, IType::Jr);
+BENCHMARK_CAPTURE(BM_Execute, branch, IType::Br);
+BENCHMARK_CAPTURE(BM_Execute, csr_read, IType::Csrr);
+BENCHMARK_CAPTURE(BM_Execute, csr_write, IType::Csrw);
+
+// One data access through the cache, including the cycles it waits, at
+// random word addresses in a working set of state.range(0) bytes; the
+// D-cache holds 4 KiB
+static void BM_CachedMemLoad(benchmark::State& state)
+{
+    size_t workingSet = state.range(0);
+    std::mt19937 random(seed);
+    std::vector<Word> addrs(4096);
+    for (Word& addr : addrs)
+        addr = 0x10000 + (random() % (workingSet / sizeof(Word))) * sizeof(Word);
+
+    MemoryStorage mem;
+    CachedMem cache(mem);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        Word addr = addrs[i++ % addrs.size()];
+        Word data = 0;
+        cache.Request(addr, IType::Ld);
+        while (!cache.Response(addr, IType::Ld, data))
+            cache.Clock();
+        cache.Clock();
+        benchmark::DoNotOptimize(data);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["miss%"] = 100.0 * cache.getDataStats().misses / std::max<uint64_t>(cache.getDataStats().accesses, 1);
+}
+BENCHMARK(BM_CachedMemLoad)->ArgName("bytes")->Arg(1 << 10)->Arg(4 << 10)->Arg(16 << 10)->Arg(256 << 10);
+
+// Fetches from a loop body of state.range(0) bytes; the I-cache holds 512
+static void BM_CachedMemFetch(benchmark::State& state)
+{
+    size_t body = state.range(0);
+    MemoryStorage mem;
+    CachedMem cache(mem);
+    Word ip = 0x200;
+    for (auto _ : state)
+    {
+        cache.Request(ip);
+        std::optional<Word> word;
+        while (!(word = cache.Response()))
+            cache.Clock();
+        cache.Clock();
+        benchmark::DoNotOptimize(word);
+        ip = ip + 4 < 0x200 + body ? ip + 4 : 0x200;
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["miss%"] = 100.0 * cache.getCodeStats().misses / std::max<uint64_t>(cache.getCodeStats().accesses, 1);
+}
+BENCHMARK(BM_CachedMemFetch)->ArgName("bytes")->Arg(256)->Arg(512)->Arg(4 << 10);
+
+// An allocation and a free of state.range(0) bytes, served by a free list
+static void BM_ArenaAllocateFree(benchmark::State& state)
+{
+    size_t size = state.range(0);
+    Arena arena;
+    for (auto _ : state)
+    {
+        void* p = arena.Allocate(size);
+        benchmark::DoNotOptimize(p);
+        arena.Deallocate(p, size);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ArenaAllocateFree)->ArgName("bytes")->Arg(16)->Arg(64)->Arg(256)->Arg(4096);
+
+// Random allocations and frees of cache-line-sized and smaller chunks, with
+// up to state.range(0) of them alive, as the caches churn their lines
+static void BM_ArenaChurn(benchmark::State& state)
+{
+    size_t live = state.range(0);
+    std::mt19937 random(seed);
+    std::vector<size_t> sizes(4096);
+    for (size_t& size : sizes)
+        size = 8 << (random() % 4);
+    Arena arena;
+    std::vector<std::pair<void*, size_t>> chunks;
+    chunks.reserve(live);
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        if (chunks.size() == live)
+        {
+            size_t victim = random() % live;
+            arena.Deallocate(chunks[victim].first, chunks[victim].second);
+            chunks[victim] = chunks.back();
+            chunks.pop_back();
+        }
+        size_t size = sizes[i++ % sizes.size()];
+        chunks.emplace_back(arena.Allocate(size), size);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ArenaChurn)->ArgName("live")->Arg(64)->Arg(4096);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,345 @@
+#include "../src/Cpu.h"
+#include "../src/DecodedText.h"
+#include "../src/Elf.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Simulator throughput. Runs every test program under each engine
+// (predecoded text or decoding on every fetch) and memory model, each in a
+// child process of its own so its peak RSS can be taken and a crash does
+// not end the suite, and reports simulated MIPS, host ns per simulated
+// instruction and peak RSS. The fastest of -repeat runs counts; short
+// programs are repeated until they ran for -min-time milliseconds.
+// With -baseline the results are compared with a file written earlier by
+// -write-baseline; the suite fails if a run got slower or bigger than the
+// thresholds allow, in percent, or stopped passing. Simulated cycle counts
+// that changed are reported but do not fail it.
+// usage: sim_bench [-baseline file] [-write-baseline file] [-threshold-time pct]
+//                  [-threshold-rss pct] [-repeat n] [-min-time ms] [-filter substring]
+
+struct Config
+{
+    const char* engine;
+    bool predecode;
+    const char* memory;
+    MemModel model;
+};
+
+static const Config configs[] = {
+    {"predecoded", true, "cached", MemModel::Cached},
+    {"predecoded", true, "flat", MemModel::Flat},
+    {"decode", false, "cached", MemModel::Cached},
+    {"decode", false, "flat", MemModel::Flat},
+};
+
+struct Result
+{
+    std::string program;
+    std::string engine;
+    std::string memory;
+    // the guest's exit code, or -1 if the simulator crashed or timed out
+    int exitCode = -1;
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    double nsPerInstr = 0.0;
+    uint64_t peakRssKib = 0;
+
+    std::string Key() const
+    {
+        return program + " " + engine + " " + memory;
+    }
+
+    double Mips() const
+    {
+        return nsPerInstr > 0.0 ? 1e3 / nsPerInstr : 0.0;
+    }
+};
+
+// What a child process reports back
+struct ChildResult
+{
+    int exitCode;
+    uint64_t instructions;
+    uint64_t cycles;
+    double seconds;
+};
+
+static ChildResult Simulate(const std::string& path, const Config& config, int repeat, double minSeconds)
+{
+    ChildResult best{-1, 0, 0, std::numeric_limits<double>::max()};
+    ElfFile elf;
+    std::optional<DecodedText> text;
+    if (config.predecode && elf.Load(path))
+        text.emplace(elf);
+    double total = 0.0;
+    for (int i = 0; i < repeat || (total < minSeconds && i < 100000); i++)
+    {
+        MemoryStorage mem;
+        if (!mem.LoadElf(path))
+            return best;
+        std::unique_ptr<ICpu> cpu = MakeCpu(config.model, mem);
+        cpu->UsePredecoded(text ? &*text : nullptr);
+        cpu->Reset(0x200);
+
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point start = Clock::now();
+        // a guard against programs that never exit
+        uint64_t budget = uint64_t(1) << 32u;
+        int exitCode = -1;
+        while (cpu->Cycles() < budget)
+        {
+            StopReason stop = cpu->Run(budget - cpu->Cycles(), std::numeric_limits<uint64_t>::max());
+            if (stop == StopReason::Fault)
+                break;
+            std::optional<CpuToHostData> msg = cpu->GetMessage();
+            if (stop == StopReason::Exit)
+            {
+                exitCode = msg->unpacked.data;
+                break;
+            }
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        total += seconds;
+        if (seconds < best.seconds)
+            best = {exitCode, cpu->Instructions(), cpu->Cycles(), seconds};
+    }
+    return best;
+}
+
+static Result Measure(const std::string& path, const std::string& name, const Config& config, int repeat,
+                      double minSeconds)
+{
+    Result result{name, config.engine, config.memory};
+    int fds[2];
+    if (pipe(fds) != 0)
+        return result;
+    fflush(nullptr);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(fds[0]);
+        // the guest's output would clutter the report
+        freopen("/dev/null", "w", stderr);
+        ChildResult child = Simulate(path, config, repeat, minSeconds);
+        ssize_t written = write(fds[1], &child, sizeof(child));
+        _exit(written == sizeof(child) ? 0 : 1);
+    }
+    close(fds[1]);
+    ChildResult child{};
+    bool reported = pid > 0 && read(fds[0], &child, sizeof(child)) == sizeof(child);
+    close(fds[0]);
+    int status = 0;
+    rusage usage{};
+    if (pid > 0)
+        wait4(pid, &status, 0, &usage);
+    if (!reported || !WIFEXITED(status))
+        return result;
+    result.exitCode = child.exitCode;
+    result.instructions = child.instructions;
+    result.cycles = child.cycles;
+    result.nsPerInstr = child.instructions ? 1e9 * child.seconds / child.instructions : 0.0;
+    result.peakRssKib = usage.ru_maxrss;
+    return result;
+}
+
+// One result per line, so the file reads back without a JSON library
+static void WriteBaseline(const std::string& file, const std::vector<Result>& results)
+{
+    std::ofstream out(file);
+    out << "{\n  \"results\": [\n";
+    char buf[512];
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        snprintf(buf, sizeof(buf), "    {\"program\": \"%s\", \"engine\": \"%s\", \"memory\": \"%s\", \"exit_code\": %d, "
+                 "\"instructions\": %lu, \"cycles\": %lu, \"ns_per_instr\": %.3f, \"mips\": %.3f, "
+                 "\"peak_rss_kib\": %lu}%s\n", r.program.c_str(), r.engine.c_str(), r.memory.c_str(), r.exitCode,
+                 (unsigned long)r.instructions, (unsigned long)r.cycles, r.nsPerInstr, r.Mips(),
+                 (unsigned long)r.peakRssKib, i + 1 < results.size() ? "," : "");
+        out << buf;
+    }
+    out << "  ]\n}\n";
+}
+
+static std::string Field(const std::string& line, const std::string& key)
+{
+    std::string pattern = "\"" + key + "\": ";
+    size_t pos = line.find(pattern);
+    if (pos == std::string::npos)
+        return "";
+    pos += pattern.size();
+    if (line[pos] == '"')
+        return line.substr(pos + 1, line.find('"', pos + 1) - pos - 1);
+    return line.substr(pos, line.find_first_of(",}", pos) - pos);
+}
+
+static std::map<std::string, Result> ReadBaseline(const std::string& file)
+{
+    std::map<std::string, Result> baseline;
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (Field(line, "program").empty())
+            continue;
+        Result r;
+        r.program = Field(line, "program");
+        r.engine = Field(line, "engine");
+        r.memory = Field(line, "memory");
+        r.exitCode = std::stoi(Field(line, "exit_code"));
+        r.instructions = std::stoull(Field(line, "instructions"));
+        r.cycles = std::stoull(Field(line, "cycles"));
+        r.nsPerInstr = std::stod(Field(line, "ns_per_instr"));
+        r.peakRssKib = std::stoull(Field(line, "peak_rss_kib"));
+        baseline[r.Key()] = r;
+    }
+    return baseline;
+}
+
+static double Change(double now, double before)
+{
+    return before > 0.0 ? 100.0 * (now - before) / before : 0.0;
+}
+
+int main(int argc, char** argv)
+{
+    std::string baselineFile;
+    std::string writeFile;
+    double thresholdTime = 10.0;
+    double thresholdRss = 25.0;
+    int repeat = 3;
+    double minMs = 50.0;
+    std::string filter;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-baseline" && i + 1 < argc)
+            baselineFile = argv[++i];
+        else if (arg == "-write-baseline" && i + 1 < argc)
+            writeFile = argv[++i];
+        else if (arg == "-threshold-time" && i + 1 < argc)
+            thresholdTime = std::stod(argv[++i]);
+        else if (arg == "-threshold-rss" && i + 1 < argc)
+            thresholdRss = std::stod(argv[++i]);
+        else if (arg == "-repeat" && i + 1 < argc)
+            repeat = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "-min-time" && i + 1 < argc)
+            minMs = std::stod(argv[++i]);
+        else if (arg == "-filter" && i + 1 < argc)
+            filter = argv[++i];
+        else
+        {
+            fprintf(stderr, "usage: sim_bench [-baseline file] [-write-baseline file] [-threshold-time pct] "
+                    "[-threshold-rss pct] [-repeat n] [-min-time ms] [-filter substring]\n");
+            return 2;
+        }
+    }
+
+    std::vector<std::pair<std::string, std::string>> programs;
+    for (const char* dir : {"assembly", "smallbenchmarks", "bigbenchmarks"})
+    {
+        std::filesystem::path bin = std::filesystem::path(PROGRAMS_DIR) / dir / "bin";
+        if (!std::filesystem::is_directory(bin))
+            continue;
+        std::vector<std::filesystem::path> files;
+        for (const auto& file : std::filesystem::directory_iterator(bin))
+        {
+            if (file.path().extension() == ".riscv")
+                files.push_back(file.path());
+        }
+        std::sort(files.begin(), files.end());
+        for (const std::filesystem::path& file : files)
+        {
+            std::string name = std::string(dir) + "/" + file.stem().string();
+            if (name.find(filter) != std::string::npos)
+                programs.emplace_back(file.string(), name);
+        }
+    }
+    if (programs.empty())
+    {
+        fprintf(stderr, "no programs found in %s\n", PROGRAMS_DIR);
+        return 2;
+    }
+
+    std::map<std::string, Result> baseline;
+    if (!baselineFile.empty())
+    {
+        baseline = ReadBaseline(baselineFile);
+        if (baseline.empty())
+        {
+            fprintf(stderr, "no results in baseline \"%s\"\n", baselineFile.c_str());
+            return 2;
+        }
+    }
+
+    printf("%-32s %-10s %-6s %4s %12s %8s %9s %9s  %s\n", "program", "engine", "memory", "exit", "instret",
+           "MIPS", "ns/instr", "RSS KiB", "vs baseline: time RSS");
+    std::vector<Result> results;
+    int regressions = 0;
+    for (const auto& [path, name] : programs)
+    {
+        for (const Config& config : configs)
+        {
+            Result r = Measure(path, name, config, repeat, minMs / 1e3);
+            results.push_back(r);
+            std::string verdict;
+            auto it = baseline.find(r.Key());
+            if (!baselineFile.empty() && it == baseline.end())
+                verdict = "new";
+            else if (it != baseline.end())
+            {
+                const Result& base = it->second;
+                double time = Change(r.nsPerInstr, base.nsPerInstr);
+                double rss = Change(r.peakRssKib, base.peakRssKib);
+                char buf[128];
+                snprintf(buf, sizeof(buf), "%+7.1f%% %+7.1f%%", time, rss);
+                verdict = buf;
+                bool failed = false;
+                if (base.exitCode == 0 && r.exitCode != 0)
+                {
+                    verdict += " FAILED";
+                    failed = true;
+                }
+                if (r.exitCode == 0 && time > thresholdTime)
+                {
+                    verdict += " SLOWER";
+                    failed = true;
+                }
+                if (r.exitCode == 0 && rss > thresholdRss)
+                {
+                    verdict += " BIGGER";
+                    failed = true;
+                }
+                if (r.cycles != base.cycles)
+                    verdict += " (cycles changed)";
+                regressions += failed;
+            }
+            printf("%-32s %-10s %-6s %4d %12lu %8.2f %9.2f %9lu  %s\n", r.program.c_str(), r.engine.c_str(),
+                   r.memory.c_str(), r.exitCode, (unsigned long)r.instructions, r.Mips(), r.nsPerInstr,
+                   (unsigned long)r.peakRssKib, verdict.c_str());
+            fflush(stdout);
+        }
+    }
+
+    if (!writeFile.empty())
+        WriteBaseline(writeFile, results);
+    if (!baselineFile.empty())
+    {
+        printf("%d regressions (thresholds: time %.1f%%, RSS %.1f%%)\n", regressions, thresholdTime,
+               thresholdRss);
+    }
+    return regressions ? 1 : 0;
+}
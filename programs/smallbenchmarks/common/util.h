@@ -16,6 +16,17 @@
 
 #include <stdint.h>
 
+// Events for the hpmcounters, see setHpmEvent()
+#define HPM_ICACHE_MISSES 1
+#define HPM_DCACHE_MISSES 2
+#define HPM_STALL_CYCLES  3
+#define HPM_BRANCHES      4
+#define HPM_MISPREDICTS   5
+
+// Region of interest: with -roi the simulator runs functionally outside it
+// and counts cycles, statistics and profiles only inside
+#define ROI_CSR "0x8c0"
+
 #if HOST_DEBUG
 
 #include <stdio.h>
@@ -29,6 +40,13 @@
 	static uint32_t getInsts() { return 0; }
 	static uint32_t getCycle() { return 0; }
 	static uint32_t getCoreId() { return 0; }
+	static uint64_t getCycle64() { return 0; }
+	static uint64_t getInsts64() { return 0; }
+	#define setHpmEvent(n, event) ((void)(event))
+	#define getHpmCounter(n) ((uint32_t)0)
+	#define ROI_BEGIN()
+	#define ROI_END()
+	#define ROI_RESET_STATS()
 
 #else // HOST_DEBUG = 0
 
@@ -50,6 +68,35 @@
 		return id;
 	}
 
+	// the high half is read again in case the low one wrapped in between
+	static uint64_t getCycle64() {
+		uint32_t hi, lo, hi2;
+		do {
+			asm volatile ("csrr %0, cycleh" : "=r"(hi) : );
+			asm volatile ("csrr %0, cycle" : "=r"(lo) : );
+			asm volatile ("csrr %0, cycleh" : "=r"(hi2) : );
+		} while (hi != hi2);
+		return (uint64_t)hi << 32 | lo;
+	}
+
+	static uint64_t getInsts64() {
+		uint32_t hi, lo, hi2;
+		do {
+			asm volatile ("csrr %0, instreth" : "=r"(hi) : );
+			asm volatile ("csrr %0, instret" : "=r"(lo) : );
+			asm volatile ("csrr %0, instreth" : "=r"(hi2) : );
+		} while (hi != hi2);
+		return (uint64_t)hi << 32 | lo;
+	}
+
+	// Counter n (3..31) counts `event` from now on
+	#define setHpmEvent(n, event) asm volatile ("csrw mhpmevent" #n ", %0" : : "r"(event))
+	#define getHpmCounter(n) ({ uint32_t v_; asm volatile ("csrr %0, hpmcounter" #n : "=r"(v_) : ); v_; })
+
+	#define ROI_BEGIN() asm volatile ("csrw " ROI_CSR ", %0" : : "r"(1) : "memory")
+	#define ROI_END() asm volatile ("csrw " ROI_CSR ", zero" : : : "memory")
+	#define ROI_RESET_STATS() asm volatile ("csrw " ROI_CSR ", %0" : : "r"(2) : "memory")
+
 #endif // HOST_DEBUG
 
 
@@ -0,0 +1,279 @@
+#ifndef RISCV_SIM_ARENA_H
+#define RISCV_SIM_ARENA_H
+
+#include <sys/mman.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Allocator for objects owned by one simulator instance: cache lines, trace
+// buffers, decoded blocks. Chunks are carved from large mmap'ed blocks, freed
+// chunks go to per-size free lists and are reused, and Reset() drops
+// everything at once at a run boundary, returning all blocks but the first to
+// the OS. Each instance owns its arena, so instances on different threads do
+// not share state; an arena that is shared has to be created thread-safe.
+class Arena
+{
+public:
+    struct Options
+    {
+        size_t blockSize = 64 * 1024;
+        // back blocks with 2 MiB pages (explicit huge pages, else THP)
+        bool hugePages = false;
+        // serialize Allocate/Deallocate/Reset with a mutex
+        bool threadSafe = false;
+    };
+
+    struct Stats
+    {
+        // mapped from the OS
+        size_t reservedBytes = 0;
+        // handed out and not yet freed
+        size_t usedBytes = 0;
+        size_t peakBytes = 0;
+        uint64_t allocations = 0;
+        // allocations served from a free list
+        uint64_t reused = 0;
+        uint64_t resets = 0;
+    };
+
+    Arena()
+        : Arena(Options())
+    {
+    }
+
+    explicit Arena(const Options& options)
+        : _options(options)
+    {
+        if (_options.hugePages)
+            _options.blockSize = RoundUp(_options.blockSize, hugePageSize);
+    }
+
+    ~Arena()
+    {
+        for (Block& block : _blocks)
+            munmap(block.base, block.size);
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t size)
+    {
+        Guard guard(*this);
+        size = RoundUp(std::max<size_t>(size, 1), granule);
+        _stats.allocations++;
+        _stats.usedBytes += size;
+        _stats.peakBytes = std::max(_stats.peakBytes, _stats.usedBytes);
+
+        if (size / granule < smallClasses)
+        {
+            FreeChunk*& head = _small[size / granule];
+            if (head)
+            {
+                _stats.reused++;
+                return std::exchange(head, head->next);
+            }
+        }
+        else
+        {
+            for (auto& [chunkSize, chunk] : _large)
+            {
+                if (chunkSize == size && chunk)
+                {
+                    _stats.reused++;
+                    return std::exchange(chunk, chunk->next);
+                }
+            }
+        }
+        return Bump(size);
+    }
+
+    // `size` must be the size passed to Allocate
+    void Deallocate(void* ptr, size_t size)
+    {
+        Guard guard(*this);
+        size = RoundUp(std::max<size_t>(size, 1), granule);
+        _stats.usedBytes -= size;
+
+        FreeChunk* chunk = static_cast<FreeChunk*>(ptr);
+        if (size / granule < smallClasses)
+        {
+            chunk->next = _small[size / granule];
+            _small[size / granule] = chunk;
+            return;
+        }
+        for (auto& [chunkSize, head] : _large)
+        {
+            if (chunkSize == size)
+            {
+                chunk->next = head;
+                head = chunk;
+                return;
+            }
+        }
+        chunk->next = nullptr;
+        _large.emplace_back(size, chunk);
+    }
+
+    // Forgets every allocation. Containers using the arena must have been
+    // destroyed or cleared before.
+    void Reset()
+    {
+        Guard guard(*this);
+        for (size_t i = 1; i < _blocks.size(); i++)
+        {
+            munmap(_blocks[i].base, _blocks[i].size);
+            _stats.reservedBytes -= _blocks[i].size;
+        }
+        if (_blocks.size() > 1)
+            _blocks.resize(1);
+        _cursor = _blocks.empty() ? nullptr : _blocks[0].base;
+        _limit = _blocks.empty() ? nullptr : _blocks[0].base + _blocks[0].size;
+        _small.fill(nullptr);
+        _large.clear();
+        _stats.usedBytes = 0;
+        _stats.resets++;
+    }
+
+    Stats GetStats() const
+    {
+        Guard guard(*this);
+        return _stats;
+    }
+
+private:
+    static constexpr size_t granule = 16;
+    static constexpr size_t smallClasses = 64;
+    static constexpr size_t hugePageSize = 2 * 1024 * 1024;
+
+    struct FreeChunk
+    {
+        FreeChunk* next;
+    };
+
+    struct Block
+    {
+        char* base;
+        size_t size;
+    };
+
+    class Guard
+    {
+    public:
+        explicit Guard(const Arena& arena)
+            : _mutex(arena._options.threadSafe ? &arena._mutex : nullptr)
+        {
+            if (_mutex)
+                _mutex->lock();
+        }
+
+        ~Guard()
+        {
+            if (_mutex)
+                _mutex->unlock();
+        }
+
+    private:
+        std::mutex* _mutex;
+    };
+
+    static size_t RoundUp(size_t value, size_t to)
+    {
+        return (value + to - 1) / to * to;
+    }
+
+    void* Bump(size_t size)
+    {
+        if (_cursor + size > _limit)
+            MapBlock(std::max(size, _options.blockSize));
+        void* ptr = _cursor;
+        _cursor += size;
+        return ptr;
+    }
+
+    void MapBlock(size_t size)
+    {
+        void* base = MAP_FAILED;
+        if (_options.hugePages)
+        {
+            size = RoundUp(size, hugePageSize);
+            base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+        if (base == MAP_FAILED)
+        {
+            base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base == MAP_FAILED)
+                throw std::bad_alloc();
+            if (_options.hugePages)
+                madvise(base, size, MADV_HUGEPAGE);
+        }
+        _blocks.push_back({static_cast<char*>(base), size});
+        _stats.reservedBytes += size;
+        _cursor = static_cast<char*>(base);
+        _limit = _cursor + size;
+    }
+
+    Options _options;
+    mutable std::mutex _mutex;
+    std::vector<Block> _blocks;
+    char* _cursor = nullptr;
+    char* _limit = nullptr;
+    std::array<FreeChunk*, smallClasses> _small{};
+    std::vector<std::pair<size_t, FreeChunk*>> _large;
+    Stats _stats;
+};
+
+// Standard allocator adapter, so containers can live in an Arena
+template <typename T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena& arena) noexcept
+        : _arena(&arena)
+    {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+        : _arena(other._arena)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(_arena->Allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept
+    {
+        _arena->Deallocate(ptr, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const noexcept
+    {
+        return _arena == other._arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const noexcept
+    {
+        return _arena != other._arena;
+    }
+
+private:
+    template <typename U>
+    friend class ArenaAllocator;
+
+    Arena* _arena;
+};
+
+#endif //RISCV_SIM_ARENA_H
@@ -2,23 +2,77 @@
 #define RISCV_SIM_CPU_H
 
 #include "Memory.h"
+#include "DecodedText.h"
+#include "InstrMix.h"
+#include "IntervalStats.h"
+#include "Profiler.h"
 #include "Decoder.h"
 #include "RegisterFile.h"
 #include "CsrFile.h"
 #include "Executor.h"
 
+#include <limits>
+#include <memory>
+#include <type_traits>
+
+// Timing of a multi-cycle functional unit. A result is available `latency`
+// cycles after issue; a pipelined unit accepts a new operation every cycle,
+// otherwise it is busy for the whole latency.
+struct FuTiming
+{
+	unsigned latency;
+	bool pipelined;
+};
+
+struct TimingConfig
+{
+	FuTiming mul{3, true};
+	FuTiming div{32, false};
+	// Execute the fusible pairs found by DecodedText as one macro-op: the
+	// second instruction retires with the first, without a fetch or issue
+	// of its own, if both lie in the same cache line. Without it the pairs
+	// are still found, which spares the second its lookup, but it is
+	// fetched and issued, and costs its cycles, as any other instruction.
+	bool fusion = false;
+};
+
+// Why Cpu::Run returned
+enum class StopReason
+{
+	// the cycle or instruction budget is spent
+	Budget,
+	// the guest sent a message to the host
+	Message,
+	// the guest sent its exit code
+	Exit,
+	// the guest accessed memory outside the storage; FaultAddress() says where
+	Fault,
+};
+
+// The core, specialized for the memory model it runs on so the calls into
+// the model are direct and can be inlined. Cpu<IMem> takes any model
+// through virtual calls.
+template <typename Mem>
 class Cpu
 {
 public:
-	Cpu(IMem& mem)
-		: _mem(mem)
+	Cpu(Mem& mem, Word hartId = 0, const TimingConfig& timing = TimingConfig())
+		: _csrf(hartId), _mem(mem), _timing(timing)
 	{
 		phase = 0;
 	}
 
 	void Clock()
 	{
+		if (_functional)
+		{
+			StepFunctional();
+			return;
+		}
+		if (_cycle >= _nextInterval)
+			SampleIntervals();
 		_csrf.Clock();
+		_cycle++;
 		switch (phase)
 		{
 		case 0:
@@ -31,35 +85,93 @@ public:
 				std::optional<Word> resp = _mem.Response();
 				if (!resp.has_value())
 				{
+					_csrf.CountEvent(HpmEvent::StallCycles);
 					return;
 				}
 				Word instr = resp.value();
-				instrDec = _decoder.Decode(instr);
-				_rf.Read(instrDec);
-				_csrf.Read(instrDec);
-				_exe.Execute(instrDec, _ip);
-				_mem.Request(instrDec->_addr, instrDec->_type);
+				// the second of a pair was found along with the first
+				const Instruction* predecoded = _partner ? _partner : _text ? _text->Find(_ip, instr) : nullptr;
+				_partner = nullptr;
+				_instr = predecoded ? *predecoded : _decoder.Decode(instr);
+				// nothing of the previous instruction may leak into this one,
+				// e.g. the next ip of an instruction the core cannot execute
+				_state = InstrState();
+				_fused = predecoded ? FusedPartner() : nullptr;
+				_issueCycle = IssueCycle(_instr);
 				phase++;
 			}
 		case 2:
 			{
-				if (!_mem.Response(instrDec->_addr, instrDec->_type, instrDec->_data))
+				if (_cycle < _issueCycle)
+				{
+					_csrf.CountEvent(HpmEvent::StallCycles);
+					return;
+				}
+				_rf.Read(_instr, _state);
+				if (_instr._flags & HasCsr)
+					SyncCacheEvents();
+				_csrf.Read(_instr, _state);
+				_exe.Execute(_instr, _state, _ip);
+				Issue(_instr);
+				_mem.Request(_state._addr, _instr._type, _instr._amoFunc);
+				phase++;
+			}
+		case 3:
+			{
+				if (!_mem.Response(_state._addr, _instr._type, _state._data))
 				{
+					_csrf.CountEvent(HpmEvent::StallCycles);
 					return;
 				}
-				_rf.Write(instrDec);
-				_csrf.Write(instrDec);
+				_rf.Write(_instr, _state);
+				_csrf.Write(_instr, _state);
+				if (_instr._type == IType::Csrw && _instr._csr == CsrIdx::Roi)
+					Roi(RoiCommand(_state._data));
 				_csrf.InstructionExecuted();
-				_ip = instrDec->_nextIp;
+				_instructions++;
+				if (_instr._type == IType::Br)
+					CountBranch(_instr);
+				if (_profiler)
+					_profiler->Retire(_ip, _instr, _state, _cycle);
+				if (_mix)
+					_mix->Retire(_ip, _instr, _state);
+				_ip = _state._nextIp;
+				if (_fused && _timing.fusion)
+					ExecuteFused(*_fused);
+				else
+					_partner = _fused;
 				phase = 0;
 			}
 		}
 	}
 
+	// Steps the core and its memory model until `maxCycles` cycles or
+	// `maxInstructions` instructions have passed, the guest has sent a
+	// message, which GetMessage() then returns, or it has accessed memory
+	// outside the storage. An instruction executed
+	// outside the region of interest counts as one cycle of the budget.
+	StopReason Run(uint64_t maxCycles, uint64_t maxInstructions = std::numeric_limits<uint64_t>::max())
+	{
+		uint64_t firstInstruction = _instructions;
+		for (uint64_t cycle = 0; cycle < maxCycles; cycle++)
+		{
+			if (_instructions - firstInstruction >= maxInstructions)
+				break;
+			Clock();
+			_mem.Clock();
+			if (_mem.Storage().Faulted())
+				return StopReason::Fault;
+			if (const std::optional<CpuToHostData>& msg = _csrf.PendingMessage())
+				return msg->unpacked.type == CpuToHostType::ExitCode ? StopReason::Exit : StopReason::Message;
+		}
+		return StopReason::Budget;
+	}
+
 	void Reset(Word ip)
 	{
 		_csrf.Reset();
 		_ip = ip;
+		_partner = nullptr;
 	}
 
 	std::optional<CpuToHostData> GetMessage()
@@ -67,20 +179,356 @@ public:
 		return _csrf.GetMessage();
 	}
 
+	std::optional<Word> FaultAddress() const
+	{
+		return _mem.Storage().FaultAddress();
+	}
+
+	// Take decoded instructions from `text` instead of decoding every fetch
+	void UsePredecoded(const DecodedText* text)
+	{
+		_text = text;
+		_partner = nullptr;
+	}
+
+	// Run functionally, without timing, statistics or profiling, outside
+	// the regions the guest marks through the Roi CSR. The core starts
+	// outside. Every region starts with cold caches, as the functional
+	// accesses go to `storage` directly.
+	void UseRoi(MemoryStorage& storage)
+	{
+		_functionalMem = std::make_unique<FlatMem>(storage);
+		_functional = phase == 0;
+	}
+
+	// Report every retired instruction to `profiler`
+	void UseProfiler(Profiler* profiler)
+	{
+		_profiler = profiler;
+	}
+
+	// Count every retired instruction in `mix`
+	void UseInstrMix(InstrMix* mix)
+	{
+		_mix = mix;
+	}
+
+	// Record the statistics of every interval of `intervals`->Interval()
+	// cycles
+	void UseIntervals(IntervalStats* intervals)
+	{
+		_intervals = intervals;
+		_nextInterval = intervals ? _cycle - _cycle % intervals->Interval() + intervals->Interval()
+		                          : std::numeric_limits<uint64_t>::max();
+	}
+
+	// Record the interval in progress, such as the partial one at the end
+	// of a run
+	void SampleIntervals()
+	{
+		if (!_intervals)
+			return;
+		IntervalStats::Totals totals;
+		totals.cycles = _cycle;
+		totals.instructions = _instructions;
+		if constexpr (std::is_same_v<Mem, CachedMem>)
+		{
+			totals.icacheAccesses = _mem.getCodeStats().accesses;
+			totals.icacheMisses = _mem.getCodeStats().misses;
+			totals.dcacheAccesses = _mem.getDataStats().accesses;
+			totals.dcacheMisses = _mem.getDataStats().misses;
+		}
+		totals.stallCycles = _csrf.EventTotal(HpmEvent::StallCycles);
+		_nextInterval = _intervals->Record(totals);
+	}
+
+	uint64_t Cycles() const
+	{
+		return _cycle;
+	}
+
+	uint64_t Instructions() const
+	{
+		return _instructions;
+	}
 
+	uint64_t FusedPairs() const
+	{
+		return _fusedPairs;
+	}
+
+	// the address of the instruction in flight
+	Word Ip() const
+	{
+		return _ip;
+	}
 
 private:
+	const Instruction* FusedPartner() const
+	{
+		const Instruction* partner = _text->FusedPartner(_ip);
+		if (!partner || _mem.LineAddr(_ip) != _mem.LineAddr(_ip + _instr._size + partner->_size - 1))
+			return nullptr;
+		return partner;
+	}
+
+	// One instruction outside the region of interest
+	void StepFunctional()
+	{
+		FlatMem& mem = *_functionalMem;
+		mem.Request(_ip);
+		Word fetched = *mem.Response();
+		const Instruction* predecoded = _text ? _text->Find(_ip, fetched) : nullptr;
+		_instr = predecoded ? *predecoded : _decoder.Decode(fetched);
+		_state = InstrState();
+		_rf.Read(_instr, _state);
+		_csrf.Read(_instr, _state);
+		_exe.Execute(_instr, _state, _ip);
+		mem.Request(_state._addr, _instr._type, _instr._amoFunc);
+		mem.Response(_state._addr, _instr._type, _state._data);
+		_rf.Write(_instr, _state);
+		_csrf.Write(_instr, _state);
+		if (_instr._type == IType::Csrw && _instr._csr == CsrIdx::Roi)
+			Roi(RoiCommand(_state._data));
+		_csrf.InstructionExecuted();
+		_instructions++;
+		_ip = _state._nextIp;
+	}
+
+	void Roi(RoiCommand command)
+	{
+		if (!_functionalMem)
+			return;
+		switch (command)
+		{
+		case RoiCommand::Begin:
+			if (_functional)
+			{
+				_functional = false;
+				if constexpr (std::is_same_v<Mem, CachedMem>)
+					_mem.Flush();
+			}
+			break;
+		case RoiCommand::End:
+			_functional = true;
+			break;
+		case RoiCommand::ResetStats:
+			// zero the cache statistics first, so the counters are based on
+			// the totals they restart from
+			if constexpr (std::is_same_v<Mem, CachedMem>)
+				_mem.ResetStats();
+			SyncCacheEvents();
+			_csrf.ResetCounters();
+			break;
+		}
+	}
+
+	// A static predictor takes backward branches and falls through forward
+	// ones
+	void CountBranch(const Instruction& instr)
+	{
+		bool taken = _state._nextIp != _ip + instr._size;
+		bool predicted = SignedWord(instr._imm) < 0;
+		_csrf.CountEvent(HpmEvent::Branches);
+		if (taken != predicted)
+			_csrf.CountEvent(HpmEvent::Mispredicts);
+	}
+
+	// The caches count their misses themselves; bring the totals up to date
+	// before a CSR read can observe them
+	void SyncCacheEvents()
+	{
+		if constexpr (std::is_same_v<Mem, CachedMem>)
+		{
+			_csrf.SetEventTotal(HpmEvent::ICacheMisses, _mem.getCodeStats().misses);
+			_csrf.SetEventTotal(HpmEvent::DCacheMisses, _mem.getDataStats().misses);
+		}
+	}
+
+	// The second instruction of a fused pair is an ALU op, jump or branch
+	// reading the first one's result, so it needs no memory access
+	void ExecuteFused(const Instruction& instr)
+	{
+		_state = InstrState();
+		_rf.Read(instr, _state);
+		_exe.Execute(instr, _state, _ip);
+		_rf.Write(instr, _state);
+		_csrf.InstructionExecuted();
+		_instructions++;
+		if (instr._type == IType::Br)
+			CountBranch(instr);
+		if (_profiler)
+			_profiler->Retire(_ip, instr, _state, _cycle);
+		if (_mix)
+			_mix->Retire(_ip, instr, _state);
+		_ip = _state._nextIp;
+		_fusedPairs++;
+	}
+
+	static bool IsMul(AluFunc func)
+	{
+		return func >= AluFunc::Mul && func <= AluFunc::Mulhu;
+	}
+
+	static bool IsDiv(AluFunc func)
+	{
+		return func >= AluFunc::Div && func <= AluFunc::Remu;
+	}
+
+	// The cycle an instruction may issue at: its sources must be ready and,
+	// for multiply/divide, the unit must be free
+	uint64_t IssueCycle(const Instruction& instr) const
+	{
+		uint64_t cycle = std::max({_cycle, _regReady[instr._src1], _regReady[instr._src2]});
+		if (instr._type == IType::Alu && IsMul(instr._aluFunc))
+			cycle = std::max(cycle, _mulFree);
+		if (instr._type == IType::Alu && IsDiv(instr._aluFunc))
+			cycle = std::max(cycle, _divFree);
+		return cycle;
+	}
+
+	void Issue(const Instruction& instr)
+	{
+		if (instr._type != IType::Alu)
+			return;
+		const FuTiming* unit = IsMul(instr._aluFunc) ? &_timing.mul : IsDiv(instr._aluFunc) ? &_timing.div : nullptr;
+		if (!unit)
+			return;
+		if (instr._dst)
+			_regReady[instr._dst] = _cycle + unit->latency;
+		uint64_t& free = unit == &_timing.mul ? _mulFree : _divFree;
+		free = _cycle + (unit->pipelined ? 1 : unit->latency);
+	}
+
 	Reg32 _ip;
 	Decoder _decoder;
 	RegisterFile _rf;
 	CsrFile _csrf;
 	Executor _exe;
-	IMem& _mem;
+	Mem& _mem;
+	const DecodedText* _text = nullptr;
+	Profiler* _profiler = nullptr;
+	InstrMix* _mix = nullptr;
+	IntervalStats* _intervals = nullptr;
+	// the cycle the current interval ends in
+	uint64_t _nextInterval = std::numeric_limits<uint64_t>::max();
+	// executes outside the region of interest
+	std::unique_ptr<FlatMem> _functionalMem;
+	bool _functional = false;
 	// Add your code here, if needed
 	int phase;
-	InstructionPtr instrDec;
+	Instruction _instr;
+	InstrState _state;
+	const Instruction* _fused = nullptr;
+	// the second of a pair that is not fused, to run next
+	const Instruction* _partner = nullptr;
+	uint64_t _fusedPairs = 0;
+
+	TimingConfig _timing;
+	uint64_t _cycle = 0;
+	uint64_t _instructions = 0;
+	uint64_t _issueCycle = 0;
+	uint64_t _mulFree = 0;
+	uint64_t _divFree = 0;
+	// scoreboard: cycle at which a multi-cycle result becomes readable
+	std::array<uint64_t, 32> _regReady{};
+
+};
+
+
+// Runtime-polymorphic face of a Cpu and the memory model it owns, for tools
+// that pick the model from their configuration. Only Run() and the queries
+// are virtual; the simulation loop is specialized for the model.
+class ICpu
+{
+public:
+	virtual ~ICpu() = default;
+
+	virtual void Reset(Word ip) = 0;
+	virtual void UsePredecoded(const DecodedText* text) = 0;
+	virtual void UseProfiler(Profiler* profiler) = 0;
+	virtual void UseInstrMix(InstrMix* mix) = 0;
+	virtual void UseIntervals(IntervalStats* intervals) = 0;
+	virtual void SampleIntervals() = 0;
+	virtual void UseRoi() = 0;
+	virtual StopReason Run(uint64_t maxCycles, uint64_t maxInstructions) = 0;
+	virtual std::optional<CpuToHostData> GetMessage() = 0;
+	virtual std::optional<Word> FaultAddress() const = 0;
+	virtual uint64_t Cycles() const = 0;
+	virtual uint64_t Instructions() const = 0;
+	virtual uint64_t FusedPairs() const = 0;
+	virtual Word Ip() const = 0;
+	// the caches of the memory model, if it has any
+	virtual const CachedMem* Cache() const = 0;
+};
+
+template <typename Mem>
+class CpuModel final : public ICpu
+{
+public:
+	CpuModel(MemoryStorage& storage, Word hartId, const TimingConfig& timing,
+	         const CacheConfig& cache = CacheConfig())
+		: _storage(storage), _mem(MakeMem(storage, cache)), _cpu(_mem, hartId, timing)
+	{
+	}
+
+	void Reset(Word ip) override { _cpu.Reset(ip); }
+	void UsePredecoded(const DecodedText* text) override { _cpu.UsePredecoded(text); }
+	void UseProfiler(Profiler* profiler) override { _cpu.UseProfiler(profiler); }
+	void UseInstrMix(InstrMix* mix) override { _cpu.UseInstrMix(mix); }
+	void UseIntervals(IntervalStats* intervals) override { _cpu.UseIntervals(intervals); }
+	void SampleIntervals() override { _cpu.SampleIntervals(); }
+	void UseRoi() override { _cpu.UseRoi(_storage); }
+	StopReason Run(uint64_t maxCycles, uint64_t maxInstructions) override { return _cpu.Run(maxCycles, maxInstructions); }
+	std::optional<CpuToHostData> GetMessage() override { return _cpu.GetMessage(); }
+	std::optional<Word> FaultAddress() const override { return _cpu.FaultAddress(); }
+	uint64_t Cycles() const override { return _cpu.Cycles(); }
+	uint64_t Instructions() const override { return _cpu.Instructions(); }
+	uint64_t FusedPairs() const override { return _cpu.FusedPairs(); }
+	Word Ip() const override { return _cpu.Ip(); }
+
+	const CachedMem* Cache() const override
+	{
+		if constexpr (std::is_same_v<Mem, CachedMem>)
+			return &_mem;
+		else
+			return nullptr;
+	}
 
+private:
+	static Mem MakeMem(MemoryStorage& storage, const CacheConfig& cache)
+	{
+		if constexpr (std::is_same_v<Mem, CachedMem>)
+			return CachedMem(storage, nullptr, cache);
+		else
+			return Mem(storage);
+	}
+
+	MemoryStorage& _storage;
+	Mem _mem;
+	Cpu<Mem> _cpu;
+};
+
+enum class MemModel
+{
+	Cached,
+	Flat,
 };
 
+// The Cpu instantiation for `model`; `cache` shapes the caches of the
+// cached model
+inline std::unique_ptr<ICpu> MakeCpu(MemModel model, MemoryStorage& storage, Word hartId = 0,
+                                     const TimingConfig& timing = TimingConfig(),
+                                     const CacheConfig& cache = CacheConfig())
+{
+	switch (model)
+	{
+	case MemModel::Flat:
+		return std::make_unique<CpuModel<FlatMem>>(storage, hartId, timing);
+	case MemModel::Cached:
+	default:
+		return std::make_unique<CpuModel<CachedMem>>(storage, hartId, timing, cache);
+	}
+}
 
 #endif //RISCV_SIM_CPU_H
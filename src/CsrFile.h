@@ -1,42 +1,99 @@
-
 #ifndef RISCV_SIM_CSRFILE_H
 #define RISCV_SIM_CSRFILE_H
 
+#include <array>
 #include <optional>
 #include "Instruction.h"
 
 class CsrFile
 {
 public:
+    static constexpr size_t hpmCounters = 29;
+
+    explicit CsrFile(Word hartId = 0)
+        : coreId(hartId)
+    {
+    }
+
     void Reset()
     {
         numInstr = 0;
         numCycles = 0;
-        coreId = 0;
+        events.fill(0);
+        hpmEvent.fill(HpmEvent::None);
+        hpmBase.fill(0);
         cpuToHostData.reset();
         startReg = true;
     }
-    void Read(InstructionPtr& instr)
+    void Read(const Instruction& instr, InstrState& state)
     {
-        if (!instr->_csr)
+        if (!(instr._flags & HasCsr))
             return;
 
-        switch (static_cast<CsrIdx>(instr->_csr.value()))
+        Word csr = Word(instr._csr);
+        switch (instr._csr)
         {
-            case CsrIdx::Instret: instr->_csrVal = numInstr; break;
-            case CsrIdx::Cycle  : instr->_csrVal = numCycles; break;
-            case CsrIdx::Mhartid: instr->_csrVal = coreId; break;
-            default: break;
+            case CsrIdx::Instret  :
+            case CsrIdx::Minstret : state._csrVal = numInstr; break;
+            case CsrIdx::InstretH :
+            case CsrIdx::MinstretH: state._csrVal = numInstr >> 32u; break;
+            case CsrIdx::Cycle    :
+            case CsrIdx::Mcycle   : state._csrVal = numCycles; break;
+            case CsrIdx::CycleH   :
+            case CsrIdx::McycleH  : state._csrVal = numCycles >> 32u; break;
+            case CsrIdx::Mhartid: state._csrVal = coreId; break;
+            default:
+                if (size_t i = HpmIndex(csr, CsrIdx::Hpmcounter3, CsrIdx::Mhpmcounter3); i < hpmCounters)
+                    state._csrVal = HpmCounter(i);
+                else if (size_t i = HpmIndex(csr, CsrIdx::Hpmcounter3H, CsrIdx::Mhpmcounter3H); i < hpmCounters)
+                    state._csrVal = HpmCounter(i) >> 32u;
+                else if (size_t i = HpmIndex(csr, CsrIdx::Mhpmevent3, CsrIdx::Mhpmevent3); i < hpmCounters)
+                    state._csrVal = Word(hpmEvent[i]);
+                break;
         }
     }
-    void Write(InstructionPtr& instr)
+    void Write(const Instruction& instr, const InstrState& state)
     {
-        if (instr->_type == IType::Csrw && instr->_csr.value_or(CsrIdx::None) == CsrIdx::Mtohost)
+        if (instr._type != IType::Csrw)
+            return;
+        Word csr = Word(instr._csr);
+        if (instr._csr == CsrIdx::Mtohost)
+        {
+            cpuToHostData = CpuToHostData{state._data};
+        }
+        else if (instr._csr == CsrIdx::Mcycle || instr._csr == CsrIdx::McycleH)
+        {
+            numCycles = SetHalf(numCycles, state._data, instr._csr == CsrIdx::McycleH);
+        }
+        else if (instr._csr == CsrIdx::Minstret || instr._csr == CsrIdx::MinstretH)
+        {
+            numInstr = SetHalf(numInstr, state._data, instr._csr == CsrIdx::MinstretH);
+        }
+        else if (size_t i = HpmIndex(csr, CsrIdx::Mhpmevent3, CsrIdx::Mhpmevent3); i < hpmCounters)
         {
-            cpuToHostData = CpuToHostData{instr->_data};
+            // selecting an event restarts the counter
+            hpmEvent[i] = state._data < Word(HpmEvent::Count) ? HpmEvent(state._data) : HpmEvent::None;
+            hpmBase[i] = events[size_t(hpmEvent[i])];
+        }
+        else if (size_t i = HpmIndex(csr, CsrIdx::Mhpmcounter3, CsrIdx::Mhpmcounter3); i < hpmCounters)
+        {
+            SetHpmCounter(i, SetHalf(HpmCounter(i), state._data, false));
+        }
+        else if (size_t i = HpmIndex(csr, CsrIdx::Mhpmcounter3H, CsrIdx::Mhpmcounter3H); i < hpmCounters)
+        {
+            SetHpmCounter(i, SetHalf(HpmCounter(i), state._data, true));
         }
     }
 
+    // Counters read zero from here on; the selected events stay
+    void ResetCounters()
+    {
+        numInstr = 0;
+        numCycles = 0;
+        for (size_t i = 0; i < hpmCounters; i++)
+            hpmBase[i] = events[size_t(hpmEvent[i])];
+    }
+
     void InstructionExecuted()
     {
         numInstr++;
@@ -47,6 +104,27 @@ public:
         numCycles++;
     }
 
+    void CountEvent(HpmEvent event, uint64_t count = 1)
+    {
+        events[size_t(event)] += count;
+    }
+
+    // For events counted elsewhere, e.g. by the caches
+    void SetEventTotal(HpmEvent event, uint64_t total)
+    {
+        events[size_t(event)] = total;
+    }
+
+    uint64_t EventTotal(HpmEvent event) const
+    {
+        return events[size_t(event)];
+    }
+
+    const std::optional<CpuToHostData>& PendingMessage() const
+    {
+        return cpuToHostData;
+    }
+
     std::optional<CpuToHostData> GetMessage()
     {
         std::optional<CpuToHostData> ret;
@@ -54,9 +132,42 @@ public:
         return ret;
     }
 private:
-    Word numInstr = 0;
-    Word numCycles = 0;
+    static uint64_t SetHalf(uint64_t value, Word half, bool high)
+    {
+        if (high)
+            return (value & 0xffffffffull) | uint64_t(half) << 32u;
+        return (value & ~0xffffffffull) | half;
+    }
+
+    // The counter `csr` is in the bank starting at `user` or `machine`, or
+    // hpmCounters
+    static size_t HpmIndex(Word csr, CsrIdx user, CsrIdx machine)
+    {
+        if (csr - Word(user) < hpmCounters)
+            return csr - Word(user);
+        if (csr - Word(machine) < hpmCounters)
+            return csr - Word(machine);
+        return hpmCounters;
+    }
+
+    uint64_t HpmCounter(size_t i) const
+    {
+        return events[size_t(hpmEvent[i])] - hpmBase[i];
+    }
+
+    void SetHpmCounter(size_t i, uint64_t value)
+    {
+        hpmBase[i] = events[size_t(hpmEvent[i])] - value;
+    }
+
+    uint64_t numInstr = 0;
+    uint64_t numCycles = 0;
     Word coreId = 0;
+    // running totals per HpmEvent; None stays 0
+    std::array<uint64_t, size_t(HpmEvent::Count)> events{};
+    std::array<HpmEvent, hpmCounters> hpmEvent{};
+    // event total at which each counter read 0
+    std::array<uint64_t, hpmCounters> hpmBase{};
     std::optional<CpuToHostData> cpuToHostData;
     bool startReg = false;
 
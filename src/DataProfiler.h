@@ -0,0 +1,168 @@
+#ifndef RISCV_SIM_DATAPROFILER_H
+#define RISCV_SIM_DATAPROFILER_H
+
+#include "Elf.h"
+#include "Memory.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Attributes loads and stores to the data they touch: the OBJECT symbols of
+// the ELF file, the stack (between the lowest and the highest value sp had),
+// the heap (between the loaded sections and the stack) and whatever else is
+// left. Per object it counts D-cache misses, the cycles accesses waited
+// beyond a single-cycle instruction, the bytes touched at least once and the
+// reuse interval, the number of data accesses since the line was last used.
+// Accesses to other lines are counted whether or not they are distinct, so
+// this is an upper bound on the reuse (stack) distance.
+class DataProfiler
+{
+public:
+    struct ObjectStats
+    {
+        std::string name;
+        Word addr = 0;
+        Word size = 0;
+        uint64_t loads = 0;
+        uint64_t stores = 0;
+        uint64_t misses = 0;
+        uint64_t stallCycles = 0;
+        uint64_t bytesTouched = 0;
+        // accesses to a line seen before, and the sum of their intervals
+        uint64_t reuses = 0;
+        uint64_t reuseInterval = 0;
+
+        uint64_t Accesses() const
+        {
+            return loads + stores;
+        }
+    };
+
+    explicit DataProfiler(const ElfFile& elf)
+        : _elf(elf), _touched(memSize)
+    {
+        for (const ElfFile::Symbol& object : elf.Objects())
+            _stats.push_back({object.name, object.addr, object.size});
+        _stats.push_back({"[stack]"});
+        _stats.push_back({"[heap]"});
+        _stats.push_back({"[other]"});
+        for (const ElfFile::Section& section : elf.Sections())
+        {
+            if (section.flags & SHF_ALLOC)
+                _dataEnd = std::max<Word>(_dataEnd, section.addr + section.size);
+        }
+    }
+
+    // Called when sp is written
+    void StackPointer(Word value)
+    {
+        // crt code builds sp from small values
+        if (value >= _dataEnd)
+        {
+            _stackLow = std::min(_stackLow, value);
+            _stackHigh = std::max(_stackHigh, value);
+        }
+    }
+
+    // The data access of `instr`; the instruction took `cycles` cycles and
+    // caused `misses` D-cache misses, and its fetch `fetchMisses` I-cache
+    // misses
+    void Access(const Instruction& instr, const InstrState& state, uint64_t cycles, uint64_t misses,
+                uint64_t fetchMisses)
+    {
+        Word addr = state._addr;
+        ObjectStats& stats = _stats[Region(addr)];
+        if (instr._type == IType::Ld || instr._type == IType::Lr)
+            stats.loads++;
+        else
+            stats.stores++;
+        stats.misses += misses;
+        // a fetch miss would hide the data stall
+        if (!fetchMisses && cycles > 1)
+            stats.stallCycles += cycles - 1;
+
+        if (ToWordAddr(addr) < _touched.size() && !_touched[ToWordAddr(addr)])
+        {
+            _touched[ToWordAddr(addr)] = true;
+            stats.bytesTouched += sizeof(Word);
+        }
+        auto [it, first] = _lastUse.try_emplace(ToLineAddr(addr), _accesses);
+        if (!first)
+        {
+            stats.reuses++;
+            stats.reuseInterval += _accesses - it->second;
+            it->second = _accesses;
+        }
+        _accesses++;
+    }
+
+    // Every region with accesses, most misses first
+    std::vector<ObjectStats> Objects() const
+    {
+        std::vector<ObjectStats> result;
+        for (const ObjectStats& stats : _stats)
+        {
+            if (stats.Accesses())
+                result.push_back(stats);
+        }
+        std::stable_sort(result.begin(), result.end(), [](const ObjectStats& a, const ObjectStats& b) {
+            return a.misses != b.misses ? a.misses > b.misses : a.Accesses() > b.Accesses();
+        });
+        return result;
+    }
+
+    void Report(std::ostream& out, size_t top = 20) const
+    {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "%10s %8s %10s %10s %8s %7s %10s %9s %10s  %s\n", "addr", "size", "loads",
+                 "stores", "misses", "miss%", "stall cyc", "touched", "reuse int", "object");
+        out << buf;
+        std::vector<ObjectStats> objects = Objects();
+        for (size_t i = 0; i < objects.size() && i < top; i++)
+        {
+            const ObjectStats& o = objects[i];
+            // the stack, heap and other regions have no fixed place
+            char addr[16] = "-";
+            char size[16] = "-";
+            if (o.name[0] != '[')
+            {
+                snprintf(addr, sizeof(addr), "%#x", o.addr);
+                snprintf(size, sizeof(size), "%u", o.size);
+            }
+            snprintf(buf, sizeof(buf), "%10s %8s %10" PRIu64 " %10" PRIu64 " %8" PRIu64 " %6.2f%% %10" PRIu64
+                     " %9" PRIu64 " %10.1f  %s\n", addr, size, o.loads, o.stores, o.misses,
+                     100.0 * o.misses / o.Accesses(), o.stallCycles, o.bytesTouched,
+                     o.reuses ? double(o.reuseInterval) / o.reuses : 0.0, o.name.c_str());
+            out << buf;
+        }
+    }
+
+private:
+    size_t Region(Word addr) const
+    {
+        size_t objects = _stats.size() - 3;
+        if (const ElfFile::Symbol* object = _elf.FindObject(addr))
+            return object - _elf.Objects().data();
+        // frames lie below the sp of their caller, so what lies at or above
+        // the highest sp, e.g. data reached through gp, is not the stack
+        if (addr >= _stackLow && addr < _stackHigh)
+            return objects;
+        return addr >= _dataEnd && addr < _stackLow ? objects + 1 : objects + 2;
+    }
+
+    const ElfFile& _elf;
+    // objects in ELF order, then stack, heap and other
+    std::vector<ObjectStats> _stats;
+    Word _dataEnd = 0;
+    Word _stackLow = ~0u;
+    Word _stackHigh = 0;
+    std::vector<bool> _touched;
+    std::unordered_map<Word, uint64_t> _lastUse;
+    uint64_t _accesses = 0;
+};
+
+#endif //RISCV_SIM_DATAPROFILER_H
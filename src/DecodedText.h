@@ -0,0 +1,167 @@
+#ifndef RISCV_SIM_DECODEDTEXT_H
+#define RISCV_SIM_DECODEDTEXT_H
+
+#include "Arena.h"
+#include "Decoder.h"
+#include "Elf.h"
+
+#include <algorithm>
+#include <vector>
+
+// Instruction pairs that a core can execute as one macro-op
+enum class Fusion : uint8_t
+{
+    None,
+    // lui rd, hi; addi rd, rd, lo: a 32-bit constant
+    LuiAddi,
+    // auipc rd, hi; jalr rd2, lo(rd): a far call or jump
+    AuipcJalr,
+    // slli rd, rs, n; srli/srai rd, rd, m: a bit-field extract
+    ShiftPair,
+    // slt(i)(u) rd, ...; beqz/bnez rd: compare and branch
+    CompareBranch,
+};
+
+// The executable sections of a program, decoded once at startup. There is an
+// entry for every halfword, so RV32C code is covered too. An entry remembers
+// the word it was decoded from, and Find() only returns it when the word just
+// fetched is the same; code written at run time is thus decoded on fetch,
+// and the table is never written after construction, so all harts can
+// share it. Fusible pairs are found here as well; the second instruction of
+// a pair is taken from the table unchecked.
+class DecodedText
+{
+public:
+    explicit DecodedText(const ElfFile& elf)
+        : DecodedText()
+    {
+        Word begin = ~0u;
+        Word end = 0;
+        for (const ElfFile::Section& section : elf.Sections())
+        {
+            if (!(section.flags & SHF_EXECINSTR) || section.data.empty())
+                continue;
+            begin = std::min(begin, section.addr);
+            end = std::max<Word>(end, section.addr + section.data.size());
+        }
+        if (begin >= end)
+            return;
+
+        std::vector<uint16_t> parcels((end - begin) / 2, 0);
+        for (const ElfFile::Section& section : elf.Sections())
+        {
+            if (!(section.flags & SHF_EXECINSTR))
+                continue;
+            for (size_t i = 0; i + 1 < section.data.size(); i += 2)
+                parcels[(section.addr - begin + i) / 2] = section.data[i] | section.data[i + 1] << 8u;
+        }
+        Build(begin, parcels);
+    }
+
+    // Code given as halfwords starting at `base`
+    DecodedText(Word base, const std::vector<uint16_t>& parcels)
+        : DecodedText()
+    {
+        Build(base, parcels);
+    }
+
+    DecodedText(const DecodedText&) = delete;
+    DecodedText& operator=(const DecodedText&) = delete;
+
+    // The predecoded instruction at `ip`, if `fetched` is still the word it
+    // was decoded from
+    const Instruction* Find(Word ip, Word fetched) const
+    {
+        Word index = (ip - _base) >> 1u;
+        if (index >= _keys.size() || _keys[index] != Key(fetched))
+            return nullptr;
+        return &_instrs[index];
+    }
+
+    // The instruction after the one at `ip` when the two form a fusible
+    // pair; the caller has checked the first one with Find()
+    const Instruction* FusedPartner(Word ip) const
+    {
+        Word index = (ip - _base) >> 1u;
+        if (index >= _fusion.size() || _fusion[index] == Fusion::None)
+            return nullptr;
+        return &_instrs[index + _instrs[index]._size / 2];
+    }
+
+    Fusion FusionAt(Word ip) const
+    {
+        Word index = (ip - _base) >> 1u;
+        return index < _fusion.size() ? _fusion[index] : Fusion::None;
+    }
+
+    size_t Size() const
+    {
+        return _instrs.size();
+    }
+
+private:
+    DecodedText()
+        : _keys(ArenaAllocator<Word>(_arena)), _instrs(ArenaAllocator<Instruction>(_arena)),
+          _fusion(ArenaAllocator<Fusion>(_arena))
+    {
+    }
+
+    void Build(Word base, const std::vector<uint16_t>& parcels)
+    {
+        _base = base;
+        _keys.resize(parcels.size());
+        _instrs.resize(parcels.size());
+        for (size_t i = 0; i < parcels.size(); i++)
+            _keys[i] = parcels[i] | Word(i + 1 < parcels.size() ? parcels[i + 1] : 0) << 16u;
+        Decoder::DecodeBlock(_keys.data(), _keys.size(), _instrs.data());
+        for (Word& key : _keys)
+            key = Key(key);
+
+        _fusion.assign(_instrs.size(), Fusion::None);
+        for (size_t i = 0; i < _instrs.size(); i++)
+        {
+            size_t next = i + _instrs[i]._size / 2;
+            if (next < _instrs.size())
+                _fusion[i] = PairFusion(_instrs[i], _instrs[next]);
+        }
+    }
+
+    static bool IsCompare(Handler handler)
+    {
+        return handler == Handler::Slt || handler == Handler::Sltu || handler == Handler::Slti ||
+               handler == Handler::Sltiu;
+    }
+
+    // The idioms a core would fuse. The first instruction of every pair
+    // falls through and the second consumes its result.
+    static Fusion PairFusion(const Instruction& first, const Instruction& second)
+    {
+        if (first._dst == 0 || second._src1 != first._dst)
+            return Fusion::None;
+        if (first._handler == Handler::Lui && second._handler == Handler::Addi && second._dst == first._dst)
+            return Fusion::LuiAddi;
+        if (first._handler == Handler::Auipc && second._handler == Handler::Jalr)
+            return Fusion::AuipcJalr;
+        if (first._handler == Handler::Slli && second._dst == first._dst &&
+            (second._handler == Handler::Srli || second._handler == Handler::Srai))
+            return Fusion::ShiftPair;
+        if (IsCompare(first._handler) && (second._handler == Handler::Beq || second._handler == Handler::Bne) &&
+            second._src2 == 0)
+            return Fusion::CompareBranch;
+        return Fusion::None;
+    }
+
+    // a compressed instruction does not depend on the parcel after it
+    static Word Key(Word word)
+    {
+        return Decoder::IsCompressed(word) ? word & 0xffffu : word;
+    }
+
+    Arena _arena;
+    Word _base = 0;
+    std::vector<Word, ArenaAllocator<Word>> _keys;
+    std::vector<Instruction, ArenaAllocator<Instruction>> _instrs;
+    std::vector<Fusion, ArenaAllocator<Fusion>> _fusion;
+};
+
+#endif //RISCV_SIM_DECODEDTEXT_H
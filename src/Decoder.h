@@ -2,223 +2,527 @@
 #ifndef RISCV_SIM_DECODER_H
 #define RISCV_SIM_DECODER_H
 
+#include "HostProfile.h"
 #include "Instruction.h"
 
-// This decoder implementation is stateless, so it could be a function as well
+#include <array>
+#include <cstddef>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RISCV_SIM_HAVE_AVX2_DECODE 1
+#endif
+
+// This decoder implementation is stateless, so it could be a function as well.
+// Decoding is a lookup in a table generated at compile time, keyed by the
+// opcode, funct3 and the two funct7 bits that select instruction variants
+// (bit 30 for SUB/SRA, bit 25 for the M extension). The entry yields the
+// prototype of the decoded instruction and the immediate format, so only that
+// immediate is extracted, with shifts and masks instead of branches.
 class Decoder
 {
 
 public:
-    InstructionPtr Decode(Word data)
-    {
-        DecodedInstr decoded{data};
-
-        InstructionPtr instr = std::make_unique<Instruction>();
-        Imm immI = SignExtend(decoded.i.imm11_0, 11);
-        Imm immS = SignExtend(decoded.s.imm11_5 << 5u | decoded.s.imm4_0, 11);
-        Word immU = decoded.u.imm31_12 << 12u;
-        Imm immB = SignExtend((decoded.b.imm12 << 12u) | (decoded.b.imm11 << 11u) |
-                              (decoded.b.imm10_5 << 5u) | (decoded.b.imm4_1 << 1u),
-                              12);
-        Imm immJ = SignExtend((decoded.j.imm20 << 20u) | (decoded.j.imm19_12 << 12u) |
-                              (decoded.j.imm11 << 11u) | (decoded.j.imm10_1 << 1u),
-                              20);
-
-        switch (static_cast<Opcode>(decoded.i.opcode))
+    Instruction Decode(Word data)
+    {
+        HOST_PROFILE_SCOPE(Decode);
+        bool compressed = IsCompressed(data);
+        Word raw = compressed ? Expand(data & 0xffffu) : data;
+        const DecodeEntry& entry = decodeTable[TableIndex(raw)];
+
+        Instruction instr = entry.prototype;
+        instr._size = compressed ? 2 : 4;
+        instr._dst &= raw >> 7u;
+        instr._src1 &= raw >> 15u;
+        instr._src2 &= raw >> 20u;
+        instr._imm = ExtractImm(raw, entry.imm);
+        if (entry.refine)
+            RefineSystemAmo(instr, raw);
+        return instr;
+    }
+
+    // Decodes `count` consecutive instruction words at once, e.g. a whole
+    // text section when it is predecoded; out[i] equals Decode(words[i])
+    static void DecodeBlock(const Word* words, size_t count, Instruction* out)
+    {
+#ifdef RISCV_SIM_HAVE_AVX2_DECODE
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if (avx2)
         {
-            case Opcode::OpImm:
+            DecodeBlockAvx2(words, count, out);
+            return;
+        }
+#endif
+        DecodeBlockScalar(words, count, out);
+    }
+
+    static void DecodeBlockScalar(const Word* words, size_t count, Instruction* out)
+    {
+        Decoder decoder;
+        for (size_t i = 0; i < count; i++)
+            out[i] = decoder.Decode(words[i]);
+    }
+
+#ifdef RISCV_SIM_HAVE_AVX2_DECODE
+    // Extracts the table key, the register fields and all immediate formats
+    // of eight words per step; picking the entry and the immediate the entry
+    // asks for is then a couple of loads per instruction
+    __attribute__((target("avx2")))
+    static void DecodeBlockAvx2(const Word* words, size_t count, Instruction* out)
+    {
+        const __m256i three = _mm256_set1_epi32(3);
+        alignas(32) Word raw[8];
+        alignas(32) Word index[8];
+        alignas(32) Word rd[8];
+        alignas(32) Word rs1[8];
+        alignas(32) Word rs2[8];
+        alignas(32) Word imms[size_t(ImmKind::Count)][8] = {};
+
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+            __m256i full = _mm256_cmpeq_epi32(_mm256_and_si256(v, three), three);
+            unsigned compressed = ~unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(full))) & 0xffu;
+            if (compressed)
             {
-                instr->_imm = immI;
-                instr->_type = IType::Alu;
-                instr->_aluFunc = static_cast<AluFunc>(decoded.i.funct3);
-                if (instr->_aluFunc == AluFunc::Sr)
+                _mm256_store_si256(reinterpret_cast<__m256i*>(raw), v);
+                for (unsigned lane = 0; lane < 8; lane++)
                 {
-                    instr->_aluFunc = decoded.r.aluSel ? AluFunc::Sra : AluFunc::Srl;
-                    instr->_imm.value() &= 31u;
+                    if (compressed & (1u << lane))
+                        raw[lane] = Expand(raw[lane] & 0xffffu);
                 }
-                instr->_dst = RId(decoded.i.rd);
-                instr->_src1 = RId(decoded.i.rs1);
-                break;
+                v = _mm256_load_si256(reinterpret_cast<const __m256i*>(raw));
             }
-            case Opcode::Op:
+            _mm256_store_si256(reinterpret_cast<__m256i*>(raw), v);
+
+            __m256i key = _mm256_or_si256(
+                _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(v, 2), Splat(31)), 5),
+                                _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(v, 12), Splat(7)), 2)),
+                _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(v, 30), Splat(1)), 1),
+                                _mm256_and_si256(_mm256_srli_epi32(v, 25), Splat(1))));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(index), key);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(rd), _mm256_srli_epi32(v, 7));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(rs1), _mm256_srli_epi32(v, 15));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(rs2), _mm256_srli_epi32(v, 20));
+
+            __m256i sign20 = _mm256_srai_epi32(v, 20);
+            __m256i immI = sign20;
+            __m256i immS = _mm256_or_si256(_mm256_andnot_si256(Splat(0x1f), sign20),
+                                           _mm256_and_si256(_mm256_srli_epi32(v, 7), Splat(0x1f)));
+            __m256i immB = _mm256_or_si256(
+                _mm256_or_si256(_mm256_andnot_si256(Splat(0xfff), _mm256_srai_epi32(v, 19)),
+                                _mm256_and_si256(_mm256_srli_epi32(v, 20), Splat(0x7e0))),
+                _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 7), Splat(0x1e)),
+                                _mm256_and_si256(_mm256_slli_epi32(v, 4), Splat(0x800))));
+            __m256i immU = _mm256_and_si256(v, Splat(0xfffff000u));
+            __m256i immJ = _mm256_or_si256(
+                _mm256_or_si256(_mm256_andnot_si256(Splat(0xfffff), _mm256_srai_epi32(v, 11)),
+                                _mm256_and_si256(v, Splat(0xff000))),
+                _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(v, 9), Splat(0x800)),
+                                _mm256_and_si256(_mm256_srli_epi32(v, 20), Splat(0x7fe))));
+            __m256i shamt = _mm256_and_si256(_mm256_srli_epi32(v, 20), Splat(0x1f));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(imms[size_t(ImmKind::I)]), immI);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(imms[size_t(ImmKind::S)]), immS);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(imms[size_t(ImmKind::B)]), immB);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(imms[size_t(ImmKind::U)]), immU);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(imms[size_t(ImmKind::J)]), immJ);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(imms[size_t(ImmKind::Shamt)]), shamt);
+
+            for (unsigned lane = 0; lane < 8; lane++)
             {
-                instr->_type = IType::Alu;
-                auto funct3 = AluFunc(decoded.r.funct3);
-                if (funct3 == AluFunc::Add)
-                {
-                    instr->_aluFunc = decoded.r.aluSel == 0 ? AluFunc::Add : AluFunc::Sub;
-                }
-                else if (funct3 == AluFunc::Sr)
-                {
-                    instr->_aluFunc = decoded.r.aluSel ? AluFunc::Sra : AluFunc::Srl;
-                }
-                else
-                {
-                    instr->_aluFunc = funct3;
-                }
-                instr->_dst = RId(decoded.r.rd);
-                instr->_src1 = RId(decoded.r.rs1);
-                instr->_src2 = RId(decoded.r.rs2);
-                break;
+                const DecodeEntry& entry = decodeTable[index[lane]];
+                Instruction instr = entry.prototype;
+                instr._size = compressed & (1u << lane) ? 2 : 4;
+                instr._dst &= rd[lane];
+                instr._src1 &= rs1[lane];
+                instr._src2 &= rs2[lane];
+                instr._imm = imms[size_t(entry.imm)][lane];
+                if (entry.refine)
+                    RefineSystemAmo(instr, raw[lane]);
+                out[i + lane] = instr;
             }
-            case Opcode::Lui:
+        }
+        DecodeBlockScalar(words + i, count - i, out + i);
+    }
+
+    __attribute__((target("avx2")))
+    static __m256i Splat(Word bits)
+    {
+        return _mm256_set1_epi32(static_cast<int>(bits));
+    }
+#endif
+
+    static bool IsCompressed(Word data)
+    {
+        return (data & 0b11u) != 0b11u;
+    }
+
+    // Expands a RV32C instruction into its 32-bit equivalent; illegal and
+    // floating-point encodings become 0, which decodes as Unsupported
+    static Word Expand(uint16_t c)
+    {
+        auto bits = [c](unsigned hi, unsigned lo) -> Word { return (c >> lo) & ((1u << (hi - lo + 1)) - 1); };
+        auto sext = [](Word value, unsigned width) -> Word {
+            return (Word)((SignedWord)(value << (32 - width)) >> (32 - width));
+        };
+        Word rd = bits(11, 7);
+        Word rs2 = bits(6, 2);
+        Word rdp = bits(4, 2) + 8;   // rd'/rs2'
+        Word rs1p = bits(9, 7) + 8;  // rs1'/rd'
+        Word imm6 = sext(bits(12, 12) << 5 | bits(6, 2), 6);
+
+        switch (bits(1, 0) << 3 | bits(15, 13))
+        {
+            case 0b00'000: // C.ADDI4SPN
             {
-                instr->_type = IType::Alu;
-                instr->_aluFunc = AluFunc::Add;
-                instr->_dst = RId(decoded.u.rd);
-                instr->_src1 = 0;
-                instr->_imm = immU;
-                break;
+                Word imm = bits(10, 7) << 6 | bits(12, 11) << 4 | bits(5, 5) << 3 | bits(6, 6) << 2;
+                return imm ? EncodeI(Opcode::OpImm, rdp, 0b000, 2, imm) : 0;
             }
-            case Opcode::Auipc:
+            case 0b00'010: // C.LW
+                return EncodeI(Opcode::Load, rdp, fnLW, rs1p, bits(5, 5) << 6 | bits(12, 10) << 3 | bits(6, 6) << 2);
+            case 0b00'110: // C.SW
+                return EncodeS(Opcode::Store, fnSW, rs1p, rdp, bits(5, 5) << 6 | bits(12, 10) << 3 | bits(6, 6) << 2);
+            case 0b01'000: // C.ADDI, C.NOP
+                return EncodeI(Opcode::OpImm, rd, 0b000, rd, imm6);
+            case 0b01'001: // C.JAL
+            case 0b01'101: // C.J
             {
-                instr->_type = IType::Auipc;
-                instr->_dst = RId(decoded.u.rd);
-                instr->_imm = immU;
-                break;
+                Word imm = sext(bits(12, 12) << 11 | bits(8, 8) << 10 | bits(10, 9) << 8 | bits(6, 6) << 7 |
+                                bits(7, 7) << 6 | bits(2, 2) << 5 | bits(11, 11) << 4 | bits(5, 3) << 1, 12);
+                return EncodeJ(bits(15, 13) == 0b001 ? 1 : 0, imm);
             }
-            case Opcode::Jal:
+            case 0b01'010: // C.LI
+                return EncodeI(Opcode::OpImm, rd, 0b000, 0, imm6);
+            case 0b01'011:
             {
-                instr->_type = IType::J;
-                instr->_brFunc = BrFunc::AT;
-                instr->_dst = RId(decoded.j.rd);
-                instr->_imm = immJ;
-                break;
+                if (rd == 2) // C.ADDI16SP
+                {
+                    Word imm = sext(bits(12, 12) << 9 | bits(4, 3) << 7 | bits(5, 5) << 6 | bits(2, 2) << 5 |
+                                    bits(6, 6) << 4, 10);
+                    return imm ? EncodeI(Opcode::OpImm, 2, 0b000, 2, imm) : 0;
+                }
+                // C.LUI
+                return imm6 ? (imm6 << 12) | (rd << 7) | Word(Opcode::Lui) : 0;
             }
-            case Opcode::Jalr:
+            case 0b01'100:
             {
-                instr->_type = IType::Jr;
-                instr->_brFunc = BrFunc::AT;
-                instr->_dst = RId(decoded.i.rd);
-                instr->_src1 = RId(decoded.i.rs1);
-                instr->_imm = immI;
-                break;
+                Word shamt = bits(6, 2);
+                switch (bits(11, 10))
+                {
+                    case 0b00: return bits(12, 12) ? 0 : EncodeI(Opcode::OpImm, rs1p, 0b101, rs1p, shamt);
+                    case 0b01: return bits(12, 12) ? 0 : EncodeI(Opcode::OpImm, rs1p, 0b101, rs1p, shamt | 0x400);
+                    case 0b10: return EncodeI(Opcode::OpImm, rs1p, 0b111, rs1p, imm6);
+                    default:
+                    {
+                        if (bits(12, 12))
+                            return 0;
+                        static constexpr Word funct3[] = {0b000, 0b100, 0b110, 0b111};
+                        Word funct7 = bits(6, 5) == 0 ? 0b0100000 : 0;
+                        return EncodeR(Opcode::Op, rs1p, funct3[bits(6, 5)], rs1p, rdp, funct7);
+                    }
+                }
             }
-            case Opcode::Branch:
+            case 0b01'110: // C.BEQZ
+            case 0b01'111: // C.BNEZ
             {
-                instr->_type = IType::Br;
-                instr->_brFunc = static_cast<BrFunc>(decoded.b.funct3);
-                instr->_src1 = RId(decoded.b.rs1);
-                instr->_src2 = RId(decoded.b.rs2);
-                instr->_imm = immB;
-                break;
+                Word imm = sext(bits(12, 12) << 8 | bits(6, 5) << 6 | bits(2, 2) << 5 | bits(11, 10) << 3 |
+                                bits(4, 3) << 1, 9);
+                return EncodeB(bits(13, 13) ? 0b001 : 0b000, rs1p, 0, imm);
             }
-            case Opcode::Load:
+            case 0b10'000: // C.SLLI
+                return bits(12, 12) ? 0 : EncodeI(Opcode::OpImm, rd, 0b001, rd, rs2);
+            case 0b10'010: // C.LWSP
+                return rd ? EncodeI(Opcode::Load, rd, fnLW, 2, bits(3, 2) << 6 | bits(12, 12) << 5 | bits(6, 4) << 2) : 0;
+            case 0b10'100:
             {
-                instr->_type = decoded.i.funct3 == fnLW ? IType::Ld : IType::Unsupported;
-                instr->_aluFunc = AluFunc::Add;
-                instr->_dst = RId(decoded.i.rd);
-                instr->_src1 = RId(decoded.i.rs1);
-                instr->_imm = immI;
-                break;
+                if (!bits(12, 12))
+                {
+                    if (rs2 == 0) // C.JR
+                        return rd ? EncodeI(Opcode::Jalr, 0, 0b000, rd, 0) : 0;
+                    return EncodeR(Opcode::Op, rd, 0b000, 0, rs2, 0); // C.MV
+                }
+                if (rs2 == 0) // C.JALR, C.EBREAK
+                    return rd ? EncodeI(Opcode::Jalr, 1, 0b000, rd, 0) : 0;
+                return EncodeR(Opcode::Op, rd, 0b000, rd, rs2, 0); // C.ADD
             }
+            case 0b10'110: // C.SWSP
+                return EncodeS(Opcode::Store, fnSW, 2, rs2, bits(8, 7) << 6 | bits(12, 9) << 2);
+            default:
+                return 0;
+        }
+    }
+
+private:
+    enum class ImmKind : uint8_t
+    {
+        None,
+        I,
+        S,
+        B,
+        U,
+        J,
+        Shamt,
+        Count,
+    };
+
+    // operand fields an entry uses
+    enum : uint8_t
+    {
+        Rd = 1u << 0,
+        Rs1 = 1u << 1,
+        Rs2 = 1u << 2,
+        // CSR and AMO encodings need fields beyond the table key
+        Refine = 1u << 3,
+    };
+
+    struct DecodeEntry
+    {
+        // the decoded instruction without its operands and immediate; the
+        // register fields hold the mask of the raw field, 31 or 0 if unused
+        Instruction prototype;
+        ImmKind imm;
+        bool refine;
+    };
+
+    // what Classify makes of one table key
+    struct Spec
+    {
+        Handler handler = Handler::Unsupported;
+        IType type = IType::Unsupported;
+        AluFunc aluFunc = AluFunc::None;
+        BrFunc brFunc = BrFunc::NT;
+        ImmKind imm = ImmKind::None;
+        uint8_t flags = 0;
+        uint8_t operands = 0;
+    };
+
+    // An immediate is the sign-extended top of the word, plus up to three
+    // bit fields moved into place with a rotate
+    struct ImmLayout
+    {
+        uint8_t signShift;
+        Word signMask;
+        uint8_t shift[3];
+        Word mask[3];
+    };
+
+    static constexpr ImmLayout immLayouts[size_t(ImmKind::Count)] = {
+        /* None  */ {0, 0, {0, 0, 0}, {0, 0, 0}},
+        /* I     */ {20, ~0u, {0, 0, 0}, {0, 0, 0}},
+        /* S     */ {20, ~0x1fu, {7, 0, 0}, {0x1f, 0, 0}},
+        /* B     */ {19, ~0xfffu, {20, 7, 28}, {0x7e0, 0x1e, 0x800}},
+        /* U     */ {0, 0xfffff000u, {0, 0, 0}, {0, 0, 0}},
+        /* J     */ {11, ~0xfffffu, {0, 9, 20}, {0xff000, 0x800, 0x7fe}},
+        /* Shamt */ {0, 0, {20, 0, 0}, {0x1f, 0, 0}},
+    };
+
+    static constexpr size_t TableIndex(Word raw)
+    {
+        return ((raw >> 2u) & 31u) << 5u | ((raw >> 12u) & 7u) << 2u | ((raw >> 30u) & 1u) << 1u | ((raw >> 25u) & 1u);
+    }
+
+    static constexpr Word Rotr(Word value, unsigned shift)
+    {
+        return value >> shift | value << ((32u - shift) & 31u);
+    }
+
+    static Word ExtractImm(Word raw, ImmKind kind)
+    {
+        const ImmLayout& layout = immLayouts[size_t(kind)];
+        return (Word(SignedWord(raw) >> layout.signShift) & layout.signMask) |
+               (Rotr(raw, layout.shift[0]) & layout.mask[0]) |
+               (Rotr(raw, layout.shift[1]) & layout.mask[1]) |
+               (Rotr(raw, layout.shift[2]) & layout.mask[2]);
+    }
+
+    static constexpr Word OperandMask(uint8_t operands, uint8_t field)
+    {
+        return -Word((operands & field) != 0) & 31u;
+    }
+
+    static void RefineSystemAmo(Instruction& instr, Word raw)
+    {
+        if (instr._flags & HasCsr)
+        {
+            instr._csr = static_cast<CsrIdx>(raw >> 20u);
+            // only CSRW (CSRRW x0) and CSRR (CSRRS with x0) are implemented
+            if ((instr._handler == Handler::Csrrw && instr._dst != 0) ||
+                (instr._handler == Handler::Csrrs && instr._src1 != 0))
+                instr._type = IType::Unsupported;
+            return;
+        }
+        Word funct5 = raw >> 27u;
+        instr._amoFunc = static_cast<AmoFunc>(funct5);
+        instr._handler = amoHandlers[funct5];
+        if (instr._handler == Handler::LrW)
+            instr._type = IType::Lr;
+        else if (instr._handler == Handler::ScW)
+            instr._type = IType::Sc;
+        else if (instr._handler == Handler::Unsupported)
+            instr._type = IType::Unsupported;
+    }
+
+    static constexpr Spec Classify(Word opcode, Word funct3, bool alt, bool mulDiv)
+    {
+        constexpr Handler branches[] = {Handler::Beq, Handler::Bne, Handler::Unsupported, Handler::Unsupported,
+                                        Handler::Blt, Handler::Bge, Handler::Bltu, Handler::Bgeu};
+        constexpr Handler opImms[] = {Handler::Addi, Handler::Slli, Handler::Slti, Handler::Sltiu,
+                                      Handler::Xori, Handler::Srli, Handler::Ori, Handler::Andi};
+        constexpr Handler ops[] = {Handler::Add, Handler::Sll, Handler::Slt, Handler::Sltu,
+                                   Handler::Xor, Handler::Srl, Handler::Or, Handler::And};
+        const Spec unsupported{};
+
+        switch (static_cast<Opcode>(opcode))
+        {
+            case Opcode::Lui:
+                return {Handler::Lui, IType::Alu, AluFunc::Add, BrFunc::NT, ImmKind::U, HasImm, Rd};
+            case Opcode::Auipc:
+                return {Handler::Auipc, IType::Auipc, AluFunc::None, BrFunc::NT, ImmKind::U, HasImm, Rd};
+            case Opcode::Jal:
+                return {Handler::Jal, IType::J, AluFunc::None, BrFunc::AT, ImmKind::J, HasImm, Rd};
+            case Opcode::Jalr:
+                return {Handler::Jalr, IType::Jr, AluFunc::None, BrFunc::AT, ImmKind::I, HasImm, Rd | Rs1};
+            case Opcode::Branch:
+                if (branches[funct3] == Handler::Unsupported)
+                    return unsupported;
+                return {branches[funct3], IType::Br, AluFunc::None, static_cast<BrFunc>(funct3), ImmKind::B, HasImm,
+                        Rs1 | Rs2};
+            case Opcode::Load:
+                if (funct3 != fnLW)
+                    return unsupported;
+                return {Handler::Lw, IType::Ld, AluFunc::Add, BrFunc::NT, ImmKind::I, HasImm, Rd | Rs1};
             case Opcode::Store:
+                if (funct3 != fnSW)
+                    return unsupported;
+                return {Handler::Sw, IType::St, AluFunc::Add, BrFunc::NT, ImmKind::S, HasImm, Rs1 | Rs2};
+            case Opcode::OpImm:
             {
-                instr->_type = decoded.i.funct3 == fnSW ? IType::St : IType::Unsupported;
-                instr->_aluFunc = AluFunc::Add;
-                instr->_src1 = RId(decoded.s.rs1);
-                instr->_src2 = RId(decoded.s.rs2);
-                instr->_imm = immS;
-                break;
+                auto func = static_cast<AluFunc>(funct3);
+                if (func == AluFunc::Sll)
+                    return {Handler::Slli, IType::Alu, func, BrFunc::NT, ImmKind::Shamt, HasImm, Rd | Rs1};
+                if (func == AluFunc::Sr)
+                    return {alt ? Handler::Srai : Handler::Srli, IType::Alu, alt ? AluFunc::Sra : AluFunc::Srl,
+                            BrFunc::NT, ImmKind::Shamt, HasImm, Rd | Rs1};
+                return {opImms[funct3], IType::Alu, func, BrFunc::NT, ImmKind::I, HasImm, Rd | Rs1};
             }
-            case Opcode::System:
+            case Opcode::Op:
             {
-                if (decoded.i.funct3 == fnCSRRW && decoded.i.rd == 0)
+                Handler handler = ops[funct3];
+                auto func = static_cast<AluFunc>(funct3);
+                if (mulDiv)
                 {
-                    instr->_type = IType::Csrw;
+                    handler = static_cast<Handler>(static_cast<int>(Handler::Mul) + funct3);
+                    func = static_cast<AluFunc>(static_cast<int>(AluFunc::Mul) + funct3);
                 }
-                else if (decoded.i.funct3 == fnCSRRS && decoded.i.rs1 == 0)
+                else if (func == AluFunc::Add && alt)
                 {
-                    instr->_type = IType::Csrr;
+                    handler = Handler::Sub;
+                    func = AluFunc::Sub;
                 }
-                instr->_dst = RId(decoded.i.rd);
-                instr->_src1 = RId(decoded.i.rs1);
-                instr->_csr = static_cast<CsrIdx>(immI & 0xfff);
-                break;
+                else if (func == AluFunc::Sr)
+                {
+                    handler = alt ? Handler::Sra : Handler::Srl;
+                    func = alt ? AluFunc::Sra : AluFunc::Srl;
+                }
+                return {handler, IType::Alu, func, BrFunc::NT, ImmKind::None, 0, Rd | Rs1 | Rs2};
             }
-            // LR SC FENCE AMO not implemented
             case Opcode::MiscMem:
+                // a single hart observes its own accesses in order, and the
+                // harts of a MultiHart system publish stores only at quantum
+                // barriers, so FENCE has nothing to do
+                if (funct3 != fnFENCE)
+                    return unsupported;
+                return {Handler::Fence, IType::Alu, AluFunc::Add, BrFunc::NT, ImmKind::None, 0, 0};
+            case Opcode::System:
+                if (funct3 == fnCSRRW)
+                    return {Handler::Csrrw, IType::Csrw, AluFunc::None, BrFunc::NT, ImmKind::None, HasCsr,
+                            Rd | Rs1 | Refine};
+                if (funct3 == fnCSRRS)
+                    return {Handler::Csrrs, IType::Csrr, AluFunc::None, BrFunc::NT, ImmKind::None, HasCsr,
+                            Rd | Rs1 | Refine};
+                return unsupported;
             case Opcode::Amo:
+                if (funct3 != fnAMOW)
+                    return unsupported;
+                return {Handler::Unsupported, IType::Amo, AluFunc::None, BrFunc::NT, ImmKind::None, 0,
+                        Rd | Rs1 | Rs2 | Refine};
             default:
-            {
-                instr->_type = IType::Unsupported;
-                instr->_aluFunc = AluFunc::None;
-                instr->_brFunc = BrFunc::NT;
-            }
+                return unsupported;
         }
+    }
 
-        if (instr->_dst.value_or(0) == 0)
-            instr->_dst.reset();
+    static constexpr std::array<DecodeEntry, 1024> BuildTable()
+    {
+        std::array<DecodeEntry, 1024> table{};
+        for (Word index = 0; index < table.size(); index++)
+        {
+            Word opcode = (index >> 5u) << 2u | 0b11u;
+            Spec spec = Classify(opcode, (index >> 2u) & 7u, (index >> 1u) & 1u, index & 1u);
+            DecodeEntry& entry = table[index];
+            entry.prototype._handler = spec.handler;
+            entry.prototype._type = spec.type;
+            entry.prototype._aluFunc = spec.aluFunc;
+            entry.prototype._brFunc = spec.brFunc;
+            entry.prototype._flags = spec.flags;
+            entry.prototype._dst = OperandMask(spec.operands, Rd);
+            entry.prototype._src1 = OperandMask(spec.operands, Rs1);
+            entry.prototype._src2 = OperandMask(spec.operands, Rs2);
+            entry.imm = spec.imm;
+            entry.refine = spec.operands & Refine;
+        }
+        return table;
+    }
 
-        return instr;
+    static constexpr std::array<Handler, 32> BuildAmoHandlers()
+    {
+        std::array<Handler, 32> handlers{};
+        handlers[Word(AmoFunc::Lr)] = Handler::LrW;
+        handlers[Word(AmoFunc::Sc)] = Handler::ScW;
+        handlers[Word(AmoFunc::Swap)] = Handler::AmoswapW;
+        handlers[Word(AmoFunc::Add)] = Handler::AmoaddW;
+        handlers[Word(AmoFunc::Xor)] = Handler::AmoxorW;
+        handlers[Word(AmoFunc::And)] = Handler::AmoandW;
+        handlers[Word(AmoFunc::Or)] = Handler::AmoorW;
+        handlers[Word(AmoFunc::Min)] = Handler::AmominW;
+        handlers[Word(AmoFunc::Max)] = Handler::AmomaxW;
+        handlers[Word(AmoFunc::Minu)] = Handler::AmominuW;
+        handlers[Word(AmoFunc::Maxu)] = Handler::AmomaxuW;
+        return handlers;
     }
 
-private:
-    using Imm = int32_t;
+    // defined after the class, where the generators are complete
+    static const std::array<DecodeEntry, 1024> decodeTable;
+    static const std::array<Handler, 32> amoHandlers;
 
-    Imm SignExtend(Imm i, unsigned sbit)
+    static Word EncodeR(Opcode opcode, Word rd, Word funct3, Word rs1, Word rs2, Word funct7)
     {
-        return i + ((0xffffffff << (sbit + 1)) * ((i & (1u << sbit)) >> sbit));
+        return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | Word(opcode);
     }
-    union DecodedInstr
+
+    static Word EncodeI(Opcode opcode, Word rd, Word funct3, Word rs1, Word imm)
     {
-        Word instr;
-        struct rType
-        {
-            uint32_t opcode : 7;
-            uint32_t rd : 5;
-            uint32_t funct3 : 3;
-            uint32_t rs1 : 5;
-            uint32_t rs2 : 5;
-            uint32_t reserved1 : 5;
-            uint32_t aluSel : 1;
-            uint32_t reserved2 : 1;
-        } r;
-        struct iType
-        {
-            uint32_t opcode : 7;
-            uint32_t rd : 5;
-            uint32_t funct3 : 3;
-            uint32_t rs1 : 5;
-            uint32_t imm11_0 : 12;
-        } i;
-        struct sType
-        {
-            uint32_t opcode : 7;
-            uint32_t imm4_0 : 5;
-            uint32_t funct3 : 3;
-            uint32_t rs1 : 5;
-            uint32_t rs2 : 5;
-            uint32_t imm11_5 : 7;
-        } s;
-        struct bType
-        {
-            uint32_t opcode : 7;
-            uint32_t imm11 : 1;
-            uint32_t imm4_1 : 4;
-            uint32_t funct3 : 3;
-            uint32_t rs1 : 5;
-            uint32_t rs2 : 5;
-            uint32_t imm10_5 : 6;
-            uint32_t imm12 : 1;
-        } b;
-        struct uType
-        {
-            uint32_t opcode : 7;
-            uint32_t rd : 5;
-            uint32_t imm31_12 : 20;
-        } u;
-        struct jType
-        {
-            uint32_t opcode : 7;
-            uint32_t rd : 5;
-            uint32_t imm19_12 : 8;
-            uint32_t imm11 : 1;
-            uint32_t imm10_1 : 10;
-            uint32_t imm20 : 1;
-        } j;
+        return (imm & 0xfff) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | Word(opcode);
+    }
 
-    };
+    static Word EncodeS(Opcode opcode, Word funct3, Word rs1, Word rs2, Word imm)
+    {
+        return ((imm >> 5) & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (imm & 0x1f) << 7 | Word(opcode);
+    }
+
+    static Word EncodeB(Word funct3, Word rs1, Word rs2, Word imm)
+    {
+        return ((imm >> 12) & 1) << 31 | ((imm >> 5) & 0x3f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+               ((imm >> 1) & 0xf) << 8 | ((imm >> 11) & 1) << 7 | Word(Opcode::Branch);
+    }
+
+    static Word EncodeJ(Word rd, Word imm)
+    {
+        return ((imm >> 20) & 1) << 31 | ((imm >> 1) & 0x3ff) << 21 | ((imm >> 11) & 1) << 20 |
+               ((imm >> 12) & 0xff) << 12 | rd << 7 | Word(Opcode::Jal);
+    }
 };
 
+inline constexpr std::array<Decoder::DecodeEntry, 1024> Decoder::decodeTable = Decoder::BuildTable();
+inline constexpr std::array<Handler, 32> Decoder::amoHandlers = Decoder::BuildAmoHandlers();
+
 #endif //RISCV_SIM_DECODER_H
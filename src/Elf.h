@@ -0,0 +1,209 @@
+#ifndef RISCV_SIM_ELF_H
+#define RISCV_SIM_ELF_H
+
+#include "Decoder.h"
+
+#include <elf.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Read-only view of the sections of a 32-bit ELF file, for tools that look
+// at a program rather than run it. MemoryStorage::LoadElf loads the segments.
+class ElfFile
+{
+public:
+    struct Section
+    {
+        std::string name;
+        Word addr = 0;
+        Word type = 0;
+        Word flags = 0;
+        // in memory; data is empty for .bss
+        Word size = 0;
+        std::vector<uint8_t> data;
+    };
+
+    // A function or data object from .symtab
+    struct Symbol
+    {
+        std::string name;
+        Word addr = 0;
+        // 0 when the symbol does not say; it then ends at the next one
+        Word size = 0;
+    };
+
+    bool Load(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        if (!file.is_open())
+        {
+            std::cerr << "ERROR: elf: failed opening file \"" << path << "\"" << std::endl;
+            return false;
+        }
+        std::vector<char> buf((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        const auto* ehdr = reinterpret_cast<const Elf32_Ehdr*>(buf.data());
+        if (buf.size() < sizeof(Elf32_Ehdr) || std::memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+            ehdr->e_ident[EI_CLASS] != ELFCLASS32)
+        {
+            std::cerr << "ERROR: elf: \"" << path << "\" is not a 32-bit elf file" << std::endl;
+            return false;
+        }
+        if (ehdr->e_shoff + size_t(ehdr->e_shnum) * sizeof(Elf32_Shdr) > buf.size() ||
+            ehdr->e_shstrndx >= ehdr->e_shnum)
+        {
+            std::cerr << "ERROR: elf: bad section header table in \"" << path << "\"" << std::endl;
+            return false;
+        }
+
+        const auto* shdrs = reinterpret_cast<const Elf32_Shdr*>(buf.data() + ehdr->e_shoff);
+        const Elf32_Shdr& names = shdrs[ehdr->e_shstrndx];
+        _sections.clear();
+        for (size_t i = 0; i < ehdr->e_shnum; i++)
+        {
+            const Elf32_Shdr& shdr = shdrs[i];
+            Section section;
+            if (shdr.sh_name < names.sh_size)
+                section.name = buf.data() + names.sh_offset + shdr.sh_name;
+            section.addr = shdr.sh_addr;
+            section.type = shdr.sh_type;
+            section.flags = shdr.sh_flags;
+            section.size = shdr.sh_size;
+            if (shdr.sh_type != SHT_NOBITS && shdr.sh_offset + size_t(shdr.sh_size) <= buf.size())
+                section.data.assign(buf.begin() + shdr.sh_offset, buf.begin() + shdr.sh_offset + shdr.sh_size);
+            _sections.push_back(std::move(section));
+        }
+        LoadSymbols(shdrs, ehdr->e_shnum);
+        return true;
+    }
+
+    const std::vector<Section>& Sections() const
+    {
+        return _sections;
+    }
+
+    const Section* Find(const std::string& name) const
+    {
+        for (const Section& section : _sections)
+        {
+            if (section.name == name)
+                return &section;
+        }
+        return nullptr;
+    }
+
+    // The functions of the program sorted by address
+    const std::vector<Symbol>& Symbols() const
+    {
+        return _symbols;
+    }
+
+    // The function `addr` lies in, or nullptr
+    const Symbol* FindSymbol(Word addr) const
+    {
+        return Find(_symbols, addr);
+    }
+
+    // The data objects (arrays, variables) of the program sorted by address
+    const std::vector<Symbol>& Objects() const
+    {
+        return _objects;
+    }
+
+    const Symbol* FindObject(Word addr) const
+    {
+        return Find(_objects, addr);
+    }
+
+    // The instruction words of the executable sections, each 32-bit or
+    // RV32C parcel as the fetch stage would hand it to the decoder
+    std::vector<Word> Instructions() const
+    {
+        std::vector<Word> words;
+        for (const Section& section : _sections)
+        {
+            if (!(section.flags & SHF_EXECINSTR))
+                continue;
+            const std::vector<uint8_t>& d = section.data;
+            size_t offset = 0;
+            while (offset + 2 <= d.size())
+            {
+                Word low = d[offset] | d[offset + 1] << 8u;
+                if (Decoder::IsCompressed(low))
+                {
+                    words.push_back(low);
+                    offset += 2;
+                    continue;
+                }
+                if (offset + 4 > d.size())
+                    break;
+                words.push_back(low | Word(d[offset + 2]) << 16u | Word(d[offset + 3]) << 24u);
+                offset += 4;
+            }
+        }
+        return words;
+    }
+
+private:
+    // Functions, plus the untyped global labels in code that hand-written
+    // assembly such as _start has
+    void LoadSymbols(const Elf32_Shdr* shdrs, size_t count)
+    {
+        _symbols.clear();
+        _objects.clear();
+        for (size_t i = 0; i < count; i++)
+        {
+            if (shdrs[i].sh_type != SHT_SYMTAB || shdrs[i].sh_link >= count)
+                continue;
+            const std::vector<uint8_t>& table = _sections[i].data;
+            const std::vector<uint8_t>& names = _sections[shdrs[i].sh_link].data;
+            for (size_t offset = 0; offset + sizeof(Elf32_Sym) <= table.size(); offset += sizeof(Elf32_Sym))
+            {
+                Elf32_Sym sym;
+                std::memcpy(&sym, table.data() + offset, sizeof(sym));
+                bool function = ELF32_ST_TYPE(sym.st_info) == STT_FUNC;
+                bool label = ELF32_ST_TYPE(sym.st_info) == STT_NOTYPE && ELF32_ST_BIND(sym.st_info) == STB_GLOBAL &&
+                             sym.st_shndx < count && (_sections[sym.st_shndx].flags & SHF_EXECINSTR);
+                bool object = ELF32_ST_TYPE(sym.st_info) == STT_OBJECT && sym.st_size > 0;
+                if (!(function || label || object) || sym.st_name >= names.size())
+                    continue;
+                const char* name = reinterpret_cast<const char*>(names.data()) + sym.st_name;
+                Symbol symbol{std::string(name, strnlen(name, names.size() - sym.st_name)), sym.st_value,
+                              sym.st_size};
+                (object ? _objects : _symbols).push_back(std::move(symbol));
+            }
+        }
+        SortUnique(_symbols);
+        SortUnique(_objects);
+    }
+
+    static void SortUnique(std::vector<Symbol>& symbols)
+    {
+        std::sort(symbols.begin(), symbols.end(), [](const Symbol& a, const Symbol& b) { return a.addr < b.addr; });
+        symbols.erase(std::unique(symbols.begin(), symbols.end(),
+                                  [](const Symbol& a, const Symbol& b) { return a.addr == b.addr; }),
+                      symbols.end());
+    }
+
+    static const Symbol* Find(const std::vector<Symbol>& symbols, Word addr)
+    {
+        auto it = std::upper_bound(symbols.begin(), symbols.end(), addr,
+                                   [](Word a, const Symbol& symbol) { return a < symbol.addr; });
+        if (it == symbols.begin())
+            return nullptr;
+        --it;
+        if (it->size && addr - it->addr >= it->size)
+            return nullptr;
+        return &*it;
+    }
+
+    std::vector<Section> _sections;
+    std::vector<Symbol> _symbols;
+    std::vector<Symbol> _objects;
+};
+
+#endif //RISCV_SIM_ELF_H
@@ -1,76 +1,89 @@
 #ifndef RISCV_SIM_EXECUTOR_H
 #define RISCV_SIM_EXECUTOR_H
 
+#include "HostProfile.h"
 #include "Instruction.h"
 #include <functional>
+#include <map>
 
 class Executor
 {
 public:
 
-	void Execute(InstructionPtr& instr, Word ip)
+	void Execute(const Instruction& instr, InstrState& state, Word ip)
 	{
-		switch (instr->_type)
+		HOST_PROFILE_SCOPE(Execute);
+		switch (instr._type)
 		{
 		case IType::Alu: {
-			Word res = AluProc(instr);
-			instr->_data = res;
-			instr->_nextIp = ip + 4;
+			Word res = AluProc(instr, state);
+			state._data = res;
+			state._nextIp = ip + instr._size;
 			break;
 		}
 		case IType::Ld:
 		{
-			instr->_addr = AluProc(instr);
-			instr->_nextIp = ip + 4;
+			state._addr = AluProc(instr, state);
+			state._nextIp = ip + instr._size;
 			break;
 		}
 		case IType::St:
 		{
-			instr->_addr = AluProc(instr);
-			instr->_data = instr->_src2Val;
-			instr->_nextIp = ip + 4;
+			state._addr = AluProc(instr, state);
+			state._data = state._src2Val;
+			state._nextIp = ip + instr._size;
 			break;
 		}
 		case IType::Csrw:
 		{
-			instr->_data = instr->_src1Val;
-			instr->_nextIp = ip + 4;
+			state._data = state._src1Val;
+			state._nextIp = ip + instr._size;
 			break;
 		}
 		case IType::Csrr:
 		{
-			instr->_data = instr->_csrVal;
-			instr->_nextIp = ip + 4;
+			state._data = state._csrVal;
+			state._nextIp = ip + instr._size;
 			break;
 		}
 		case IType::J:
 		{
-			instr->_data = ip + 4;
+			state._data = ip + instr._size;
 		}
 		case IType::Br:
 		{
-			bool res = BranchProc(instr);
+			bool res = BranchProc(instr, state);
 			if (res)
-				instr->_nextIp = ip + *instr->_imm;
+				state._nextIp = ip + instr._imm;
 			else
-				instr->_nextIp = ip + 4;
+				state._nextIp = ip + instr._size;
 			break;
 		}
 		case IType::Jr:
 		{
-			instr->_data = ip + 4;
+			state._data = ip + instr._size;
 
-			bool res = BranchProc(instr);
+			bool res = BranchProc(instr, state);
 			if (res)
-				instr->_nextIp = *instr->_imm + instr->_src1Val;
+				state._nextIp = instr._imm + state._src1Val;
 			else
-				instr->_nextIp = ip + 4;
+				state._nextIp = ip + instr._size;
 			break;
 		}
 		case IType::Auipc:
 		{
-			instr->_data = ip + *instr->_imm;
-			instr->_nextIp = ip + 4;
+			state._data = ip + instr._imm;
+			state._nextIp = ip + instr._size;
+			break;
+		}
+		case IType::Lr:
+		case IType::Sc:
+		case IType::Amo:
+		{
+			// the read-modify-write itself is done by the memory model
+			state._addr = state._src1Val;
+			state._data = state._src2Val;
+			state._nextIp = ip + instr._size;
 			break;
 		}
 		}
@@ -89,6 +102,23 @@ public:
 		_aluFuncs[AluFunc::Sub] = [this](Word op1, Word op2) { return op1 - op2; };
 		_aluFuncs[AluFunc::Sra] = [this](Word op1, Word op2) { return (Word)((int)op1 >> (op2 % 32)); };
 		_aluFuncs[AluFunc::Srl] = [this](Word op1, Word op2) { return op1 >> (op2 % 32); };
+		_aluFuncs[AluFunc::Mul] = [this](Word op1, Word op2) { return op1 * op2; };
+		_aluFuncs[AluFunc::Mulh] = [this](Word op1, Word op2) { return (Word)(((int64_t)(int)op1 * (int)op2) >> 32); };
+		_aluFuncs[AluFunc::Mulhsu] = [this](Word op1, Word op2) { return (Word)(((int64_t)(int)op1 * (uint64_t)op2) >> 32); };
+		_aluFuncs[AluFunc::Mulhu] = [this](Word op1, Word op2) { return (Word)(((uint64_t)op1 * op2) >> 32); };
+		// division by zero and overflow give the results the spec mandates, no traps
+		_aluFuncs[AluFunc::Div] = [this](Word op1, Word op2) {
+			if (op2 == 0) return (Word)-1;
+			if (op1 == 0x80000000u && op2 == (Word)-1) return op1;
+			return (Word)((int)op1 / (int)op2);
+		};
+		_aluFuncs[AluFunc::Divu] = [this](Word op1, Word op2) { return op2 == 0 ? (Word)-1 : op1 / op2; };
+		_aluFuncs[AluFunc::Rem] = [this](Word op1, Word op2) {
+			if (op2 == 0) return op1;
+			if (op1 == 0x80000000u && op2 == (Word)-1) return (Word)0;
+			return (Word)((int)op1 % (int)op2);
+		};
+		_aluFuncs[AluFunc::Remu] = [this](Word op1, Word op2) { return op2 == 0 ? op1 : op1 % op2; };
 		// writing up branch functions
 		_brFuncs[BrFunc::Eq] = [this](Word op1, Word op2) { return (Word)(op1 == op2); };
 		_brFuncs[BrFunc::Neq] = [this](Word op1, Word op2) { return (Word)(op1 != op2); };
@@ -104,30 +134,16 @@ private:
 	std::map<AluFunc, std::function<Word(Word, Word)>> _aluFuncs;
 	std::map<BrFunc, std::function<Word(Word, Word)>> _brFuncs;
 
-	Word AluProc(InstructionPtr& instr)
+	Word AluProc(const Instruction& instr, const InstrState& state)
 	{
-		Word operand_1, operand_2;
-		if (instr->_src1.has_value() && (instr->_imm.has_value() || instr->_src2.has_value()))
-		{
-			operand_1 = instr->_src1Val;
-			operand_2 = instr->_imm.value_or(instr->_src2Val);
-			return _aluFuncs[instr->_aluFunc](operand_1, operand_2);
-		}
-		return Word();
+		Word operand_1 = state._src1Val;
+		Word operand_2 = instr._flags & HasImm ? instr._imm : state._src2Val;
+		return _aluFuncs[instr._aluFunc](operand_1, operand_2);
 	}
 
-	bool BranchProc(InstructionPtr& instr)
+	bool BranchProc(const Instruction& instr, const InstrState& state)
 	{
-		Word operand_1, operand_2;
-		if (instr->_src1) 
-		{
-			operand_1 = instr->_src1Val;
-		}
-		if (instr->_src2)
-		{
-			operand_2 = instr->_src2Val;
-		}
-		return _brFuncs[instr->_brFunc](operand_1, operand_2);
+		return _brFuncs[instr._brFunc](state._src1Val, state._src2Val);
 	}
 };
 
@@ -0,0 +1,331 @@
+#ifndef RISCV_SIM_HOSTPROFILE_H
+#define RISCV_SIM_HOSTPROFILE_H
+
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+#include <string>
+
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define RISCV_SIM_HAVE_RDTSC 1
+#endif
+
+// Parts of the simulator the host time is charged to
+enum class HostComponent : uint8_t
+{
+    // everything not in a scope below: the core's pipeline logic and the
+    // run loop
+    Loop,
+    Decode,
+    Execute,
+    RegisterFile,
+    // the request, response and clock of CachedMem
+    Memory,
+    Count,
+};
+
+constexpr const char* hostComponentNames[] = {"loop", "decode", "execute", "regfile", "memory"};
+
+// Self-profiling of the simulator on the host. Scopes opened with
+// HOST_PROFILE_SCOPE charge the time stamp counter to their component,
+// exclusive of nested scopes. With RISCV_SIM_HOST_EVENTS=1 in the
+// environment the host's cycles, instructions, cache misses and branch
+// misses are charged as well, read with perf_event_open and user-space
+// rdpmc; that is opt-in because rdpmc can trap to a hypervisor. The macro
+// expands to nothing unless RISCV_SIM_HOST_PROFILE is defined (cmake
+// -DHOST_PROFILE=ON), so a normal build pays nothing. Each thread profiles
+// itself.
+class HostProfiler
+{
+public:
+    enum Event : size_t
+    {
+        HostCycles,
+        HostInstructions,
+        CacheMisses,
+        BranchMisses,
+        EventCount,
+    };
+
+    struct Counters
+    {
+        uint64_t ticks = 0;
+        std::array<uint64_t, EventCount> events{};
+        uint64_t scopes = 0;
+    };
+
+    static HostProfiler& Instance()
+    {
+        static thread_local HostProfiler profiler;
+        return profiler;
+    }
+
+    HostProfiler() = default;
+    HostProfiler(const HostProfiler&) = delete;
+    HostProfiler& operator=(const HostProfiler&) = delete;
+
+    ~HostProfiler()
+    {
+        CloseEvents();
+    }
+
+    // Starts charging time, to Loop outside any scope
+    void Start()
+    {
+        if (!_eventsOpened)
+            OpenEvents();
+        _current = HostComponent::Loop;
+        _last = Now();
+        _active = true;
+    }
+
+    void Stop()
+    {
+        if (!_active)
+            return;
+        Charge();
+        _active = false;
+    }
+
+    bool HasEvents() const
+    {
+        return _hasEvents;
+    }
+
+    // Enters `component` and returns the one to go back to
+    HostComponent Enter(HostComponent component)
+    {
+        if (!_active)
+            return _current;
+        Charge();
+        HostComponent previous = _current;
+        _current = component;
+        _counters[size_t(component)].scopes++;
+        return previous;
+    }
+
+    void Leave(HostComponent previous)
+    {
+        if (!_active)
+            return;
+        Charge();
+        _current = previous;
+    }
+
+    const Counters& At(HostComponent component) const
+    {
+        return _counters[size_t(component)];
+    }
+
+    Counters Total() const
+    {
+        Counters total;
+        for (const Counters& c : _counters)
+        {
+            total.ticks += c.ticks;
+            for (size_t e = 0; e < EventCount; e++)
+                total.events[e] += c.events[e];
+            total.scopes += c.scopes;
+        }
+        return total;
+    }
+
+    // Host cost per simulated instruction by component
+    void Report(std::ostream& out, uint64_t instructions) const
+    {
+        char buf[256];
+        Counters total = Total();
+        double perInstr = instructions ? 1.0 / instructions : 0.0;
+        snprintf(buf, sizeof(buf), "Host profile: %" PRIu64 " simulated instructions, %" PRIu64 " %s, %.1f per "
+                 "instruction\n", instructions, total.ticks, tickUnit, total.ticks * perInstr);
+        out << buf;
+        if (!_hasEvents)
+            out << "(hardware counters off: set RISCV_SIM_HOST_EVENTS=1, needs perf_event_open and user-space rdpmc)\n";
+        snprintf(buf, sizeof(buf), "%-10s %7s %12s %12s", "component", "share", tickUnit, "scopes/inst");
+        out << buf;
+        if (_hasEvents)
+        {
+            snprintf(buf, sizeof(buf), " %10s %10s %10s %10s", "cyc/inst", "ins/inst", "cmiss/kin", "bmiss/kin");
+            out << buf;
+        }
+        out << '\n';
+        for (size_t i = 0; i < _counters.size(); i++)
+        {
+            const Counters& c = _counters[i];
+            snprintf(buf, sizeof(buf), "%-10s %6.2f%% %12.1f %12.2f", hostComponentNames[i],
+                     total.ticks ? 100.0 * c.ticks / total.ticks : 0.0, c.ticks * perInstr, c.scopes * perInstr);
+            out << buf;
+            if (_hasEvents)
+            {
+                snprintf(buf, sizeof(buf), " %10.1f %10.1f %10.3f %10.3f", c.events[HostCycles] * perInstr,
+                         c.events[HostInstructions] * perInstr, 1e3 * c.events[CacheMisses] * perInstr,
+                         1e3 * c.events[BranchMisses] * perInstr);
+                out << buf;
+            }
+            out << '\n';
+        }
+    }
+
+private:
+#ifdef RISCV_SIM_HAVE_RDTSC
+    static constexpr const char* tickUnit = "tsc ticks";
+#else
+    static constexpr const char* tickUnit = "ns";
+#endif
+
+    struct Sample
+    {
+        uint64_t ticks;
+        std::array<uint64_t, EventCount> events;
+    };
+
+    static uint64_t Ticks()
+    {
+#ifdef RISCV_SIM_HAVE_RDTSC
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // The value of the counter behind `page`, read in user space
+    static uint64_t ReadEvent(const volatile perf_event_mmap_page* page)
+    {
+#ifdef RISCV_SIM_HAVE_RDTSC
+        uint32_t sequence;
+        uint64_t count;
+        do
+        {
+            sequence = page->lock;
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            uint32_t index = page->index;
+            count = page->offset;
+            if (index)
+            {
+                uint64_t width = page->pmc_width;
+                int64_t pmc = int64_t(__rdpmc(int(index - 1)) << (64 - width)) >> (64 - width);
+                count += pmc;
+            }
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        } while (page->lock != sequence);
+        return count;
+#else
+        (void)page;
+        return 0;
+#endif
+    }
+
+    Sample Now() const
+    {
+        Sample sample;
+        sample.ticks = Ticks();
+        for (size_t e = 0; e < EventCount; e++)
+            sample.events[e] = _hasEvents ? ReadEvent(_pages[e]) : 0;
+        return sample;
+    }
+
+    void Charge()
+    {
+        Sample now = Now();
+        Counters& c = _counters[size_t(_current)];
+        c.ticks += now.ticks - _last.ticks;
+        for (size_t e = 0; e < EventCount; e++)
+            c.events[e] += now.events[e] - _last.events[e];
+        _last = now;
+    }
+
+    void OpenEvents()
+    {
+        _eventsOpened = true;
+#ifdef RISCV_SIM_HAVE_RDTSC
+        const char* enable = getenv("RISCV_SIM_HOST_EVENTS");
+        if (!enable || std::string(enable) != "1")
+            return;
+        static constexpr uint64_t configs[EventCount] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                         PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for (size_t e = 0; e < EventCount; e++)
+        {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[e];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            _fds[e] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if (_fds[e] < 0)
+                break;
+            void* page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, _fds[e], 0);
+            if (page == MAP_FAILED)
+                break;
+            _pages[e] = static_cast<perf_event_mmap_page*>(page);
+            if (!_pages[e]->cap_user_rdpmc)
+                break;
+            _hasEvents = e + 1 == EventCount;
+        }
+        if (!_hasEvents)
+            CloseEvents();
+#endif
+    }
+
+    void CloseEvents()
+    {
+        for (size_t e = 0; e < EventCount; e++)
+        {
+            if (_pages[e])
+                munmap(_pages[e], sysconf(_SC_PAGESIZE));
+            if (_fds[e] >= 0)
+                close(_fds[e]);
+            _pages[e] = nullptr;
+            _fds[e] = -1;
+        }
+        _hasEvents = false;
+    }
+
+    bool _active = false;
+    bool _eventsOpened = false;
+    bool _hasEvents = false;
+    HostComponent _current = HostComponent::Loop;
+    Sample _last{};
+    std::array<Counters, size_t(HostComponent::Count)> _counters{};
+    std::array<int, EventCount> _fds{-1, -1, -1, -1};
+    std::array<perf_event_mmap_page*, EventCount> _pages{};
+};
+
+// Charges the enclosing block to a component
+class HostScope
+{
+public:
+    explicit HostScope(HostComponent component)
+        : _previous(HostProfiler::Instance().Enter(component))
+    {
+    }
+
+    HostScope(const HostScope&) = delete;
+    HostScope& operator=(const HostScope&) = delete;
+
+    ~HostScope()
+    {
+        HostProfiler::Instance().Leave(_previous);
+    }
+
+private:
+    HostComponent _previous;
+};
+
+#ifdef RISCV_SIM_HOST_PROFILE
+#define HOST_PROFILE_SCOPE(component) HostScope hostProfileScope(HostComponent::component)
+#else
+#define HOST_PROFILE_SCOPE(component) ((void)0)
+#endif
+
+#endif //RISCV_SIM_HOSTPROFILE_H
@@ -0,0 +1,230 @@
+#ifndef RISCV_SIM_INSTRMIX_H
+#define RISCV_SIM_INSTRMIX_H
+
+#include "Instruction.h"
+
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <ostream>
+
+// Dynamic instruction mix. Retired instructions are counted in flat arrays
+// indexed by their decoded Handler, together with the taken conditional
+// branches; the totals per IType and AluFunc are derived from them for the
+// report, and the conditional branch handlers are one per BrFunc. It also
+// sums the bytes loaded and stored and keeps a histogram of
+// register-dependency distances: for every source register, how many
+// instructions earlier its value was produced.
+class InstrMix
+{
+public:
+    // distances 1, 2, 3-4, 5-8, ... 33-64 and above 64
+    static constexpr size_t distanceBuckets = 8;
+
+    // Called by the core when the instruction at `ip` retires
+    void Retire(Word ip, const Instruction& instr, const InstrState& state)
+    {
+        size_t handler = size_t(instr._handler);
+        if (!_counts[handler]++)
+            _classes[handler] = {instr._type, instr._aluFunc};
+        _retired++;
+
+        switch (instr._type)
+        {
+            case IType::Br:
+                if (state._nextIp != ip + instr._size)
+                    _taken[handler]++;
+                break;
+            case IType::Ld:
+            case IType::Lr:
+                _loadBytes += sizeof(Word);
+                break;
+            case IType::St:
+            case IType::Sc:
+                _storeBytes += sizeof(Word);
+                break;
+            case IType::Amo:
+                _loadBytes += sizeof(Word);
+                _storeBytes += sizeof(Word);
+                break;
+            default:
+                break;
+        }
+
+        Depend(instr._src1);
+        if (instr._src2 != instr._src1)
+            Depend(instr._src2);
+        if (instr._dst)
+            _lastWrite[instr._dst] = _retired;
+    }
+
+    uint64_t Instructions() const
+    {
+        return _retired;
+    }
+
+    uint64_t Count(Handler handler) const
+    {
+        return _counts[size_t(handler)];
+    }
+
+    uint64_t Taken(Handler handler) const
+    {
+        return _taken[size_t(handler)];
+    }
+
+    uint64_t CountType(IType type) const
+    {
+        uint64_t count = 0;
+        for (size_t i = 0; i < _counts.size(); i++)
+        {
+            if (_counts[i] && _classes[i].type == type)
+                count += _counts[i];
+        }
+        return count;
+    }
+
+    uint64_t LoadBytes() const
+    {
+        return _loadBytes;
+    }
+
+    uint64_t StoreBytes() const
+    {
+        return _storeBytes;
+    }
+
+    const std::array<uint64_t, distanceBuckets>& Distances() const
+    {
+        return _distances;
+    }
+
+    void Report(std::ostream& out) const
+    {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "Instruction mix: %" PRIu64 " instructions\n", _retired);
+        out << buf;
+
+        out << "By class:\n";
+        for (size_t type = 0; type < std::size(typeNames); type++)
+        {
+            if (uint64_t count = CountType(IType(type)))
+                Line(out, typeNames[type], count);
+        }
+
+        out << "By ALU function:\n";
+        for (size_t func = 0; func < aluNames.size(); func++)
+        {
+            uint64_t count = 0;
+            for (size_t i = 0; i < _counts.size(); i++)
+            {
+                if (_counts[i] && _classes[i].type == IType::Alu && size_t(_classes[i].aluFunc) == func)
+                    count += _counts[i];
+            }
+            if (count)
+                Line(out, aluNames[func], count);
+        }
+
+        uint64_t branches = 0;
+        uint64_t taken = 0;
+        out << "Conditional branches:\n";
+        snprintf(buf, sizeof(buf), "  %-10s %12s %12s %7s\n", "", "count", "taken", "taken%");
+        out << buf;
+        for (size_t i = 0; i < _counts.size(); i++)
+        {
+            if (!_counts[i] || _classes[i].type != IType::Br)
+                continue;
+            branches += _counts[i];
+            taken += _taken[i];
+            snprintf(buf, sizeof(buf), "  %-10s %12" PRIu64 " %12" PRIu64 " %6.2f%%\n", handlerNames[i],
+                     _counts[i], _taken[i], 100.0 * _taken[i] / _counts[i]);
+            out << buf;
+        }
+        snprintf(buf, sizeof(buf), "  %-10s %12" PRIu64 " %12" PRIu64 " %6.2f%%\n", "total", branches, taken,
+                 branches ? 100.0 * taken / branches : 0.0);
+        out << buf;
+
+        snprintf(buf, sizeof(buf), "Memory: %" PRIu64 " bytes loaded, %" PRIu64 " bytes stored\n", _loadBytes,
+                 _storeBytes);
+        out << buf;
+
+        out << "Register dependency distance:\n";
+        uint64_t dependencies = 0;
+        for (uint64_t count : _distances)
+            dependencies += count;
+        for (size_t i = 0; i < _distances.size(); i++)
+        {
+            char range[24];
+            if (i + 1 == _distances.size())
+                snprintf(range, sizeof(range), ">%u", 1u << (i - 1));
+            else if (i < 2)
+                snprintf(range, sizeof(range), "%u", 1u << i);
+            else
+                snprintf(range, sizeof(range), "%u-%u", (1u << (i - 1)) + 1, 1u << i);
+            snprintf(buf, sizeof(buf), "  %-10s %12" PRIu64 " %6.2f%%\n", range, _distances[i],
+                     dependencies ? 100.0 * _distances[i] / dependencies : 0.0);
+            out << buf;
+        }
+
+        out << "By instruction:\n";
+        std::array<size_t, size_t(Handler::Count)> order;
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return _counts[a] > _counts[b]; });
+        for (size_t i : order)
+        {
+            if (_counts[i])
+                Line(out, handlerNames[i], _counts[i]);
+        }
+    }
+
+private:
+    struct Class
+    {
+        IType type;
+        AluFunc aluFunc;
+    };
+
+    // indexed by IType
+    static constexpr const char* typeNames[] = {
+        "unsupported", "alu", "load", "store", "jump", "jump-reg", "branch",
+        "csr-read", "csr-write", "auipc", "lr", "sc", "amo",
+    };
+    // indexed by AluFunc
+    static constexpr std::array<const char*, size_t(AluFunc::None)> aluNames = {
+        "add", "sll", "slt", "sltu", "xor", "sr", "or", "and", "sub", "sra", "srl",
+        "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu",
+    };
+
+    void Depend(uint8_t reg)
+    {
+        if (!reg || !_lastWrite[reg])
+            return;
+        size_t bucket = 0;
+        for (uint64_t d = _retired - _lastWrite[reg] - 1; d && bucket + 1 < distanceBuckets; d >>= 1u)
+            bucket++;
+        _distances[bucket]++;
+    }
+
+    void Line(std::ostream& out, const char* name, uint64_t count) const
+    {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "  %-10s %12" PRIu64 " %6.2f%%\n", name, count,
+                 _retired ? 100.0 * count / _retired : 0.0);
+        out << buf;
+    }
+
+    std::array<uint64_t, size_t(Handler::Count)> _counts{};
+    std::array<uint64_t, size_t(Handler::Count)> _taken{};
+    // the IType and AluFunc of each handler, set on its first retirement
+    std::array<Class, size_t(Handler::Count)> _classes{};
+    uint64_t _retired = 0;
+    uint64_t _loadBytes = 0;
+    uint64_t _storeBytes = 0;
+    // the retirement number of the last write of every register, 0 if none
+    std::array<uint64_t, 32> _lastWrite{};
+    std::array<uint64_t, distanceBuckets> _distances{};
+};
+
+#endif //RISCV_SIM_INSTRMIX_H
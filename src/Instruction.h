@@ -2,11 +2,11 @@
 #ifndef RISCV_SIM_INSTRUCTION_H
 #define RISCV_SIM_INSTRUCTION_H
 
-#include <optional>
-#include <memory>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
 
 #include "BaseTypes.h"
-#include "PoolAllocator.h"
 
 
 enum class Opcode : uint8_t
@@ -27,14 +27,53 @@ enum class Opcode : uint8_t
 
 enum class CsrIdx : RId
 {
-    Instret = 0xc02,
-    Cycle   = 0xc00,
+    Instret   = 0xc02,
+    Cycle     = 0xc00,
+    InstretH  = 0xc82,
+    CycleH    = 0xc80,
+    Mcycle    = 0xb00,
+    Minstret  = 0xb02,
+    McycleH   = 0xb80,
+    MinstretH = 0xb82,
+    // the banks of 29 counters from counter 3 on, and their event selectors
+    Hpmcounter3   = 0xc03,
+    Hpmcounter3H  = 0xc83,
+    Mhpmcounter3  = 0xb03,
+    Mhpmcounter3H = 0xb83,
+    Mhpmevent3    = 0x323,
     Mhartid = 0xf10,
     Mtohost = 0x780,
+    // region-of-interest marker, a custom read/write CSR; see RoiCommand
+    Roi     = 0x8c0,
     None    = 0xfff,
 };
 
-// LR, SC, FENCE not implemented
+// Values written to the Roi CSR
+enum class RoiCommand : Word
+{
+    End   = 0,
+    Begin = 1,
+    // zero the cycle, instret and hpm counters and the cache statistics
+    ResetStats = 2,
+};
+
+// Events the mhpmcounters can count, as written to mhpmevent
+enum class HpmEvent : uint8_t
+{
+    None,
+    ICacheMisses,
+    DCacheMisses,
+    // cycles the core waited for a fetch, an operand or a data access
+    StallCycles,
+    // conditional branches
+    Branches,
+    // conditional branches a static backward-taken/forward-not-taken
+    // predictor gets wrong
+    Mispredicts,
+    Count,
+};
+
+// FENCE is executed as a nop
 // LB(U), LH(U), SB, SH not implemented
 
 // For CSR, only following two are implemented
@@ -43,7 +82,7 @@ enum class CsrIdx : RId
 
 // SCALL, SBREAK not implemented
 
-enum class IType
+enum class IType : uint8_t
 {
     Unsupported,
     Alu,
@@ -54,7 +93,10 @@ enum class IType
     Br,
     Csrr,
     Csrw,
-    Auipc
+    Auipc,
+    Lr,
+    Sc,
+    Amo,
 };
 
 enum class BrFunc : uint8_t
@@ -69,7 +111,7 @@ enum class BrFunc : uint8_t
     NT,
 };
 
-enum class AluFunc
+enum class AluFunc : uint8_t
 {
     Add  = 0b000,
     Sll  = 0b001,
@@ -82,30 +124,106 @@ enum class AluFunc
     Sub  = 0b1000,
     Sra,
     Srl,
+    // M extension
+    Mul,
+    Mulh,
+    Mulhsu,
+    Mulhu,
+    Div,
+    Divu,
+    Rem,
+    Remu,
     None,
 };
 
-struct Instruction : public PoolAllocated<Instruction>
+// funct5 of the A extension
+enum class AmoFunc : uint8_t
+{
+    Add  = 0b00000,
+    Swap = 0b00001,
+    Lr   = 0b00010,
+    Sc   = 0b00011,
+    Xor  = 0b00100,
+    Or   = 0b01000,
+    And  = 0b01100,
+    Min  = 0b10000,
+    Max  = 0b10100,
+    Minu = 0b11000,
+    Maxu = 0b11100,
+    None = 0b11111,
+};
+
+// One value per instruction the decoder recognizes, so per-instruction
+// tables can be indexed directly
+enum class Handler : uint8_t
+{
+    Unsupported,
+    Lui, Auipc, Jal, Jalr,
+    Beq, Bne, Blt, Bge, Bltu, Bgeu,
+    Lw, Sw,
+    Addi, Slti, Sltiu, Xori, Ori, Andi, Slli, Srli, Srai,
+    Add, Sub, Sll, Slt, Sltu, Xor, Srl, Sra, Or, And,
+    Mul, Mulh, Mulhsu, Mulhu, Div, Divu, Rem, Remu,
+    Fence, Csrrw, Csrrs,
+    LrW, ScW, AmoswapW, AmoaddW, AmoxorW, AmoandW, AmoorW, AmominW, AmomaxW, AmominuW, AmomaxuW,
+    Count,
+};
+
+constexpr const char* handlerNames[] = {
+    "unsupported",
+    "lui", "auipc", "jal", "jalr",
+    "beq", "bne", "blt", "bge", "bltu", "bgeu",
+    "lw", "sw",
+    "addi", "slti", "sltiu", "xori", "ori", "andi", "slli", "srli", "srai",
+    "add", "sub", "sll", "slt", "sltu", "xor", "srl", "sra", "or", "and",
+    "mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu",
+    "fence", "csrrw", "csrrs",
+    "lr.w", "sc.w", "amoswap.w", "amoadd.w", "amoxor.w", "amoand.w", "amoor.w", "amomin.w", "amomax.w",
+    "amominu.w", "amomaxu.w",
+};
+
+static_assert(std::size(handlerNames) == size_t(Handler::Count), "every handler needs a name");
+
+enum InstrFlags : uint8_t
+{
+    HasImm = 1u << 0,
+    HasCsr = 1u << 1,
+};
+
+// A decoded instruction. It is a 16-byte trivially copyable record that is
+// passed by value; register 0 stands for an absent operand, since it reads
+// as zero and the register file drops writes to it.
+struct Instruction
 {
     IType _type = IType::Unsupported;
     BrFunc _brFunc = BrFunc::NT;
-    AluFunc _aluFunc;
-    std::optional<RId> _dst;
-    std::optional<RId> _src1;
-    std::optional<RId> _src2;
-    std::optional<CsrIdx> _csr;
-    std::optional<Word> _imm;
-
-    Word _src1Val;
-    Word _src2Val;
-    Word _csrVal;
+    AluFunc _aluFunc = AluFunc::None;
+    AmoFunc _amoFunc = AmoFunc::None;
+    uint8_t _dst = 0;
+    uint8_t _src1 = 0;
+    uint8_t _src2 = 0;
+    uint8_t _flags = 0;
+    CsrIdx _csr = CsrIdx::None;
+    // 2 for an expanded RV32C instruction
+    uint8_t _size = 4;
+    Handler _handler = Handler::Unsupported;
+    Word _imm = 0;
+};
+
+static_assert(sizeof(Instruction) <= 16, "Instruction must stay compact");
+static_assert(std::is_trivially_copyable_v<Instruction>, "Instruction must be copyable as bytes");
+
+// Values produced while an instruction flows through the pipeline
+struct InstrState
+{
+    Word _src1Val = 0;
+    Word _src2Val = 0;
+    Word _csrVal = 0;
     Word _data = 0xdeadbeaf;
     Word _addr = 0xdeadbeaf;
     Word _nextIp = 0xdeadbeaf;
 };
 
-using InstructionPtr = std::unique_ptr<Instruction>;
-
 // Load
 constexpr uint8_t fnLW    = 0b010;
 //constexpr uint8_t fnLB    = 0b000;
@@ -117,8 +235,7 @@ constexpr uint8_t fnSW    = 0b010;
 //constexpr uint8_t fnSB    = 0b000;
 //constexpr uint8_t fnSH    = 0b001;
 // Amo
-constexpr uint8_t fnLR    = 0b00010;
-constexpr uint8_t fnSC    = 0b00011;
+constexpr uint8_t fnAMOW  = 0b010;
 //MiscMem
 constexpr uint8_t fnFENCE  = 0b000;
 //constexpr uint8_t fnFENCEI = 0b001;
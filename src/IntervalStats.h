@@ -0,0 +1,184 @@
+#ifndef RISCV_SIM_INTERVALSTATS_H
+#define RISCV_SIM_INTERVALSTATS_H
+
+#include "Memory.h"
+
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <ostream>
+#include <vector>
+
+// Statistics per interval of N cycles, for telling program phases apart.
+// The core hands in its running totals at the end of every interval and
+// the differences are appended to one preallocated column per counter.
+// When the columns are full, neighbouring intervals are merged in place and
+// the interval doubles, so recording never allocates and a run of any
+// length fits. IPC, miss rates and the memory bandwidth, counted as line
+// fills, are derived when the columns are written out.
+class IntervalStats
+{
+public:
+    enum Column : size_t
+    {
+        // the cycle the interval ended in
+        EndCycle,
+        Cycles,
+        Instructions,
+        ICacheAccesses,
+        ICacheMisses,
+        DCacheAccesses,
+        DCacheMisses,
+        StallCycles,
+        ColumnCount,
+    };
+
+    // Running totals of a core
+    struct Totals
+    {
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        uint64_t icacheAccesses = 0;
+        uint64_t icacheMisses = 0;
+        uint64_t dcacheAccesses = 0;
+        uint64_t dcacheMisses = 0;
+        uint64_t stallCycles = 0;
+    };
+
+    // `capacity` is rounded up to an even number of intervals; a miss moves
+    // `lineBytes`, the line size of the caches
+    explicit IntervalStats(uint64_t interval, size_t capacity = 1u << 16u,
+                           size_t lineBytes = CacheConfig().lineBytes)
+        : _interval(std::max<uint64_t>(interval, 1)), _lineBytes(lineBytes)
+    {
+        capacity = std::max<size_t>(capacity + capacity % 2, 2);
+        for (std::vector<uint64_t>& column : _columns)
+            column.resize(capacity);
+    }
+
+    // Appends the interval ending at `now` and returns the cycle the next
+    // one ends in
+    uint64_t Record(const Totals& now)
+    {
+        if (now.cycles == _last.cycles)
+            return NextEnd(now.cycles);
+        Set(EndCycle, now.cycles);
+        Set(Cycles, now.cycles - _last.cycles);
+        Set(Instructions, Delta(now.instructions, _last.instructions));
+        Set(ICacheAccesses, Delta(now.icacheAccesses, _last.icacheAccesses));
+        Set(ICacheMisses, Delta(now.icacheMisses, _last.icacheMisses));
+        Set(DCacheAccesses, Delta(now.dcacheAccesses, _last.dcacheAccesses));
+        Set(DCacheMisses, Delta(now.dcacheMisses, _last.dcacheMisses));
+        Set(StallCycles, Delta(now.stallCycles, _last.stallCycles));
+        _last = now;
+        if (++_size == _columns[0].size())
+            Merge();
+        return NextEnd(now.cycles);
+    }
+
+    uint64_t Interval() const
+    {
+        return _interval;
+    }
+
+    size_t Size() const
+    {
+        return _size;
+    }
+
+    uint64_t At(Column column, size_t row) const
+    {
+        return _columns[column][row];
+    }
+
+    // One row per interval, with a header line
+    void WriteCsv(std::ostream& out) const
+    {
+        out << "end_cycle,cycles,instructions,ipc,icache_accesses,icache_misses,icache_miss_rate,"
+               "dcache_accesses,dcache_misses,dcache_miss_rate,stall_cycles,mem_bytes,mem_bytes_per_cycle\n";
+        char buf[512];
+        for (size_t i = 0; i < _size; i++)
+        {
+            uint64_t cycles = At(Cycles, i);
+            uint64_t memBytes = (At(ICacheMisses, i) + At(DCacheMisses, i)) * _lineBytes;
+            snprintf(buf, sizeof(buf), "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.4f,%" PRIu64 ",%" PRIu64 ",%.4f,%" PRIu64
+                     ",%" PRIu64 ",%.4f,%" PRIu64 ",%" PRIu64 ",%.4f\n", At(EndCycle, i), cycles,
+                     At(Instructions, i), Ratio(At(Instructions, i), cycles), At(ICacheAccesses, i),
+                     At(ICacheMisses, i), Ratio(At(ICacheMisses, i), At(ICacheAccesses, i)), At(DCacheAccesses, i),
+                     At(DCacheMisses, i), Ratio(At(DCacheMisses, i), At(DCacheAccesses, i)), At(StallCycles, i),
+                     memBytes, Ratio(memBytes, cycles));
+            out << buf;
+        }
+    }
+
+    // The header, then every column as little-endian uint64 values:
+    //   char magic[4] = "RVIS"; uint32 version = 1; uint32 columns;
+    //   uint32 line size; uint64 rows; uint64 interval
+    // with the columns in the order of Column
+    void WriteBinary(std::ostream& out) const
+    {
+        out.write("RVIS", 4);
+        Put(out, uint32_t(1));
+        Put(out, uint32_t(ColumnCount));
+        Put(out, uint32_t(_lineBytes));
+        Put(out, uint64_t(_size));
+        Put(out, _interval);
+        for (const std::vector<uint64_t>& column : _columns)
+        {
+            for (size_t i = 0; i < _size; i++)
+                Put(out, column[i]);
+        }
+    }
+
+private:
+    void Set(Column column, uint64_t value)
+    {
+        _columns[column][_size] = value;
+    }
+
+    uint64_t NextEnd(uint64_t cycle) const
+    {
+        return cycle - cycle % _interval + _interval;
+    }
+
+    // counters such as the cache statistics may be reset in between
+    static uint64_t Delta(uint64_t now, uint64_t last)
+    {
+        return now >= last ? now - last : now;
+    }
+
+    static double Ratio(uint64_t a, uint64_t b)
+    {
+        return b ? double(a) / b : 0.0;
+    }
+
+    template <typename T>
+    static void Put(std::ostream& out, T value)
+    {
+        char bytes[sizeof(T)];
+        for (size_t i = 0; i < sizeof(T); i++)
+            bytes[i] = char(value >> (8 * i));
+        out.write(bytes, sizeof(T));
+    }
+
+    // Halves the rows by merging every pair of neighbours
+    void Merge()
+    {
+        for (size_t c = 0; c < ColumnCount; c++)
+        {
+            std::vector<uint64_t>& column = _columns[c];
+            for (size_t i = 0; i < _size / 2; i++)
+                column[i] = c == EndCycle ? column[2 * i + 1] : column[2 * i] + column[2 * i + 1];
+        }
+        _size /= 2;
+        _interval *= 2;
+    }
+
+    uint64_t _interval;
+    size_t _lineBytes;
+    std::array<std::vector<uint64_t>, ColumnCount> _columns;
+    size_t _size = 0;
+    Totals _last;
+};
+
+#endif //RISCV_SIM_INTERVALSTATS_H
@@ -0,0 +1,168 @@
+#ifndef RISCV_SIM_LIVESTATS_H
+#define RISCV_SIM_LIVESTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Counters a running simulation publishes for tools/riscv_top. Every
+// simulation maps a file of its own, <dir>/riscv_sim.<pid>, where <dir> is
+// $RISCV_SIM_LIVE_DIR or /dev/shm, and removes it at exit. The simulator is
+// the only writer. The values are guarded by a sequence number that is odd
+// while they are being updated, so a reader copies them without locking
+// and retries if the number changed underneath it.
+class LiveStats
+{
+public:
+    enum Field : size_t
+    {
+        Pid,
+        // wall-clock nanoseconds since the epoch
+        StartNs,
+        UpdateNs,
+        Cycles,
+        Instructions,
+        // over the run so far
+        InstructionsPerSecond,
+        ICacheAccesses,
+        ICacheMisses,
+        DCacheAccesses,
+        DCacheMisses,
+        Ip,
+        // 1 once the guest has exited
+        Finished,
+        FieldCount,
+    };
+
+    // The layout of the file
+    struct Segment
+    {
+        // written last, so a file with the magic is initialized
+        char magic[8];
+        std::atomic<uint32_t> sequence;
+        uint32_t reserved;
+        std::atomic<uint64_t> values[FieldCount];
+        char program[256];
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "the segment is shared between processes");
+
+    static constexpr char magic[8] = "RVLIVE1";
+    static constexpr const char* filePrefix = "riscv_sim.";
+
+    static std::string Directory()
+    {
+        const char* dir = getenv("RISCV_SIM_LIVE_DIR");
+        return dir && *dir ? dir : "/dev/shm";
+    }
+
+    // A consistent copy of the values in `segment`, or false if the writer
+    // kept changing them
+    static bool Read(const Segment& segment, uint64_t (&values)[FieldCount])
+    {
+        for (int attempt = 0; attempt < 1000; attempt++)
+        {
+            uint32_t before = segment.sequence.load(std::memory_order_acquire);
+            if (before & 1u)
+                continue;
+            for (size_t i = 0; i < FieldCount; i++)
+                values[i] = segment.values[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (segment.sequence.load(std::memory_order_relaxed) == before)
+                return true;
+        }
+        return false;
+    }
+
+    static uint64_t NowNs()
+    {
+        timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        return uint64_t(now.tv_sec) * 1000000000u + now.tv_nsec;
+    }
+
+    LiveStats() = default;
+    LiveStats(const LiveStats&) = delete;
+    LiveStats& operator=(const LiveStats&) = delete;
+
+    ~LiveStats()
+    {
+        if (!_segment)
+            return;
+        munmap(_segment, sizeof(Segment));
+        unlink(_path.c_str());
+    }
+
+    // Creates the file for this process in `dir`
+    bool Open(const std::string& program, const std::string& dir = Directory())
+    {
+        _path = dir + "/" + filePrefix + std::to_string(getpid());
+        int fd = open(_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+        void* mapping = MAP_FAILED;
+        if (ftruncate(fd, sizeof(Segment)) == 0)
+            mapping = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+        {
+            unlink(_path.c_str());
+            return false;
+        }
+        // the file is zero-filled, so the sequence number starts even
+        _segment = static_cast<Segment*>(mapping);
+        strncpy(_segment->program, program.c_str(), sizeof(_segment->program) - 1);
+        _values[Pid] = getpid();
+        _values[StartNs] = NowNs();
+        Publish();
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(_segment->magic, magic, sizeof(magic));
+        return true;
+    }
+
+    bool IsOpen() const
+    {
+        return _segment != nullptr;
+    }
+
+    const std::string& Path() const
+    {
+        return _path;
+    }
+
+    void Set(Field field, uint64_t value)
+    {
+        _values[field] = value;
+    }
+
+    // Makes the values given to Set() visible to readers
+    void Publish()
+    {
+        if (!_segment)
+            return;
+        _values[UpdateNs] = NowNs();
+        uint64_t elapsed = _values[UpdateNs] - _values[StartNs];
+        _values[InstructionsPerSecond] = elapsed ? uint64_t(_values[Instructions] * 1e9 / elapsed) : 0;
+
+        uint32_t sequence = _segment->sequence.load(std::memory_order_relaxed);
+        _segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < FieldCount; i++)
+            _segment->values[i].store(_values[i], std::memory_order_relaxed);
+        _segment->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+private:
+    std::string _path;
+    Segment* _segment = nullptr;
+    uint64_t _values[FieldCount] = {};
+};
+
+#endif //RISCV_SIM_LIVESTATS_H
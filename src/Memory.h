@@ -3,14 +3,23 @@
 #define RISCV_SIM_DATAMEMORY_H
 
 #include "Instruction.h"
+#include "Decoder.h"
+#include "HostProfile.h"
+#include "Arena.h"
 #include <iostream>
 #include <fstream>
 #include <elf.h>
 #include <cstring>
+#include <array>
+#include <atomic>
+#include <optional>
 #include <vector>
 #include <cassert>
 #include <map>
 #include <list>
+#include <scoped_allocator>
+#include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
 
 
@@ -84,16 +93,41 @@ public:
 		}
 	}
 
+	// An access beyond memSize is a guest fault: a read returns 0, a write
+	// is dropped, and the first such address is kept for FaultAddress()
 	Word Read(Word ip)
 	{
+		if (ToWordAddr(ip) >= memSize)
+		{
+			Fault(ip);
+			return 0;
+		}
 		return _mem[ToWordAddr(ip)];
 	}
 
 	void Write(Word ip, Word data)
 	{
+		if (ToWordAddr(ip) >= memSize)
+		{
+			Fault(ip);
+			return;
+		}
 		_mem[ToWordAddr(ip)] = data;
 	}
 
+	bool Faulted() const
+	{
+		return _fault.load(std::memory_order_relaxed) != noFault;
+	}
+
+	std::optional<Word> FaultAddress() const
+	{
+		uint64_t fault = _fault.load(std::memory_order_relaxed);
+		if (fault == noFault)
+			return std::nullopt;
+		return Word(fault);
+	}
+
 private:
 	template <typename Elf_Ehdr, typename Elf_Phdr>
 	bool LoadElfSpecific(char* buf, size_t buf_sz) {
@@ -112,6 +146,12 @@ private:
 					std::cerr << "ERROR: load_elf: file size is larger than memory size" << std::endl;
 					return false;
 				}
+				if (phdr[i].p_paddr > memSize * sizeof(Word)
+					|| phdr[i].p_memsz > memSize * sizeof(Word) - phdr[i].p_paddr) {
+					std::cerr << "ERROR: load_elf: segment at 0x" << std::hex << phdr[i].p_paddr << std::dec
+						<< " does not fit in memory" << std::endl;
+					return false;
+				}
 				if (phdr[i].p_filesz > 0) {
 					if (phdr[i].p_offset + phdr[i].p_filesz > buf_sz) {
 						std::cerr << "ERROR: load_elf: file section overflow" << std::endl;
@@ -133,10 +173,197 @@ private:
 		return true;
 	}
 
+	void Fault(Word addr)
+	{
+		uint64_t expected = noFault;
+		_fault.compare_exchange_strong(expected, addr, std::memory_order_relaxed);
+	}
+
+	// harts share the storage, so the first fault is kept atomically
+	static constexpr uint64_t noFault = ~uint64_t(0);
+
 	std::vector<Word> _mem;
+	std::atomic<uint64_t> _fault{noFault};
+};
+
+
+// Stores issued by one hart during the current quantum. They are kept private
+// to the hart (its own loads see them) and are drained into the shared storage
+// only at the quantum barrier, in hart order, so a multi-hart run does not
+// depend on how the host schedules its threads.
+class StoreBuffer
+{
+public:
+	Word Read(MemoryStorage& mem, Word addr) const
+	{
+		auto it = _stores.find(ToWordAddr(addr));
+		return it != _stores.end() ? it->second : mem.Read(addr);
+	}
+
+	void Write(Word addr, Word data)
+	{
+		_stores[ToWordAddr(addr)] = data;
+	}
+
+	void Drain(MemoryStorage& mem)
+	{
+		for (auto& [wordAddr, data] : _stores)
+			mem.Write(wordAddr << 2u, data);
+		_stores.clear();
+	}
+
+private:
+	std::unordered_map<Word, Word> _stores;
+};
+
+
+enum class Mesi : uint8_t
+{
+	Invalid,
+	Shared,
+	Exclusive,
+	Modified,
+};
+
+class CachedMem;
+
+// MESI directory for the private data caches of a MultiHart system.
+// While a quantum runs the directory is only read (to pick E or S on a fill);
+// every hart appends its fills, writes and evictions to a private log. At the
+// quantum barrier Commit() replays the logs in hart order, invalidating and
+// downgrading the peer copies, and updates the per-line counters. A hart
+// that filled a line another hart wrote in the same quantum may hold the
+// old data, since the fill can have come first; its copy is invalidated.
+class CoherenceDirectory
+{
+public:
+	struct LineStats
+	{
+		uint64_t coherenceMisses = 0;
+		uint64_t invalidations = 0;
+		uint64_t upgrades = 0;
+		// harts that wrote each word of the line, to spot false sharing
+		std::array<uint64_t, lineSizeWords> wordWriters{};
+	};
+
+	// the sharers of a line are kept as a mask with one bit per hart
+	static constexpr unsigned maxHarts = 64;
+
+	CoherenceDirectory(unsigned harts, size_t invalidationLatency)
+		: _invalidationLatency(invalidationLatency), _logs(harts)
+	{
+		assert(harts >= 1 && harts <= maxHarts);
+	}
+
+	size_t InvalidationLatency() const { return _invalidationLatency; }
+
+	bool SharedElsewhere(Word hart, Word tag) const
+	{
+		auto it = _sharers.find(tag);
+		return it != _sharers.end() && (it->second & ~(1ull << hart)) != 0;
+	}
+
+	void Fill(Word hart, Word tag, bool coherenceMiss)
+	{
+		_logs[hart].push_back({Event::Fill, tag, coherenceMiss});
+	}
+
+	void Write(Word hart, Word addr, bool upgrade)
+	{
+		_logs[hart].push_back({Event::Write, addr, upgrade});
+	}
+
+	void Evict(Word hart, Word tag)
+	{
+		_logs[hart].push_back({Event::Evict, tag, false});
+	}
+
+	// caches[i] is the data cache of hart i; all harts must be parked
+	void Commit(const std::vector<CachedMem*>& caches);
+
+	// A write performed at the barrier, like an atomic read-modify-write
+	void CommitWrite(Word hart, Word addr, const std::vector<CachedMem*>& caches)
+	{
+		ApplyWrite(hart, addr, false, caches);
+	}
+
+	const std::map<Word, LineStats>& Lines() const { return _lines; }
+
+	void Report(std::ostream& out, size_t top) const
+	{
+		std::vector<std::pair<uint64_t, Word>> order;
+		for (auto& [tag, stats] : _lines)
+			order.emplace_back(stats.coherenceMisses + stats.invalidations + stats.upgrades, tag);
+		std::sort(order.rbegin(), order.rend());
+
+		out << "line        coh.misses  invalidations  upgrades  sharing\n";
+		for (size_t i = 0; i < order.size() && i < top && order[i].first != 0; i++)
+		{
+			const LineStats& stats = _lines.at(order[i].second);
+			char buf[128];
+			snprintf(buf, sizeof(buf), "0x%08x  %10lu  %13lu  %8lu  %s\n", order[i].second,
+			         (unsigned long)stats.coherenceMisses, (unsigned long)stats.invalidations,
+			         (unsigned long)stats.upgrades, FalseSharing(stats) ? "false" : "true");
+			out << buf;
+		}
+	}
+
+private:
+	struct Event
+	{
+		enum Kind : uint8_t { Fill, Write, Evict } kind;
+		Word addr;
+		bool flag;
+	};
+
+	// several harts wrote the line, but never the same word
+	static bool FalseSharing(const LineStats& stats)
+	{
+		uint64_t writers = 0;
+		for (uint64_t harts : stats.wordWriters)
+		{
+			if (harts & (harts - 1))
+				return false;
+			writers |= harts;
+		}
+		return (writers & (writers - 1)) != 0;
+	}
+
+	void ApplyWrite(Word hart, Word addr, bool upgrade, const std::vector<CachedMem*>& caches);
+
+	size_t _invalidationLatency;
+	std::unordered_map<Word, uint64_t> _sharers;
+	std::vector<std::vector<Event>> _logs;
+	// the harts that wrote each line in the quantum being committed
+	std::unordered_map<Word, uint64_t> _written;
+	std::map<Word, LineStats> _lines;
 };
 
 
+static bool IsDataAccess(IType type)
+{
+	return type == IType::Ld || type == IType::St || type == IType::Lr ||
+	       type == IType::Sc || type == IType::Amo;
+}
+
+static Word AmoProc(AmoFunc func, Word old, Word operand)
+{
+	switch (func)
+	{
+	case AmoFunc::Add : return old + operand;
+	case AmoFunc::Swap: return operand;
+	case AmoFunc::Xor : return old ^ operand;
+	case AmoFunc::Or  : return old | operand;
+	case AmoFunc::And : return old & operand;
+	case AmoFunc::Min : return (SignedWord)old < (SignedWord)operand ? old : operand;
+	case AmoFunc::Max : return (SignedWord)old > (SignedWord)operand ? old : operand;
+	case AmoFunc::Minu: return old < operand ? old : operand;
+	case AmoFunc::Maxu: return old > operand ? old : operand;
+	default: return old;
+	}
+}
+
+
 class IMem
 {
 public:
@@ -150,132 +377,346 @@ public:
 
 	virtual void Request(Word ip) = 0;
 	virtual std::optional<Word> Response() = 0;
-	virtual void Request(Word, IType) = 0;
+	virtual void Request(Word, IType, AmoFunc = AmoFunc::None) = 0;
 	virtual bool Response(Word, IType, Word&) = 0;
 	virtual void Clock() = 0;
+	virtual const MemoryStorage& Storage() const = 0;
+	// the first address of the line `addr` lies in
+	virtual Word LineAddr(Word addr) const = 0;
+};
+
+
+// Which line of a full set a cache replaces
+enum class Replacement : uint8_t
+{
+	// the least recently used
+	Lru,
+	// the one filled first; hits do not refresh a line
+	Fifo,
+	// a pseudo-random one, from a fixed seed
+	Random,
 };
 
+constexpr const char* replacementNames[] = {"lru", "fifo", "random"};
 
-class CachedMem : public IMem
+// The shape and timing of CachedMem's two caches. The defaults are the
+// caches every reference cycle count was taken with: a fully associative
+// 4 KiB D-cache and 512 B I-cache of 64 B lines, which evicted on the fill
+// that made them full and so held 63 and 7 lines. Without exactLatency an
+// access that has to wait completes on the next Clock() whatever its
+// latency, which is how CachedMem has always been clocked.
+struct CacheConfig
+{
+	// a power of two; with harts it must be lineSizeBytes, the granule of
+	// the coherence directory
+	size_t lineBytes = lineSizeBytes;
+	// sets are powers of two
+	unsigned dataSets = 1;
+	unsigned dataWays = 63;
+	unsigned codeSets = 1;
+	unsigned codeWays = 7;
+	unsigned missLatency = 136;
+	// of a D-cache hit; I-cache hits are free
+	unsigned hitLatency = 3;
+	// added to an SC or AMO; with harts these also wait for the quantum
+	// barrier, where they are performed
+	unsigned atomicLatency = 4;
+	Replacement replacement = Replacement::Lru;
+	// count the latencies down one per Clock()
+	bool exactLatency = false;
+
+	bool IsValid() const
+	{
+		auto powerOfTwo = [](size_t n) { return n && (n & (n - 1)) == 0; };
+		return powerOfTwo(lineBytes) && lineBytes >= sizeof(Word) && powerOfTwo(dataSets) &&
+		       powerOfTwo(codeSets) && dataWays && codeWays;
+	}
+};
+
+class CachedMem final : public IMem
 {
 public:
 
-	explicit CachedMem(MemoryStorage& amem)
-		: _mem(amem)
+	explicit CachedMem(MemoryStorage& amem, StoreBuffer* storeBuffer = nullptr,
+	                   const CacheConfig& config = CacheConfig())
+		: _mem(amem), _storeBuffer(storeBuffer), _config(config), _lineWords(config.lineBytes / sizeof(Word)),
+		  line(LineMap::allocator_type(_arena)), _code_cache(_arena), _data_cache(_arena)
 	{
+		assert(config.IsValid());
+	}
 
+	const CacheConfig& getConfig() const
+	{
+		return _config;
 	}
 
-	void Request(Word ip)
+	// Drops every cached line and hands the line storage back to the arena,
+	// e.g. between runs or when restoring a checkpoint
+	void Flush()
 	{
-		_requestedIp = ip;
-		Word tag = ToLineAddr(_requestedIp);
-		if (std::find(_code_cache.last_used.begin(), _code_cache.last_used.end(), tag) != _code_cache.last_used.end())
-		{
-			_code_cache.last_used.remove(tag);
-		}
+		line.clear();
+		_code_cache.Clear();
+		_data_cache.Clear();
+		_lineStates.clear();
+		_invalidated.clear();
+		_reservation.reset();
+		_arena.Reset();
+	}
 
-		else
-		{
-			int i = 0;
-			while (i < lineSizeWords) {
-				Word word = _mem.Read(tag + i * 4);
+	Arena::Stats getArenaStats() const
+	{
+		return _arena.GetStats();
+	}
 
-				line[ToLineOffset(tag + i * 4)] = word;
-				i++;
-			}
-			_code_cache.tables[tag] = line;
+	void AttachCoherence(CoherenceDirectory* directory, Word hartId)
+	{
+		assert(_config.lineBytes == lineSizeBytes);
+		_coherence = directory;
+		_hartId = hartId;
+	}
 
-			if (_code_cache.tables.size() == _code_lines)
-			{
-				erase_tag = _code_cache.last_used.back();
-				_code_cache.last_used.remove(erase_tag);
-				_code_cache.tables.erase(erase_tag);
-			}
-			_waitCycles = latency;
+	void Request(Word ip)
+	{
+		HOST_PROFILE_SCOPE(Memory);
+		_requestedIp = ip;
+		Word tag = LineAddr(_requestedIp);
+		_codeStats.accesses++;
+		FetchLine(tag);
+		// a 32-bit instruction at the last halfword of a line spills into the
+		// next one, whose fill must not evict the first
+		if ((ip & 2u) && LineAddr(ip + 2) != tag && !Decoder::IsCompressed(CodeWord(ip) >> 16u))
+		{
+			_codeStats.lineCrossings++;
+			FetchLine(LineAddr(ip + 2), tag);
 		}
-		_code_cache.last_used.push_front(tag);
-
 	}
 
 	std::optional<Word> Response()
 	{
+		HOST_PROFILE_SCOPE(Memory);
 		if (_waitCycles > 0)
 			return std::optional<Word>();
-		return _code_cache.tables[ToLineAddr(_requestedIp)][ToLineOffset(_requestedIp)];
+		if (!(_requestedIp & 2u))
+			return CodeWord(_requestedIp);
+
+		// halfword aligned: the upper parcel is only needed by a 32-bit instruction
+		Word low = CodeWord(_requestedIp) >> 16u;
+		if (Decoder::IsCompressed(low))
+			return low;
+		return low | CodeWord(_requestedIp + 2) << 16u;
+	}
+
+	struct CacheStats
+	{
+		uint64_t accesses = 0;
+		uint64_t misses = 0;
+		// fetches that needed two lines
+		uint64_t lineCrossings = 0;
+	};
 
+	const CacheStats& getCodeStats() const { return _codeStats; }
+	const CacheStats& getDataStats() const { return _dataStats; }
+
+	void ResetStats()
+	{
+		_codeStats = {};
+		_dataStats = {};
 	}
 
-	void Request(Word _addr, IType _type)
+	void Request(Word _addr, IType _type, AmoFunc _amoFunc = AmoFunc::None)
 	{
-		if (_type != IType::Ld && _type != IType::St)
+		HOST_PROFILE_SCOPE(Memory);
+		if (!IsDataAccess(_type))
 		{
 		    skip = true;
 			return;
 		}
 		else {
 			_requestedIp = _addr;
-            Word tag = ToLineAddr(_requestedIp);
-			if (std::find(_data_cache.last_used.begin(), _data_cache.last_used.end(), tag) != _data_cache.last_used.end())
-			{
-				_data_cache.last_used.remove(tag);
-				_waitCycles += 3;
-
-			}
-
+			_requestedAmo = _amoFunc;
+            Word tag = LineAddr(_requestedIp);
+			_dataStats.accesses++;
+			if (Touch(_data_cache, tag))
+				_waitCycles += _config.hitLatency;
 			else
 			{
+				_dataStats.misses++;
 				int i = 0;
-				while (i < lineSizeWords) {
-					Word word = _mem.Read(tag + i * 4);
-					line[ToLineOffset(tag + i * 4)] = word;
+				while (i < _lineWords) {
+					Word word = MemRead(tag + i * 4);
+					line[LineOffset(tag + i * 4)] = word;
 					i++;
 				}
 				_data_cache.tables[tag] = line;
+				if (_coherence)
+				{
+					_lineStates[tag] = _coherence->SharedElsewhere(_hartId, tag) ? Mesi::Shared : Mesi::Exclusive;
+					_coherence->Fill(_hartId, tag, _invalidated.erase(tag) != 0);
+				}
 
-				if (_data_cache.tables.size() == _data_lines)
+				if (Evict(_data_cache, tag, _config.dataSets, _config.dataWays))
 				{
-					erase_tag = _data_cache.last_used.back();
-					_data_cache.last_used.remove(erase_tag);
-					i = 0;
-					while (i < lineSizeWords) {
-						_mem.Write(erase_tag + i * 4, _data_cache.tables[erase_tag][ToLineOffset(erase_tag + i * 4)]);
-						i++;
+					// The cache is write-through, so the victim is already in
+					// memory; writing it back would clobber newer stores of other harts.
+					if (_reservation == erase_tag)
+						_reservation.reset();
+					if (_coherence)
+					{
+						_lineStates.erase(erase_tag);
+						_coherence->Evict(_hartId, erase_tag);
 					}
-					_data_cache.tables.erase(erase_tag);
 				}
-				_waitCycles = latency;
+				_waitCycles = _config.missLatency;
+				_data_cache.last_used.push_front(tag);
 			}
-			_data_cache.last_used.push_front(tag);
+			if (_type == IType::Sc || _type == IType::Amo)
+				_stallCycles += _config.atomicLatency;
+			// with harts around, atomics write at the barrier (CommitAtomic)
+			if (_coherence && _type == IType::St)
+				CoherentWrite(tag, _addr);
 		}
 		return;
 	}
 
 	bool Response(Word _addr, IType _type, Word& _data)
 	{
-		if (_type != IType::Ld && _type != IType::St)
+		HOST_PROFILE_SCOPE(Memory);
+		if (!IsDataAccess(_type))
 			return true;
 
-		if (_waitCycles != 0)
+		if (_waitCycles != 0 || _stallCycles != 0)
 			return false;
 
-		if (_type == IType::Ld) {
-            _data = _data_cache.tables[ToLineAddr(_addr)][ToLineOffset(_addr)];
+		if (_type == IType::Ld || _type == IType::Lr) {
+            _data = _data_cache.tables[LineAddr(_addr)][LineOffset(_addr)];
             data = _data;
+            if (_type == IType::Lr)
+                _reservation = LineAddr(_addr);
         }
+		else if (_type == IType::St)
+		{
+			_data_cache.tables[LineAddr(_addr)][LineOffset(_addr)] = _data;
+			MemWrite(_addr, _data);
+		}
+		else if (_coherence)
+		{
+			// Sc/Amo: stall until the barrier performs it on the shared memory
+			if (!_atomic)
+			{
+				_atomic = PendingAtomic{_type, _requestedAmo, _addr, _data, false};
+				return false;
+			}
+			if (!_atomic->done)
+				return false;
+			_data = _atomic->operand;
+			_atomic.reset();
+		}
 		else
 		{
-			_data_cache.tables[ToLineAddr(_addr)][ToLineOffset(_addr)] = _data;
-			_mem.Write(_addr, _data);
+			Word& word = _data_cache.tables[LineAddr(_addr)][LineOffset(_addr)];
+			if (_type == IType::Sc)
+			{
+				bool reserved = _reservation == LineAddr(_addr);
+				_reservation.reset();
+				if (reserved)
+				{
+					word = _data;
+					MemWrite(_addr, _data);
+				}
+				_data = reserved ? 0 : 1;
+			}
+			else
+			{
+				Word old = word;
+				word = AmoProc(_requestedAmo, old, _data);
+				MemWrite(_addr, word);
+				_data = old;
+			}
 		}
 		return true;
 	}
 
+	// Performs a pending Sc/Amo of this hart on the shared memory. Called by
+	// the MultiHart coordinator in hart order, after the store buffers were
+	// drained and the coherence directory committed.
+	void CommitAtomic(const std::vector<CachedMem*>& caches)
+	{
+		if (!_atomic || _atomic->done)
+			return;
+		PendingAtomic& atomic = *_atomic;
+		Word tag = LineAddr(atomic.addr);
+		Word old = _mem.Read(atomic.addr);
+		Word result;
+		bool write = true;
+		if (atomic.type == IType::Sc)
+		{
+			write = _reservation == tag;
+			_reservation.reset();
+			result = atomic.operand;
+			atomic.operand = write ? 0 : 1;
+		}
+		else
+		{
+			result = AmoProc(atomic.func, old, atomic.operand);
+			atomic.operand = old;
+		}
+		if (write)
+		{
+			_mem.Write(atomic.addr, result);
+			auto it = _data_cache.tables.find(tag);
+			if (it != _data_cache.tables.end())
+				it->second[LineOffset(atomic.addr)] = result;
+			_coherence->CommitWrite(_hartId, atomic.addr, caches);
+		}
+		atomic.done = true;
+	}
+
 
 	void Clock()
 	{
+		HOST_PROFILE_SCOPE(Memory);
 		if (_waitCycles > 0)
-			_waitCycles = 0;
+			_waitCycles = _config.exactLatency ? _waitCycles - 1 : 0;
+		if (_stallCycles > 0)
+			_stallCycles--;
+	}
+
+	const MemoryStorage& Storage() const
+	{
+		return _mem;
+	}
+
+	// Called by the directory at a quantum barrier
+	bool Invalidate(Word tag)
+	{
+		if (_reservation == tag)
+			_reservation.reset();
+		if (_data_cache.tables.erase(tag) == 0)
+			return false;
+		_data_cache.last_used.remove(tag);
+		_lineStates.erase(tag);
+		_invalidated.insert(tag);
+		return true;
+	}
+
+	void Downgrade(Word tag)
+	{
+		auto it = _lineStates.find(tag);
+		if (it != _lineStates.end())
+			it->second = Mesi::Shared;
+	}
+
+	void Claim(Word tag)
+	{
+		auto it = _lineStates.find(tag);
+		if (it != _lineStates.end())
+			it->second = Mesi::Modified;
+	}
+
+	Mesi getLineState(Word addr) const
+	{
+		auto it = _lineStates.find(LineAddr(addr));
+		return it != _lineStates.end() ? it->second : Mesi::Invalid;
 	}
 
     size_t getWaitCycles()
@@ -289,7 +730,7 @@ public:
 
 
     std::list<Word> getCodeList() const {
-        return _code_cache.last_used;
+        return {_code_cache.last_used.begin(), _code_cache.last_used.end()};
     }
 
 
@@ -299,31 +740,31 @@ public:
 
     void setCacheCodeTableLines(Word ip, std::map<Word, Word> custom_line) {
         _requestedIp = ip;
-        Word tag = ToLineAddr(_requestedIp);
-        _code_cache.tables[tag] = custom_line;
+        Word tag = LineAddr(_requestedIp);
+        _code_cache.tables[tag] = LineMap(custom_line.begin(), custom_line.end(), line.get_allocator());
     }
 
     void setCacheDataTableLines(Word ip, std::map<Word, Word> custom_line){
         _requestedIp = ip;
-        Word tag = ToLineAddr(_requestedIp);
-        _data_cache.tables[tag] = custom_line;
+        Word tag = LineAddr(_requestedIp);
+        _data_cache.tables[tag] = LineMap(custom_line.begin(), custom_line.end(), line.get_allocator());
     }
 
 
     void setCacheCodeLastUsed(Word ip) {
         _requestedIp = ip;
-        Word tag = ToLineAddr(_requestedIp);
+        Word tag = LineAddr(_requestedIp);
         _code_cache.last_used.push_front(tag);
     }
 
     void setCacheDataLastUsed(Word ip){
         _requestedIp = ip;
-        Word tag = ToLineAddr(_requestedIp);
+        Word tag = LineAddr(_requestedIp);
         _data_cache.last_used.push_front(tag);
 	}
 
     std::map<Word, Word> getLine() const {
-        return line;
+        return {line.begin(), line.end()};
     }
 
     Word getEraseTag() const {
@@ -331,35 +772,337 @@ public:
     }
 
     std::map<Word, std::map<Word, Word>> getDataTables(){
-        return _data_cache.tables;
+        std::map<Word, std::map<Word, Word>> tables;
+        for (const auto& [tag, words] : _data_cache.tables)
+            tables[tag] = {words.begin(), words.end()};
+        return tables;
     }
 
 	Word getData(){
 	    return data;
 	}
 
+	Word LineAddr(Word addr) const
+	{
+		return addr & ~Word(_config.lineBytes - 1);
+	}
+
 private:
-	static constexpr size_t latency = 136;
+	Word LineOffset(Word addr) const
+	{
+		return ToWordAddr(addr) & (_lineWords - 1);
+	}
+
+	// The word at `addr` of a line the I-cache holds
+	Word CodeWord(Word addr) const
+	{
+		return _code_cache.tables.at(LineAddr(addr)).at(LineOffset(addr));
+	}
+
+	// Fills the line `tag` into the I-cache unless it is there; `keep` is
+	// a line the fill must not evict
+	void FetchLine(Word tag, std::optional<Word> keep = std::nullopt)
+	{
+		if (!Touch(_code_cache, tag))
+		{
+			_codeStats.misses++;
+			int i = 0;
+			while (i < _lineWords) {
+				Word word = MemRead(tag + i * 4);
+
+				line[LineOffset(tag + i * 4)] = word;
+				i++;
+			}
+			_code_cache.tables[tag] = line;
+			Evict(_code_cache, tag, _config.codeSets, _config.codeWays, keep);
+			_waitCycles = _config.missLatency;
+			_code_cache.last_used.push_front(tag);
+		}
+	}
+
+
+	Word MemRead(Word addr)
+	{
+		return _storeBuffer ? _storeBuffer->Read(_mem, addr) : _mem.Read(addr);
+	}
+
+	void MemWrite(Word addr, Word data)
+	{
+		if (_storeBuffer)
+			_storeBuffer->Write(addr, data);
+		else
+			_mem.Write(addr, data);
+	}
+
+	void CoherentWrite(Word tag, Word addr)
+	{
+		Mesi& state = _lineStates[tag];
+		bool upgrade = state == Mesi::Shared;
+		if (upgrade)
+			_stallCycles += _coherence->InvalidationLatency();
+		state = Mesi::Modified;
+		_coherence->Write(_hartId, addr, upgrade);
+	}
+
+	struct PendingAtomic
+	{
+		IType type;
+		AmoFunc func;
+		Word addr;
+		// the value to store, then the value returned to rd
+		Word operand;
+		bool done;
+	};
+
 	Word data = 0;
     Word erase_tag = 0;
 	Word _requestedIp = 0;
 	size_t _waitCycles = 0;
 	MemoryStorage& _mem;
-	const int _data_lines = 64;  // 4096 / 64
-	const int _code_lines = 8;  // 512 / 64
-	std::map<Word, Word> line;
+	StoreBuffer* _storeBuffer;
+	CoherenceDirectory* _coherence = nullptr;
+	Word _hartId = 0;
+	size_t _stallCycles = 0;
+	AmoFunc _requestedAmo = AmoFunc::None;
+	// line address reserved by the last LR
+	std::optional<Word> _reservation;
+	std::optional<PendingAtomic> _atomic;
+	std::unordered_map<Word, Mesi> _lineStates;
+	// lines taken away by peers; the next miss on them is a coherence miss
+	std::unordered_set<Word> _invalidated;
+	const CacheConfig _config;
+	const int _lineWords;
+	// the state of the xorshift behind Replacement::Random
+	uint32_t _random = 2463534242u;
+	// cache lines and LRU nodes live here, so every instance owns its storage
+	Arena _arena;
+	using LineMap = std::map<Word, Word, std::less<Word>, ArenaAllocator<std::pair<const Word, Word>>>;
+	LineMap line;
 
 
     bool skip = false;
     
 	struct Cache
 	{
-		std::list<Word> last_used;
-		std::map<Word, std::map<Word, Word>> tables;
+		explicit Cache(Arena& arena)
+			: last_used(ArenaAllocator<Word>(arena)), tables(TableAllocator(arena))
+		{
+		}
+
+		void Clear()
+		{
+			last_used.clear();
+			tables.clear();
+		}
+
+		// the outer allocator is handed down to every line map
+		using TableAllocator = std::scoped_allocator_adaptor<ArenaAllocator<std::pair<const Word, LineMap>>>;
+		std::list<Word, ArenaAllocator<Word>> last_used;
+		std::map<Word, LineMap, std::less<Word>, TableAllocator> tables;
 	};
 	Cache _code_cache;
 	Cache _data_cache;
+	CacheStats _codeStats;
+	CacheStats _dataStats;
+
+	// Whether `tag` is cached; a hit makes it the most recently used line,
+	// unless lines are replaced first in, first out
+	bool Touch(Cache& cache, Word tag)
+	{
+		auto it = std::find(cache.last_used.begin(), cache.last_used.end(), tag);
+		if (it == cache.last_used.end())
+			return false;
+		if (_config.replacement != Replacement::Fifo)
+			cache.last_used.splice(cache.last_used.begin(), cache.last_used, it);
+		return true;
+	}
+
+	// Makes room in the set of `tag`, which was just filled but is not in
+	// last_used yet: if the set now holds more than `ways` lines, one of
+	// the others but `keep` goes, into erase_tag. A set whose only other
+	// line is `keep` stays over its ways until its next fill.
+	bool Evict(Cache& cache, Word tag, unsigned sets, unsigned ways, std::optional<Word> keep = std::nullopt)
+	{
+		Word set = (tag / _config.lineBytes) & (sets - 1);
+		auto inSet = [&](Word other) { return ((other / _config.lineBytes) & (sets - 1)) == set; };
+		auto candidate = [&](Word other) { return other != keep && inSet(other); };
+		size_t fill = sets == 1 ? cache.tables.size()
+		                        : 1 + std::count_if(cache.last_used.begin(), cache.last_used.end(), inSet);
+		if (fill <= ways)
+			return false;
+		// last_used runs from the most to the least recently used or filled
+		auto victim = std::find_if(cache.last_used.rbegin(), cache.last_used.rend(), candidate);
+		if (victim == cache.last_used.rend())
+			return false;
+		if (_config.replacement == Replacement::Random)
+		{
+			_random ^= _random << 13u;
+			_random ^= _random >> 17u;
+			_random ^= _random << 5u;
+			size_t skip = _random % std::count_if(cache.last_used.begin(), cache.last_used.end(), candidate);
+			for (; skip > 0; skip--)
+				victim = std::find_if(std::next(victim), cache.last_used.rend(), candidate);
+		}
+		erase_tag = *victim;
+		cache.last_used.erase(std::next(victim).base());
+		cache.tables.erase(erase_tag);
+		return true;
+	}
 
 };
 
+// Memory without caches: every access completes in the cycle it is made.
+// Gives the bound the memory system puts on a program and is the cheapest
+// model to simulate. Single hart only.
+class FlatMem final : public IMem
+{
+public:
+	explicit FlatMem(MemoryStorage& mem)
+		: _mem(mem)
+	{
+	}
+
+	void Request(Word ip)
+	{
+		_requestedIp = ip;
+	}
+
+	std::optional<Word> Response()
+	{
+		if (!(_requestedIp & 2u))
+			return _mem.Read(_requestedIp);
+		Word low = _mem.Read(_requestedIp) >> 16u;
+		if (Decoder::IsCompressed(low))
+			return low;
+		return low | _mem.Read(_requestedIp + 2) << 16u;
+	}
+
+	void Request(Word, IType, AmoFunc amoFunc = AmoFunc::None)
+	{
+		_requestedAmo = amoFunc;
+	}
+
+	bool Response(Word addr, IType type, Word& data)
+	{
+		switch (type)
+		{
+		case IType::Ld:
+			data = _mem.Read(addr);
+			break;
+		case IType::Lr:
+			data = _mem.Read(addr);
+			_reservation = LineAddr(addr);
+			break;
+		case IType::St:
+			_mem.Write(addr, data);
+			break;
+		case IType::Sc:
+			{
+				bool reserved = _reservation == LineAddr(addr);
+				_reservation.reset();
+				if (reserved)
+					_mem.Write(addr, data);
+				data = reserved ? 0 : 1;
+				break;
+			}
+		case IType::Amo:
+			{
+				Word old = _mem.Read(addr);
+				_mem.Write(addr, AmoProc(_requestedAmo, old, data));
+				data = old;
+				break;
+			}
+		default:
+			break;
+		}
+		return true;
+	}
+
+	void Clock()
+	{
+	}
+
+	const MemoryStorage& Storage() const
+	{
+		return _mem;
+	}
+
+	Word LineAddr(Word addr) const
+	{
+		return ToLineAddr(addr);
+	}
+
+private:
+	MemoryStorage& _mem;
+	Word _requestedIp = 0;
+	AmoFunc _requestedAmo = AmoFunc::None;
+	std::optional<Word> _reservation;
+};
+
+inline void CoherenceDirectory::Commit(const std::vector<CachedMem*>& caches)
+{
+	for (Word hart = 0; hart < _logs.size(); hart++)
+	{
+		uint64_t self = 1ull << hart;
+		for (const Event& event : _logs[hart])
+		{
+			Word tag = ToLineAddr(event.addr);
+			uint64_t& sharers = _sharers[tag];
+			switch (event.kind)
+			{
+			case Event::Fill:
+			{
+				LineStats& stats = _lines[tag];
+				stats.coherenceMisses += event.flag;
+				// the write was replayed first but may have happened later;
+				// the next access refills, as a coherence miss
+				if (auto it = _written.find(tag); it != _written.end() && (it->second & ~self))
+				{
+					if (caches[hart]->Invalidate(tag))
+						stats.invalidations++;
+					break;
+				}
+				// nobody keeps writing silently once the line is shared,
+				// including a filler that saw a stale directory
+				if (sharers & ~self)
+				{
+					for (Word peer = 0; peer < caches.size(); peer++)
+						if (sharers & (1ull << peer))
+							caches[peer]->Downgrade(tag);
+					caches[hart]->Downgrade(tag);
+				}
+				sharers |= self;
+				break;
+			}
+			case Event::Write:
+				ApplyWrite(hart, event.addr, event.flag, caches);
+				_written[tag] |= self;
+				break;
+			case Event::Evict:
+				sharers &= ~self;
+				break;
+			}
+		}
+		_logs[hart].clear();
+	}
+	_written.clear();
+}
+
+inline void CoherenceDirectory::ApplyWrite(Word hart, Word addr, bool upgrade, const std::vector<CachedMem*>& caches)
+{
+	Word tag = ToLineAddr(addr);
+	uint64_t self = 1ull << hart;
+	uint64_t& sharers = _sharers[tag];
+	LineStats& stats = _lines[tag];
+	stats.upgrades += upgrade;
+	stats.wordWriters[ToLineOffset(addr)] |= self;
+	for (Word peer = 0; peer < caches.size(); peer++)
+	{
+		if (((sharers & ~self) & (1ull << peer)) && caches[peer]->Invalidate(tag))
+			stats.invalidations++;
+	}
+	caches[hart]->Claim(tag);
+	sharers = self;
+}
+
 #endif //RISCV_SIM_DATAMEMORY_H
\ No newline at end of file
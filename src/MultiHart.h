@@ -0,0 +1,184 @@
+#ifndef RISCV_SIM_MULTIHART_H
+#define RISCV_SIM_MULTIHART_H
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Cpu.h"
+
+// Reusable thread barrier (std::barrier is C++20)
+class Barrier
+{
+public:
+	explicit Barrier(size_t count)
+		: _count(count)
+	{
+	}
+
+	void Wait()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		size_t generation = _generation;
+		if (++_waiting == _count)
+		{
+			_waiting = 0;
+			_generation++;
+			_cv.notify_all();
+			return;
+		}
+		_cv.wait(lock, [&] { return generation != _generation; });
+	}
+
+private:
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	size_t _count;
+	size_t _waiting = 0;
+	size_t _generation = 0;
+};
+
+// N harts sharing one MemoryStorage. Every hart owns a private CachedMem and
+// StoreBuffer and is stepped on its own host thread for `quantum` cycles at a
+// time. Between quanta all threads meet at a barrier, and the calling thread
+// drains the store buffers, commits the coherence directory, performs the
+// pending atomics and delivers host messages in hart order, so the result of a
+// run does not depend on host scheduling.
+class MultiHart
+{
+public:
+	// Returns false to stop the simulation
+	using MessageHandler = std::function<bool(Word hartId, CpuToHostData msg)>;
+
+	// cycles a write to a line other harts share waits for their copies to
+	// be invalidated
+	static constexpr size_t defaultInvalidationLatency = 20;
+
+	// `harts` must be between 1 and CoherenceDirectory::maxHarts, and
+	// `quantum` at least 1, or no hart would ever step. An SC or AMO is
+	// performed at the next barrier, so the cycles it takes include the
+	// wait for the end of the quantum, up to `quantum` cycles, on top of
+	// the atomic latency of `cache`.
+	MultiHart(MemoryStorage& mem, unsigned harts, uint64_t quantum, const TimingConfig& timing = TimingConfig(),
+	          size_t invalidationLatency = defaultInvalidationLatency, const CacheConfig& cache = CacheConfig())
+		: _mem(mem), _quantum(quantum), _coherence(harts, invalidationLatency),
+		  _start(harts + 1), _done(harts + 1)
+	{
+		assert(quantum >= 1);
+		// the directory tracks lines of lineSizeBytes
+		assert(cache.lineBytes == lineSizeBytes);
+		for (unsigned id = 0; id < harts; id++)
+		{
+			_harts.push_back(std::make_unique<Hart>(mem, id, timing, cache));
+			_harts.back()->cache.AttachCoherence(&_coherence, id);
+			_caches.push_back(&_harts.back()->cache);
+		}
+	}
+
+	void Reset(Word ip)
+	{
+		for (auto& hart : _harts)
+		{
+			hart->cache.Flush();
+			hart->cpu.Reset(ip);
+		}
+	}
+
+	void UsePredecoded(const DecodedText* text)
+	{
+		for (auto& hart : _harts)
+			hart->cpu.UsePredecoded(text);
+	}
+
+	void Run(const MessageHandler& handler)
+	{
+		_stop = false;
+		std::vector<std::thread> threads;
+		for (auto& hart : _harts)
+			threads.emplace_back([this, &hart] { Worker(*hart); });
+
+		while (!_stop)
+		{
+			_start.Wait();
+			_done.Wait();
+			for (auto& hart : _harts)
+				hart->stores.Drain(_mem);
+			_coherence.Commit(_caches);
+			for (CachedMem* cache : _caches)
+				cache->CommitAtomic(_caches);
+			for (Word id = 0; id < _harts.size() && !_stop; id++)
+			{
+				for (CpuToHostData msg : _harts[id]->messages)
+				{
+					if (!handler(id, msg))
+					{
+						_stop = true;
+						break;
+					}
+				}
+				_harts[id]->messages.clear();
+			}
+			// the run cannot go on past a guest access outside the storage
+			if (_mem.Faulted())
+				_stop = true;
+		}
+		// release the workers so they can observe _stop
+		_start.Wait();
+		for (auto& thread : threads)
+			thread.join();
+	}
+
+	const CoherenceDirectory& Coherence() const
+	{
+		return _coherence;
+	}
+
+private:
+	struct Hart
+	{
+		Hart(MemoryStorage& mem, Word id, const TimingConfig& timing, const CacheConfig& config)
+			: cache(mem, &stores, config), cpu(cache, id, timing)
+		{
+		}
+
+		StoreBuffer stores;
+		CachedMem cache;
+		Cpu<CachedMem> cpu;
+		std::vector<CpuToHostData> messages;
+	};
+
+	void Worker(Hart& hart)
+	{
+		while (true)
+		{
+			_start.Wait();
+			if (_stop)
+				return;
+			uint64_t end = hart.cpu.Cycles() + _quantum;
+			while (hart.cpu.Cycles() < end)
+			{
+				StopReason stop = hart.cpu.Run(end - hart.cpu.Cycles());
+				if (stop == StopReason::Fault)
+					break;
+				if (stop != StopReason::Budget)
+					hart.messages.push_back(*hart.cpu.GetMessage());
+			}
+			_done.Wait();
+		}
+	}
+
+	MemoryStorage& _mem;
+	uint64_t _quantum;
+	CoherenceDirectory _coherence;
+	std::vector<std::unique_ptr<Hart>> _harts;
+	std::vector<CachedMem*> _caches;
+	Barrier _start;
+	Barrier _done;
+	// written by the coordinator only while all workers wait on _start
+	bool _stop = false;
+};
+
+#endif //RISCV_SIM_MULTIHART_H
@@ -0,0 +1,320 @@
+#ifndef RISCV_SIM_PROFILER_H
+#define RISCV_SIM_PROFILER_H
+
+#include "DataProfiler.h"
+#include "Elf.h"
+#include "Memory.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Guest profiler. Every retired instruction is charged to its PC with the
+// cycles since the previous retirement and the I-cache and D-cache misses it
+// caused. Calls and returns, recognised by the link-register convention
+// (jal/jalr writing ra or t0 call, jalr x0 through ra or t0 returns), are
+// followed on a shadow stack that builds a calling-context tree, from which
+// inclusive totals and collapsed stacks for flamegraph.pl are derived.
+// Code entered by a jump instead of a call gets a frame of its own below
+// the caller. Counting is a few array increments per instruction; the tree
+// is only searched on calls, returns and such jumps.
+class Profiler
+{
+public:
+    struct Counters
+    {
+        uint64_t instructions = 0;
+        uint64_t cycles = 0;
+        uint64_t icacheMisses = 0;
+        uint64_t dcacheMisses = 0;
+
+        void Add(const Counters& other)
+        {
+            instructions += other.instructions;
+            cycles += other.cycles;
+            icacheMisses += other.icacheMisses;
+            dcacheMisses += other.dcacheMisses;
+        }
+    };
+
+    // `cache` supplies the miss counts; without one only instructions and
+    // cycles are collected
+    explicit Profiler(const ElfFile& elf, const CachedMem* cache = nullptr)
+        : _elf(elf), _cache(cache)
+    {
+        Word begin = ~0u;
+        Word end = 0;
+        for (const ElfFile::Section& section : elf.Sections())
+        {
+            if (!(section.flags & SHF_EXECINSTR) || section.data.empty())
+                continue;
+            begin = std::min(begin, section.addr);
+            end = std::max<Word>(end, section.addr + section.data.size());
+        }
+        if (begin < end)
+        {
+            _base = begin;
+            _pcs.resize((end - begin) / 2);
+            _functions.resize(_pcs.size());
+            for (size_t i = 0; i < _functions.size(); i++)
+                _functions[i] = FunctionOf(_base + 2 * i);
+        }
+        _nodes.push_back({unknown, 0, {}, {}});
+    }
+
+    // Also attribute the loads and stores to data objects
+    void UseDataProfiler(DataProfiler* data)
+    {
+        _data = data;
+    }
+
+    // Called by the core when the instruction at `ip` retires in `cycle`
+    void Retire(Word ip, const Instruction& instr, const InstrState& state, uint64_t cycle)
+    {
+        Counters delta;
+        delta.instructions = 1;
+        delta.cycles = cycle - _lastCycle;
+        _lastCycle = cycle;
+        if (_cache)
+        {
+            uint64_t icache = _cache->getCodeStats().misses;
+            uint64_t dcache = _cache->getDataStats().misses;
+            // the statistics restart from 0 when the region of interest
+            // resets them
+            delta.icacheMisses = icache >= _icacheMisses ? icache - _icacheMisses : icache;
+            delta.dcacheMisses = dcache >= _dcacheMisses ? dcache - _dcacheMisses : dcache;
+            _icacheMisses = icache;
+            _dcacheMisses = dcache;
+        }
+
+        Word index = (ip - _base) >> 1u;
+        uint32_t function = unknown;
+        if (index < _pcs.size())
+        {
+            _pcs[index].Add(delta);
+            function = _functions[index];
+        }
+        else
+            _outside.Add(delta);
+        if (_stack.empty())
+        {
+            _nodes[0].function = function;
+            _stack.push_back(0);
+        }
+        // code reached by a jump rather than a call is a frame of its own
+        uint32_t node = _stack.back();
+        if (_nodes[node].function != function)
+            node = Child(node, function);
+        _nodes[node].self.Add(delta);
+        _total.Add(delta);
+        if (_data && instr._dst == sp)
+            _data->StackPointer(state._data);
+        if (_data && IsDataAccess(instr._type))
+            _data->Access(instr, state, delta.cycles, delta.dcacheMisses, delta.icacheMisses);
+
+        if (instr._handler != Handler::Jal && instr._handler != Handler::Jalr)
+            return;
+        if (IsLink(instr._dst))
+            Call(state._nextIp);
+        else if (instr._dst == 0 && instr._handler == Handler::Jalr && IsLink(instr._src1) && _stack.size() > 1)
+            _stack.pop_back();
+    }
+
+    const Counters& Total() const
+    {
+        return _total;
+    }
+
+    // Self and inclusive totals per function, heaviest self cycles first
+    struct FunctionProfile
+    {
+        std::string name;
+        Counters self;
+        Counters inclusive;
+    };
+
+    std::vector<FunctionProfile> Functions() const
+    {
+        std::map<uint32_t, FunctionProfile> functions;
+        for (size_t i = 0; i < _pcs.size(); i++)
+        {
+            if (_pcs[i].instructions)
+                Entry(functions, _functions[i]).self.Add(_pcs[i]);
+        }
+        // a node's cost counts once towards every distinct function on its path
+        std::vector<uint32_t> path;
+        for (uint32_t node = 0; node < _nodes.size(); node++)
+        {
+            path.clear();
+            for (uint32_t n = node;; n = _nodes[n].parent)
+            {
+                if (std::find(path.begin(), path.end(), _nodes[n].function) == path.end())
+                    path.push_back(_nodes[n].function);
+                if (n == 0)
+                    break;
+            }
+            for (uint32_t function : path)
+                Entry(functions, function).inclusive.Add(_nodes[node].self);
+        }
+
+        std::vector<FunctionProfile> result;
+        for (auto& [function, profile] : functions)
+            result.push_back(std::move(profile));
+        std::sort(result.begin(), result.end(), [](const FunctionProfile& a, const FunctionProfile& b) {
+            return a.self.cycles > b.self.cycles;
+        });
+        return result;
+    }
+
+    // Flat profile of the `top` heaviest functions and PCs
+    void Report(std::ostream& out, size_t top = 20) const
+    {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "Profile: %" PRIu64 " instructions, %" PRIu64 " cycles, %" PRIu64
+                 " I-cache misses, %" PRIu64 " D-cache misses\n", _total.instructions, _total.cycles,
+                 _total.icacheMisses, _total.dcacheMisses);
+        out << buf;
+        snprintf(buf, sizeof(buf), "%7s %12s %12s %12s %8s %8s  %s\n", "self%", "self cyc", "incl cyc", "instrs",
+                 "I-miss", "D-miss", "function");
+        out << buf;
+        std::vector<FunctionProfile> functions = Functions();
+        for (size_t i = 0; i < functions.size() && i < top; i++)
+        {
+            const FunctionProfile& f = functions[i];
+            snprintf(buf, sizeof(buf), "%6.2f%% %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %8" PRIu64 " %8" PRIu64
+                     "  %s\n", Percent(f.self.cycles), f.self.cycles, f.inclusive.cycles, f.self.instructions,
+                     f.self.icacheMisses, f.self.dcacheMisses, f.name.c_str());
+            out << buf;
+        }
+
+        std::vector<Word> pcs;
+        for (size_t i = 0; i < _pcs.size(); i++)
+        {
+            if (_pcs[i].instructions)
+                pcs.push_back(i);
+        }
+        std::sort(pcs.begin(), pcs.end(), [this](Word a, Word b) { return _pcs[a].cycles > _pcs[b].cycles; });
+        snprintf(buf, sizeof(buf), "%7s %10s %12s %12s %8s %8s  %s\n", "self%", "pc", "cycles", "instrs", "I-miss",
+                 "D-miss", "location");
+        out << buf;
+        for (size_t i = 0; i < pcs.size() && i < top; i++)
+        {
+            const Counters& c = _pcs[pcs[i]];
+            Word pc = _base + 2 * pcs[i];
+            snprintf(buf, sizeof(buf), "%6.2f%% %#10x %12" PRIu64 " %12" PRIu64 " %8" PRIu64 " %8" PRIu64 "  %s\n",
+                     Percent(c.cycles), pc, c.cycles, c.instructions, c.icacheMisses, c.dcacheMisses,
+                     Location(pc).c_str());
+            out << buf;
+        }
+    }
+
+    // One line per call path, "main;sort;partition <cycles>", the input
+    // format of flamegraph.pl
+    void WriteCollapsed(std::ostream& out) const
+    {
+        for (uint32_t node = 0; node < _nodes.size(); node++)
+        {
+            if (!_nodes[node].self.cycles)
+                continue;
+            std::vector<uint32_t> path;
+            for (uint32_t n = node;; n = _nodes[n].parent)
+            {
+                path.push_back(_nodes[n].function);
+                if (n == 0)
+                    break;
+            }
+            for (auto it = path.rbegin(); it != path.rend(); ++it)
+                out << (it == path.rbegin() ? "" : ";") << Name(*it);
+            out << ' ' << _nodes[node].self.cycles << '\n';
+        }
+    }
+
+private:
+    static constexpr uint32_t unknown = ~0u;
+    static constexpr Word sp = 2;
+
+    struct Node
+    {
+        uint32_t function;
+        uint32_t parent;
+        Counters self;
+        std::map<uint32_t, uint32_t> children;
+    };
+
+    // ra, or t0 as the alternate link register
+    static bool IsLink(Word reg)
+    {
+        return reg == 1 || reg == 5;
+    }
+
+    void Call(Word target)
+    {
+        Word index = (target - _base) >> 1u;
+        _stack.push_back(Child(_stack.back(), index < _functions.size() ? _functions[index] : unknown));
+    }
+
+    uint32_t Child(uint32_t parent, uint32_t function)
+    {
+        auto it = _nodes[parent].children.find(function);
+        if (it != _nodes[parent].children.end())
+            return it->second;
+        _nodes[parent].children.emplace(function, _nodes.size());
+        _nodes.push_back({function, parent, {}, {}});
+        return _nodes.size() - 1;
+    }
+
+    uint32_t FunctionOf(Word addr) const
+    {
+        const ElfFile::Symbol* symbol = _elf.FindSymbol(addr);
+        return symbol ? symbol - _elf.Symbols().data() : unknown;
+    }
+
+    std::string Name(uint32_t function) const
+    {
+        return function == unknown ? "[unknown]" : _elf.Symbols()[function].name;
+    }
+
+    std::string Location(Word pc) const
+    {
+        uint32_t function = FunctionOf(pc);
+        if (function == unknown)
+            return "[unknown]";
+        char offset[16];
+        snprintf(offset, sizeof(offset), "+%#x", pc - _elf.Symbols()[function].addr);
+        return Name(function) + offset;
+    }
+
+    FunctionProfile& Entry(std::map<uint32_t, FunctionProfile>& functions, uint32_t function) const
+    {
+        FunctionProfile& profile = functions[function];
+        profile.name = Name(function);
+        return profile;
+    }
+
+    double Percent(uint64_t cycles) const
+    {
+        return _total.cycles ? 100.0 * cycles / _total.cycles : 0.0;
+    }
+
+    const ElfFile& _elf;
+    const CachedMem* _cache;
+    DataProfiler* _data = nullptr;
+    Word _base = 0;
+    std::vector<Counters> _pcs;
+    // the function of every PC
+    std::vector<uint32_t> _functions;
+    // retired outside the executable sections
+    Counters _outside;
+    Counters _total;
+    uint64_t _lastCycle = 0;
+    uint64_t _icacheMisses = 0;
+    uint64_t _dcacheMisses = 0;
+    std::vector<Node> _nodes;
+    // nodes of the calls in progress, the root first
+    std::vector<uint32_t> _stack;
+};
+
+#endif //RISCV_SIM_PROFILER_H
@@ -2,6 +2,8 @@
 #ifndef RISCV_SIM_REGISTERFILE_H
 #define RISCV_SIM_REGISTERFILE_H
 
+#include <array>
+#include "HostProfile.h"
 #include "Instruction.h"
 
 class RegisterFile
@@ -12,18 +14,18 @@ public:
         _r.fill(0);
     }
 
-    void Read(InstructionPtr& instr)
+    void Read(const Instruction& instr, InstrState& state) const
     {
-        if (instr->_src1)
-            instr->_src1Val = _r.at(instr->_src1.value());
-
-        if (instr->_src2)
-            instr->_src2Val = _r.at(instr->_src2.value());
+        HOST_PROFILE_SCOPE(RegisterFile);
+        state._src1Val = _r[instr._src1];
+        state._src2Val = _r[instr._src2];
     }
-    void Write(InstructionPtr& instr)
+    void Write(const Instruction& instr, const InstrState& state)
     {
-        if (instr->_dst)
-            _r.at(instr->_dst.value()) = instr->_data;
+        HOST_PROFILE_SCOPE(RegisterFile);
+        // an instruction without a destination names x0, which stays zero
+        _r[instr._dst] = state._data;
+        _r[0] = 0;
     }
 private:
     std::array<Word, 32> _r;
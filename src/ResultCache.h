@@ -0,0 +1,296 @@
+#ifndef RISCV_SIM_RESULTCACHE_H
+#define RISCV_SIM_RESULTCACHE_H
+
+#include "Simulation.h"
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+// Results of whole simulations kept on disk, so a run of the same program
+// on the same configuration with the same simulator binary is looked up
+// instead of simulated. An entry is named by a hash of the ELF file's
+// bytes, Describe(SimOptions) and the build ID, a hash of the running
+// executable, so any rebuild starts afresh. The entry repeats the
+// configuration and build ID and is only used if they match. Entries are
+// written to a temporary file and renamed, so concurrent runs, in threads
+// or processes, never see half an entry. Runs cut off by the wall-clock
+// budget depend on the host and are not kept. With a verify rate, that
+// share of the hits is simulated again and checked against the entry.
+class ResultCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t verified = 0;
+        // verified hits that came out differently; their entries were
+        // replaced
+        uint64_t mismatches = 0;
+    };
+
+    static constexpr const char* magic = "RVRC1";
+
+    static std::string DefaultDirectory()
+    {
+        const char* dir = getenv("RISCV_SIM_CACHE_DIR");
+        if (dir && *dir)
+            return dir;
+        const char* home = getenv("HOME");
+        return std::string(home && *home ? home : "/tmp") + "/.cache/riscv_sim";
+    }
+
+    // 64-bit FNV-1a, continuing from `hash`
+    static uint64_t Hash(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325u)
+    {
+        const auto* bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++)
+            hash = (hash ^ bytes[i]) * 0x100000001b3u;
+        return hash;
+    }
+
+    static uint64_t BuildId()
+    {
+        static const uint64_t id = [] {
+            std::vector<char> exe = ReadFile("/proc/self/exe");
+            return Hash(exe.data(), exe.size());
+        }();
+        return id;
+    }
+
+    static std::string Key(const std::vector<char>& elf, const SimOptions& options, uint64_t buildId = BuildId())
+    {
+        std::string config = Describe(options);
+        uint64_t hash = Hash(elf.data(), elf.size());
+        hash = Hash(config.data(), config.size(), hash);
+        hash = Hash(&buildId, sizeof(buildId), hash);
+        char buf[17];
+        snprintf(buf, sizeof(buf), "%016" PRIx64, hash);
+        return buf;
+    }
+
+    explicit ResultCache(const std::string& dir = DefaultDirectory(), uint64_t buildId = BuildId())
+        : _dir(dir), _buildId(buildId), _random(std::random_device()())
+    {
+        std::error_code error;
+        std::filesystem::create_directories(_dir, error);
+    }
+
+    const std::string& Directory() const
+    {
+        return _dir;
+    }
+
+    // The share of hits to simulate again, 0 to 1
+    void SetVerifyRate(double rate)
+    {
+        _verifyRate = rate;
+    }
+
+    Stats GetStats() const
+    {
+        return {_hits.load(), _misses.load(), _verified.load(), _mismatches.load()};
+    }
+
+    void Report(std::ostream& out) const
+    {
+        Stats stats = GetStats();
+        char buf[512];
+        snprintf(buf, sizeof(buf), "Result cache %s: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " verified, %"
+                 PRIu64 " mismatched\n", _dir.c_str(), stats.hits, stats.misses, stats.verified, stats.mismatches);
+        out << buf;
+    }
+
+    std::optional<SimResult> Lookup(const std::string& key, const SimOptions& options) const
+    {
+        std::ifstream in(Path(key), std::ios::binary);
+        if (!in)
+            return std::nullopt;
+        std::string line;
+        if (!std::getline(in, line) || line != magic)
+            return std::nullopt;
+        SimResult r;
+        r.cached = true;
+        uint64_t outputSize = 0;
+        bool sameBuild = false;
+        bool sameConfig = false;
+        while (std::getline(in, line))
+        {
+            std::istringstream fields(line);
+            std::string name;
+            fields >> name;
+            if (name == "build")
+            {
+                uint64_t build = 0;
+                fields >> std::hex >> build;
+                sameBuild = build == _buildId;
+            }
+            else if (name == "config")
+                sameConfig = line.substr(name.size() + 1) == Describe(options);
+            else if (name == "status")
+            {
+                std::string status;
+                fields >> status;
+                size_t i = 0;
+                while (i < std::size(simStatusNames) && status != simStatusNames[i])
+                    i++;
+                if (i == std::size(simStatusNames))
+                    return std::nullopt;
+                r.status = SimStatus(i);
+            }
+            else if (name == "exit")
+                fields >> r.exitCode;
+            else if (name == "fault")
+                fields >> std::hex >> r.faultAddress;
+            else if (name == "cycles")
+                fields >> r.cycles;
+            else if (name == "instructions")
+                fields >> r.instructions;
+            else if (name == "icache")
+                fields >> r.codeStats.accesses >> r.codeStats.misses >> r.codeStats.lineCrossings;
+            else if (name == "dcache")
+                fields >> r.dataStats.accesses >> r.dataStats.misses >> r.dataStats.lineCrossings;
+            else if (name == "seconds")
+                fields >> r.seconds;
+            else if (name == "output")
+            {
+                fields >> outputSize;
+                break;
+            }
+            if (fields.fail())
+                return std::nullopt;
+        }
+        if (!sameBuild || !sameConfig || line.rfind("output", 0) != 0)
+            return std::nullopt;
+        r.output.resize(outputSize);
+        if (!in.read(r.output.data(), std::streamsize(outputSize)))
+            return std::nullopt;
+        return r;
+    }
+
+    void Store(const std::string& key, const SimOptions& options, const SimResult& r) const
+    {
+        if (r.status == SimStatus::TimeBudget || r.status == SimStatus::LoadError)
+            return;
+        std::string path = Path(key);
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+        std::string temp = path + ".tmp." + std::to_string(getpid()) + "." +
+                           std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        {
+            std::ofstream out(temp, std::ios::binary);
+            char buf[512];
+            snprintf(buf, sizeof(buf), "%s\nbuild %016" PRIx64 "\nconfig %s\nstatus %s\nexit %d\nfault %08x\ncycles %" PRIu64
+                     "\ninstructions %" PRIu64 "\nicache %" PRIu64 " %" PRIu64 " %" PRIu64 "\ndcache %" PRIu64
+                     " %" PRIu64 " %" PRIu64 "\nseconds %.6f\noutput %zu\n", magic, _buildId,
+                     Describe(options).c_str(), simStatusNames[size_t(r.status)], r.exitCode, r.faultAddress, r.cycles,
+                     r.instructions, r.codeStats.accesses, r.codeStats.misses, r.codeStats.lineCrossings,
+                     r.dataStats.accesses, r.dataStats.misses, r.dataStats.lineCrossings, r.seconds,
+                     r.output.size());
+            out << buf << r.output;
+            if (!out)
+            {
+                out.close();
+                std::filesystem::remove(temp, error);
+                return;
+            }
+        }
+        std::filesystem::rename(temp, path, error);
+        if (error)
+            std::filesystem::remove(temp, error);
+    }
+
+    // SimulateFile() through the cache
+    SimResult Simulate(const std::string& path, const SimOptions& options)
+    {
+        std::vector<char> elf = ReadFile(path);
+        if (elf.empty())
+            return SimulateFile(path, options);
+        std::string key = Key(elf, options, _buildId);
+        std::optional<SimResult> cached = Lookup(key, options);
+        if (cached && !DrawVerify())
+        {
+            _hits++;
+            return *cached;
+        }
+        SimResult r = SimulateFile(path, options);
+        if (!cached)
+        {
+            _misses++;
+            Store(key, options, r);
+            return r;
+        }
+        _hits++;
+        _verified++;
+        if (!SameResult(*cached, r))
+        {
+            _mismatches++;
+            fprintf(stderr, "WARNING: result cache entry %s for %s does not match a new simulation\n", key.c_str(),
+                    path.c_str());
+            Store(key, options, r);
+        }
+        return r;
+    }
+
+    // Everything simulated alike, the time taken aside
+    static bool SameResult(const SimResult& a, const SimResult& b)
+    {
+        return a.status == b.status && a.exitCode == b.exitCode && a.faultAddress == b.faultAddress &&
+               a.cycles == b.cycles &&
+               a.instructions == b.instructions && a.codeStats.accesses == b.codeStats.accesses &&
+               a.codeStats.misses == b.codeStats.misses && a.codeStats.lineCrossings == b.codeStats.lineCrossings &&
+               a.dataStats.accesses == b.dataStats.accesses && a.dataStats.misses == b.dataStats.misses &&
+               a.dataStats.lineCrossings == b.dataStats.lineCrossings && a.output == b.output;
+    }
+
+    static std::vector<char> ReadFile(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        return std::vector<char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    }
+
+private:
+
+    // Entries are spread over directories by the first two digits
+    std::string Path(const std::string& key) const
+    {
+        return _dir + "/" + key.substr(0, 2) + "/" + key.substr(2);
+    }
+
+    bool DrawVerify()
+    {
+        if (_verifyRate <= 0.0)
+            return false;
+        std::lock_guard<std::mutex> lock(_randomMutex);
+        return std::uniform_real_distribution<double>()(_random) < _verifyRate;
+    }
+
+    std::string _dir;
+    uint64_t _buildId;
+    double _verifyRate = 0.0;
+    std::mutex _randomMutex;
+    std::mt19937_64 _random;
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _misses{0};
+    std::atomic<uint64_t> _verified{0};
+    std::atomic<uint64_t> _mismatches{0};
+};
+
+#endif //RISCV_SIM_RESULTCACHE_H
@@ -0,0 +1,177 @@
+#ifndef RISCV_SIM_SIMULATION_H
+#define RISCV_SIM_SIMULATION_H
+
+#include "Cpu.h"
+#include "DecodedText.h"
+#include "Elf.h"
+#include "Memory.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+
+// One complete run of a program, start to exit, with its own storage and
+// core, so runs on different threads do not share anything. What the guest
+// prints is collected rather than written out.
+
+struct SimOptions
+{
+    MemModel memModel = MemModel::Cached;
+    TimingConfig timing;
+    CacheConfig cache;
+    bool predecode = true;
+    // the run is abandoned after this many cycles or wall-clock seconds;
+    // 0 for no limit
+    uint64_t maxCycles = 0;
+    double maxSeconds = 0.0;
+};
+
+enum class SimStatus
+{
+    // the guest exited with code 0
+    Passed,
+    // the guest exited with another code
+    Failed,
+    // the guest accessed memory outside the storage
+    Fault,
+    CycleBudget,
+    TimeBudget,
+    LoadError,
+};
+
+constexpr const char* simStatusNames[] = {"PASS", "FAIL", "FAULT", "CYCLES", "TIMEOUT", "NOLOAD"};
+
+struct SimResult
+{
+    SimStatus status = SimStatus::LoadError;
+    // the guest's exit code, if it exited
+    int exitCode = -1;
+    // the address of the access, with SimStatus::Fault
+    Word faultAddress = 0;
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    // zero with MemModel::Flat
+    CachedMem::CacheStats codeStats;
+    CachedMem::CacheStats dataStats;
+    double seconds = 0.0;
+    std::string output;
+    // looked up in a ResultCache rather than simulated; seconds are those
+    // of the run that was stored
+    bool cached = false;
+};
+
+// The cache parameters as one line of key=value pairs
+inline std::string Describe(const CacheConfig& cache)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "line=%zu dsets=%u dways=%u isets=%u iways=%u miss=%u hit=%u atomic=%u policy=%s "
+             "exact=%d", cache.lineBytes, cache.dataSets, cache.dataWays, cache.codeSets, cache.codeWays,
+             cache.missLatency, cache.hitLatency, cache.atomicLatency, replacementNames[size_t(cache.replacement)],
+             int(cache.exactLatency));
+    return buf;
+}
+
+// Everything in `options` that can change a result, as one line; the wall
+// clock budget is left out, since it depends on the host
+inline std::string Describe(const SimOptions& options)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "mem=%s predecode=%d mul=%u/%d div=%u/%d fusion=%d max-cycles=%lu ",
+             options.memModel == MemModel::Flat ? "flat" : "cached", int(options.predecode),
+             options.timing.mul.latency, int(options.timing.mul.pipelined), options.timing.div.latency,
+             int(options.timing.div.pipelined), int(options.timing.fusion), (unsigned long)options.maxCycles);
+    return buf + Describe(options.cache);
+}
+
+// Runs the program already in `mem` from 0x200; `text` may be null
+inline SimResult Simulate(MemoryStorage& mem, const DecodedText* text, const SimOptions& options = SimOptions())
+{
+    using Clock = std::chrono::steady_clock;
+    // how often the wall-clock budget is checked
+    static constexpr uint64_t chunkCycles = uint64_t(1) << 20u;
+    static constexpr uint64_t unlimited = std::numeric_limits<uint64_t>::max();
+
+    Clock::time_point start = Clock::now();
+    std::unique_ptr<ICpu> cpu = MakeCpu(options.memModel, mem, 0, options.timing, options.cache);
+    cpu->UsePredecoded(text);
+    cpu->Reset(0x200);
+
+    SimResult result;
+    int32_t printInt = 0;
+    while (true)
+    {
+        uint64_t budget = options.maxSeconds > 0.0 ? chunkCycles : unlimited;
+        if (options.maxCycles)
+        {
+            if (cpu->Cycles() >= options.maxCycles)
+            {
+                result.status = SimStatus::CycleBudget;
+                break;
+            }
+            budget = std::min(budget, options.maxCycles - cpu->Cycles());
+        }
+        StopReason stop = cpu->Run(budget, unlimited);
+        if (stop == StopReason::Budget)
+        {
+            if (options.maxSeconds > 0.0 &&
+                std::chrono::duration<double>(Clock::now() - start).count() >= options.maxSeconds)
+            {
+                result.status = SimStatus::TimeBudget;
+                break;
+            }
+            continue;
+        }
+        if (stop == StopReason::Fault)
+        {
+            result.status = SimStatus::Fault;
+            result.faultAddress = *cpu->FaultAddress();
+            break;
+        }
+        std::optional<CpuToHostData> msg = cpu->GetMessage();
+        auto type = msg.value().unpacked.type;
+        auto data = msg.value().unpacked.data;
+        if (type == CpuToHostType::ExitCode)
+        {
+            result.exitCode = data;
+            result.status = data == 0 ? SimStatus::Passed : SimStatus::Failed;
+            break;
+        }
+        else if (type == CpuToHostType::PrintChar)
+            result.output += char(data);
+        else if (type == CpuToHostType::PrintIntLow)
+            printInt = uint32_t(data);
+        else if (type == CpuToHostType::PrintIntHigh)
+        {
+            printInt |= uint32_t(data) << 16;
+            result.output += std::to_string(printInt);
+        }
+    }
+    result.cycles = cpu->Cycles();
+    result.instructions = cpu->Instructions();
+    if (const CachedMem* cache = cpu->Cache())
+    {
+        result.codeStats = cache->getCodeStats();
+        result.dataStats = cache->getDataStats();
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return result;
+}
+
+// Loads and runs the ELF file at `path`
+inline SimResult SimulateFile(const std::string& path, const SimOptions& options = SimOptions())
+{
+    MemoryStorage mem;
+    if (!mem.LoadElf(path))
+        return SimResult();
+    ElfFile elf;
+    std::optional<DecodedText> text;
+    if (options.predecode && elf.Load(path))
+        text.emplace(elf);
+    return Simulate(mem, text ? &*text : nullptr, options);
+}
+
+#endif //RISCV_SIM_SIMULATION_H
@@ -0,0 +1,101 @@
+#ifndef RISCV_SIM_WORKSTEALINGPOOL_H
+#define RISCV_SIM_WORKSTEALINGPOOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Runs a batch of independent tasks on a set of threads. The tasks are dealt
+// out round-robin to one queue per thread; a thread takes its own tasks from
+// the back of its queue and, once that is empty, steals from the front of
+// the others', so a thread that drew short tasks helps with the long ones.
+// Tasks are indices 0..count-1 into whatever the caller is working on.
+class WorkStealingPool
+{
+public:
+    static unsigned DefaultThreads()
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    explicit WorkStealingPool(unsigned threads = DefaultThreads())
+        : _threads(std::max(1u, threads))
+    {
+    }
+
+    unsigned Threads() const
+    {
+        return _threads;
+    }
+
+    // Calls task(i) once for every i < count, on up to Threads() threads,
+    // and returns when all calls have; `task` must be safe to call
+    // concurrently for different i
+    void Run(size_t count, const std::function<void(size_t)>& task)
+    {
+        unsigned workers = unsigned(std::min<size_t>(_threads, count));
+        if (workers == 0)
+            return;
+        std::vector<std::unique_ptr<Queue>> queues;
+        for (unsigned w = 0; w < workers; w++)
+            queues.push_back(std::make_unique<Queue>());
+        for (size_t i = 0; i < count; i++)
+            queues[i % workers]->tasks.push_back(i);
+
+        auto work = [&](unsigned self) {
+            while (std::optional<size_t> next = Take(queues, self))
+                task(*next);
+        };
+        std::vector<std::thread> threads;
+        for (unsigned w = 1; w < workers; w++)
+            threads.emplace_back(work, w);
+        work(0);
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    static std::optional<size_t> Take(std::vector<std::unique_ptr<Queue>>& queues, unsigned self)
+    {
+        {
+            Queue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                size_t task = own.tasks.back();
+                own.tasks.pop_back();
+                return task;
+            }
+        }
+        // no task is ever added once the batch runs, so a thread that finds
+        // every queue empty is done
+        for (size_t i = 1; i < queues.size(); i++)
+        {
+            Queue& victim = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                size_t task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return task;
+            }
+        }
+        return std::nullopt;
+    }
+
+    unsigned _threads;
+};
+
+#endif //RISCV_SIM_WORKSTEALINGPOOL_H
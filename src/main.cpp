@@ -1,30 +1,337 @@
 #include "Cpu.h"
 #include "Memory.h"
+#include "MultiHart.h"
+#include "DecodedText.h"
+#include "Elf.h"
+#include "HostProfile.h"
+#include "DataProfiler.h"
+#include "InstrMix.h"
+#include "IntervalStats.h"
+#include "LiveStats.h"
+#include "Profiler.h"
 #include "BaseTypes.h"
 
+#include <fstream>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <string>
+#include <vector>
 
-int main()
+static void PrintCacheStats(const CachedMem& cache)
 {
+    const CachedMem::CacheStats& code = cache.getCodeStats();
+    const CachedMem::CacheStats& data = cache.getDataStats();
+    fprintf(stderr, "I-cache: %lu fetches, %lu misses, %lu line crossings\n",
+            (unsigned long)code.accesses, (unsigned long)code.misses, (unsigned long)code.lineCrossings);
+    fprintf(stderr, "D-cache: %lu accesses, %lu misses\n",
+            (unsigned long)data.accesses, (unsigned long)data.misses);
+    Arena::Stats arena = cache.getArenaStats();
+    fprintf(stderr, "Cache arena: %lu KiB reserved, %lu KiB peak, %lu allocations (%lu reused)\n",
+            (unsigned long)arena.reservedBytes / 1024, (unsigned long)arena.peakBytes / 1024,
+            (unsigned long)arena.allocations, (unsigned long)arena.reused);
+}
+
+static void WriteProfile(const Profiler& profiler, bool report, const std::string& stacksFile)
+{
+    if (report)
+        profiler.Report(std::cerr);
+    if (stacksFile.empty())
+        return;
+    std::ofstream stacks(stacksFile);
+    if (!stacks)
+    {
+        fprintf(stderr, "ERROR: failed opening \"%s\"\n", stacksFile.c_str());
+        return;
+    }
+    profiler.WriteCollapsed(stacks);
+}
+
+static void PublishLiveStats(LiveStats& live, const ICpu& cpu, bool finished)
+{
+    if (!live.IsOpen())
+        return;
+    live.Set(LiveStats::Cycles, cpu.Cycles());
+    live.Set(LiveStats::Instructions, cpu.Instructions());
+    live.Set(LiveStats::Ip, cpu.Ip());
+    live.Set(LiveStats::Finished, finished);
+    if (const CachedMem* cache = cpu.Cache())
+    {
+        live.Set(LiveStats::ICacheAccesses, cache->getCodeStats().accesses);
+        live.Set(LiveStats::ICacheMisses, cache->getCodeStats().misses);
+        live.Set(LiveStats::DCacheAccesses, cache->getDataStats().accesses);
+        live.Set(LiveStats::DCacheMisses, cache->getDataStats().misses);
+    }
+    live.Publish();
+}
+
+// CSV, or the binary format for a file named *.bin
+static void WriteIntervals(const IntervalStats& intervals, const std::string& file)
+{
+    bool binary = file.size() > 4 && file.compare(file.size() - 4, 4, ".bin") == 0;
+    std::ofstream out(file, binary ? std::ios::binary : std::ios::out);
+    if (!out)
+    {
+        fprintf(stderr, "ERROR: failed opening \"%s\"\n", file.c_str());
+        return;
+    }
+    if (binary)
+        intervals.WriteBinary(out);
+    else
+        intervals.WriteCsv(out);
+}
+
+// With -harts, the harts run -quantum cycles at a time between barriers. An
+// SC or AMO is performed at the next barrier, so its cycles include the
+// wait for the end of the quantum as well as -atomic-latency; lock
+// timings with harts depend on the quantum.
+static int Usage()
+{
+    fprintf(stderr, "usage: riscv_sim [-harts n] [-quantum cycles] [-invalidation-latency cycles] "
+            "[-atomic-latency cycles] [-mul-latency cycles] [-mul-pipelined 0|1] [-div-latency cycles] [-div-pipelined 0|1] [-coherence] "
+            "[-stats] [-no-predecode] [-flat-mem] [-profile] [-profile-data] [-profile-stacks file] [-roi] "
+            "[-fusion] [-mix] [-intervals cycles] [-intervals-file file] [-live] [elf]\n"
+            "with -harts, an SC or AMO waits for the end of its -quantum, which its cycles include\n");
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    std::string elf = "program";
+    unsigned long harts = 1;
+    uint64_t quantum = 1000;
+    size_t invalidationLatency = MultiHart::defaultInvalidationLatency;
+    bool coherenceReport = false;
+    bool cacheStats = false;
+    bool predecode = true;
+    MemModel memModel = MemModel::Cached;
+    bool profile = false;
+    bool profileData = false;
+    bool roi = false;
+    bool mix = false;
+    uint64_t interval = 0;
+    std::string intervalsFile = "intervals.csv";
+    bool live = false;
+    std::string stacksFile;
+    TimingConfig timing;
+    CacheConfig cache;
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (arg == "-harts" && i + 1 < argc)
+                harts = std::stoul(argv[++i]);
+            else if (arg == "-quantum" && i + 1 < argc)
+                quantum = std::stoull(argv[++i]);
+            else if (arg == "-invalidation-latency" && i + 1 < argc)
+                invalidationLatency = std::stoul(argv[++i]);
+            else if (arg == "-atomic-latency" && i + 1 < argc)
+                cache.atomicLatency = std::stoul(argv[++i]);
+            else if (arg == "-mul-latency" && i + 1 < argc)
+                timing.mul.latency = std::stoul(argv[++i]);
+            else if (arg == "-mul-pipelined" && i + 1 < argc)
+                timing.mul.pipelined = std::stoul(argv[++i]) != 0;
+            else if (arg == "-div-latency" && i + 1 < argc)
+                timing.div.latency = std::stoul(argv[++i]);
+            else if (arg == "-div-pipelined" && i + 1 < argc)
+                timing.div.pipelined = std::stoul(argv[++i]) != 0;
+            else if (arg == "-coherence")
+                coherenceReport = true;
+            else if (arg == "-stats")
+                cacheStats = true;
+            else if (arg == "-no-predecode")
+                predecode = false;
+            else if (arg == "-flat-mem")
+                memModel = MemModel::Flat;
+            else if (arg == "-profile")
+                profile = true;
+            else if (arg == "-profile-data")
+                profileData = true;
+            else if (arg == "-profile-stacks" && i + 1 < argc)
+                stacksFile = argv[++i];
+            else if (arg == "-roi")
+                roi = true;
+            else if (arg == "-fusion")
+                timing.fusion = true;
+            else if (arg == "-mix")
+                mix = true;
+            else if (arg == "-intervals" && i + 1 < argc)
+                interval = std::stoull(argv[++i]);
+            else if (arg == "-intervals-file" && i + 1 < argc)
+                intervalsFile = argv[++i];
+            else if (arg == "-live")
+                live = true;
+            else if (!arg.empty() && arg[0] != '-')
+                elf = arg;
+            else
+                return Usage();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "ERROR: %s\n", e.what());
+        return Usage();
+    }
+    if (harts < 1 || harts > CoherenceDirectory::maxHarts)
+    {
+        fprintf(stderr, "ERROR: -harts must be between 1 and %u\n", CoherenceDirectory::maxHarts);
+        return 2;
+    }
+    if (quantum < 1)
+    {
+        fprintf(stderr, "ERROR: -quantum must be at least 1\n");
+        return 2;
+    }
+
     MemoryStorage mem ;
-    mem.LoadElf("program");
-    std::unique_ptr<IMem> memModelPtr(new CachedMem(mem));
-    Cpu cpu{*memModelPtr};
-    cpu.Reset(0x200);
+    if (!mem.LoadElf(elf))
+        return 1;
+
+    std::optional<DecodedText> text;
+    ElfFile elfFile;
+    bool elfLoaded = (predecode || profile || profileData || !stacksFile.empty()) && elfFile.Load(elf);
+    if (predecode && elfLoaded)
+        text.emplace(elfFile);
+    const DecodedText* decoded = text ? &*text : nullptr;
+
+    if (harts > 1)
+    {
+        if (memModel != MemModel::Cached)
+            fprintf(stderr, "WARNING: -flat-mem is ignored with -harts\n");
+        if (profile || profileData || !stacksFile.empty())
+            fprintf(stderr, "WARNING: profiling is not supported with -harts\n");
+        if (roi)
+            fprintf(stderr, "WARNING: -roi is ignored with -harts\n");
+        if (mix)
+            fprintf(stderr, "WARNING: -mix is ignored with -harts\n");
+        if (interval)
+            fprintf(stderr, "WARNING: -intervals is ignored with -harts\n");
+        if (live)
+            fprintf(stderr, "WARNING: -live is ignored with -harts\n");
+#ifdef RISCV_SIM_HOST_PROFILE
+        fprintf(stderr, "WARNING: the host profile is not reported with -harts\n");
+#endif
+        MultiHart system(mem, harts, quantum, timing, invalidationLatency, cache);
+        system.UsePredecoded(decoded);
+        system.Reset(0x200);
+
+        int exitCode = 0;
+        std::vector<int32_t> print_int(harts, 0);
+        system.Run([&](Word hartId, CpuToHostData msg) {
+            auto type = msg.unpacked.type;
+            auto data = msg.unpacked.data;
+
+            if(type == CpuToHostType::ExitCode) {
+                // the run ends with hart 0, the others just park
+                if(hartId != 0)
+                    return true;
+                if(data == 0) {
+                    fprintf(stderr, "PASSED\n");
+                } else {
+                    fprintf(stderr, "FAILED: exit code = %d\n", data);
+                }
+                exitCode = data;
+                return false;
+            } else if(type == CpuToHostType::PrintChar) {
+                fprintf(stderr, "%c", (char)data);
+            } else if(type == CpuToHostType::PrintIntLow) {
+                print_int[hartId] = uint32_t(data);
+            } else if(type == CpuToHostType::PrintIntHigh) {
+                print_int[hartId] |= uint32_t(data) << 16;
+                fprintf(stderr, "%d", print_int[hartId]);
+            }
+            return true;
+        });
+        if (coherenceReport)
+            system.Coherence().Report(std::cerr, 16);
+        if (std::optional<Word> fault = mem.FaultAddress())
+        {
+            fprintf(stderr, "FAILED: access outside memory at 0x%08x\n", *fault);
+            return 1;
+        }
+        return exitCode;
+    }
 
+    std::unique_ptr<ICpu> cpu = MakeCpu(memModel, mem, 0, timing, cache);
+    cpu->UsePredecoded(decoded);
+    if (roi)
+        cpu->UseRoi();
+    std::optional<Profiler> profiler;
+    std::optional<DataProfiler> dataProfiler;
+    if ((profile || profileData || !stacksFile.empty()) && elfLoaded)
+    {
+        profiler.emplace(elfFile, cpu->Cache());
+        cpu->UseProfiler(&*profiler);
+    }
+    if (profileData && profiler)
+    {
+        dataProfiler.emplace(elfFile);
+        profiler->UseDataProfiler(&*dataProfiler);
+    }
+    std::optional<InstrMix> instrMix;
+    if (mix)
+    {
+        instrMix.emplace();
+        cpu->UseInstrMix(&*instrMix);
+    }
+    std::optional<IntervalStats> intervals;
+    if (interval)
+    {
+        intervals.emplace(interval, size_t(1u << 16u),
+                          cpu->Cache() ? cpu->Cache()->getConfig().lineBytes : CacheConfig().lineBytes);
+        cpu->UseIntervals(&*intervals);
+    }
+    LiveStats liveStats;
+    if (live && !liveStats.Open(elf))
+        fprintf(stderr, "ERROR: failed creating \"%s\"\n", liveStats.Path().c_str());
+    cpu->Reset(0x200);
+
+#ifdef RISCV_SIM_HOST_PROFILE
+    HostProfiler::Instance().Start();
+#endif
     int32_t print_int = 0;
     while (true)
     {
-        cpu.Clock();
-        memModelPtr->Clock();
-        std::optional<CpuToHostData> msg = cpu.GetMessage();
-        if (!msg)
+        uint64_t unlimited = std::numeric_limits<uint64_t>::max();
+        // publish the live statistics every so many cycles
+        StopReason stop = cpu->Run(liveStats.IsOpen() ? 1u << 18u : unlimited, unlimited);
+        PublishLiveStats(liveStats, *cpu, stop == StopReason::Exit);
+        if (stop == StopReason::Budget)
             continue;
+        if (stop == StopReason::Fault)
+        {
+            fprintf(stderr, "FAILED: access outside memory at 0x%08x\n", *cpu->FaultAddress());
+            return 1;
+        }
+        std::optional<CpuToHostData> msg = cpu->GetMessage();
 
         auto type = msg.value().unpacked.type;
         auto data = msg.value().unpacked.data;
 
         if(type == CpuToHostType::ExitCode) {
+#ifdef RISCV_SIM_HOST_PROFILE
+            HostProfiler::Instance().Stop();
+            HostProfiler::Instance().Report(std::cerr, cpu->Instructions());
+#endif
+            if (cacheStats)
+            {
+                if (cpu->Cache())
+                    PrintCacheStats(*cpu->Cache());
+                if (timing.fusion)
+                    fprintf(stderr, "Fused pairs: %lu\n", (unsigned long)cpu->FusedPairs());
+            }
+            if (profiler)
+                WriteProfile(*profiler, profile, stacksFile);
+            if (dataProfiler)
+                dataProfiler->Report(std::cerr);
+            if (instrMix)
+                instrMix->Report(std::cerr);
+            if (intervals)
+            {
+                cpu->SampleIntervals();
+                WriteIntervals(*intervals, intervalsFile);
+            }
             if(data == 0) {
                 fprintf(stderr, "PASSED\n");
                 return 0;
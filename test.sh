@@ -1,7 +1,15 @@
 #!/bin/bash
+# usage: test.sh <path to riscv_run>
+# The argument used to be riscv_sim; the tests now run through tools/riscv_run.
 
 exe_file=$1;
 
+if [ "$(basename "${exe_file}")" != riscv_run ] || [ ! -x "${exe_file}" ]; then
+    echo "ERROR: expected the path to the riscv_run executable, got \"${exe_file}\"" >&2
+    echo "usage: $0 <path to riscv_run>" >&2
+    exit 2
+fi
+
 if [ -z $testResponse ]; then
     echo "What would you program would you like to run?"
     echo "1) asm tests"
@@ -50,27 +58,9 @@ case $testResponse in
     *)  echo "ERROR: Unexpected response: $response" ; exit ;;
 esac
 
-SOFTWARE_SOCKET_NAME=/tmp/connectal$USER
-export SOFTWARE_SOCKET_NAME
-
-log_dir=logs
-wait_time=3
-
-# create bsim log dir
-mkdir -p ${log_dir}
-
-# run each test
+# run every test in one process, in parallel
+programs=()
 for test_name in ${asm_tests[@]}; do
-	echo "-- benchmark test: ${test_name} --"
-	# copy vmh file
-	mem_file=${vmh_dir}/${test_name}.riscv
-	if [ ! -f $mem_file ]; then
-		echo "ERROR: $mem_file does not exit, you need to first compile"
-		exit
-	fi
-    ln -sf ${mem_file} program 
-
-	# run test
-    ${exe_file} > ${log_dir}/${test_name}.log  # run bsim, redirect outputs to log
-    sleep ${wait_time} # wait bsim to setup
+	programs+=(${vmh_dir}/${test_name}.riscv)
 done
+${exe_file} -output ${programs[@]}
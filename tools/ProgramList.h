@@ -0,0 +1,39 @@
+#ifndef RISCV_SIM_PROGRAMLIST_H
+#define RISCV_SIM_PROGRAMLIST_H
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <glob.h>
+
+// Adds the programs `arg` names to `programs`: an ELF file, a directory,
+// searched for *.riscv files, or a glob pattern
+inline void AddPrograms(const std::string& arg, std::vector<std::string>& programs)
+{
+    std::error_code error;
+    if (std::filesystem::is_directory(arg, error))
+    {
+        std::vector<std::string> found;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(arg, error))
+        {
+            if (entry.is_regular_file() && entry.path().extension() == ".riscv")
+                found.push_back(entry.path().string());
+        }
+        std::sort(found.begin(), found.end());
+        programs.insert(programs.end(), found.begin(), found.end());
+        return;
+    }
+    glob_t matches{};
+    // a name without wildcards that does not exist is kept, to be
+    // reported as not loading
+    if (glob(arg.c_str(), GLOB_NOCHECK, nullptr, &matches) == 0)
+    {
+        for (size_t i = 0; i < matches.gl_pathc; i++)
+            programs.emplace_back(matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+}
+
+#endif //RISCV_SIM_PROGRAMLIST_H
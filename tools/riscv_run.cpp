@@ -0,0 +1,105 @@
+#include "../src/ResultCache.h"
+#include "../src/Simulation.h"
+#include "../src/WorkStealingPool.h"
+#include "ProgramList.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Runs a set of test programs in one process, in parallel, each on its own
+// storage and core, and reports for each whether it passed, its exit code
+// and its cycles. Arguments are ELF files, directories, searched for
+// *.riscv files, or glob patterns. A program that has not exited within
+// -max-cycles cycles or -max-time seconds counts as failed. Exits with 1
+// if any program did not pass. With -cache, or -cache-dir, results are
+// looked up in and added to a ResultCache; -verify-sample simulates that
+// share of the hits again.
+// usage: riscv_run [-jobs n] [-max-cycles n] [-max-time seconds] [-flat-mem] [-no-predecode]
+//                  [-output] [-cache] [-cache-dir dir] [-verify-sample fraction] <elf | dir | glob>...
+
+static int Usage()
+{
+    fprintf(stderr, "usage: riscv_run [-jobs n] [-max-cycles n] [-max-time seconds] [-flat-mem] "
+            "[-no-predecode] [-output] [-cache] [-cache-dir dir] [-verify-sample fraction] <elf | dir | glob>...\n");
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    SimOptions options;
+    unsigned jobs = WorkStealingPool::DefaultThreads();
+    bool printOutput = false;
+    std::string cacheDir;
+    double verifyRate = 0.0;
+    std::vector<std::string> programs;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-jobs" && i + 1 < argc)
+            jobs = std::stoul(argv[++i]);
+        else if (arg == "-max-cycles" && i + 1 < argc)
+            options.maxCycles = std::stoull(argv[++i]);
+        else if (arg == "-max-time" && i + 1 < argc)
+            options.maxSeconds = std::stod(argv[++i]);
+        else if (arg == "-flat-mem")
+            options.memModel = MemModel::Flat;
+        else if (arg == "-no-predecode")
+            options.predecode = false;
+        else if (arg == "-output")
+            printOutput = true;
+        else if (arg == "-cache")
+            cacheDir = ResultCache::DefaultDirectory();
+        else if (arg == "-cache-dir" && i + 1 < argc)
+            cacheDir = argv[++i];
+        else if (arg == "-verify-sample" && i + 1 < argc)
+            verifyRate = std::stod(argv[++i]);
+        else if (!arg.empty() && arg[0] != '-')
+            AddPrograms(arg, programs);
+        else
+            return Usage();
+    }
+    if (programs.empty())
+        return Usage();
+
+    std::unique_ptr<ResultCache> cache;
+    if (!cacheDir.empty())
+    {
+        cache = std::make_unique<ResultCache>(cacheDir);
+        cache->SetVerifyRate(verifyRate);
+    }
+
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start = Clock::now();
+    std::vector<SimResult> results(programs.size());
+    WorkStealingPool pool(jobs);
+    pool.Run(programs.size(), [&](size_t i) {
+        results[i] = cache ? cache->Simulate(programs[i], options) : SimulateFile(programs[i], options);
+    });
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    size_t passed = 0;
+    printf("%-7s %4s %12s %12s %9s  %s\n", "result", "exit", "cycles", "instret", "seconds", "program");
+    for (size_t i = 0; i < programs.size(); i++)
+    {
+        const SimResult& r = results[i];
+        passed += r.status == SimStatus::Passed;
+        printf("%-7s %4d %12lu %12lu %9.3f  %s%s", simStatusNames[size_t(r.status)], r.exitCode,
+               (unsigned long)r.cycles, (unsigned long)r.instructions, r.seconds, programs[i].c_str(),
+               r.cached ? " (cached)" : "");
+        if (r.status == SimStatus::Fault)
+            printf(" (access outside memory at 0x%08x)", r.faultAddress);
+        printf("\n");
+        if (printOutput && !r.output.empty())
+            printf("%s%s", r.output.c_str(), r.output.back() == '\n' ? "" : "\n");
+    }
+    printf("%zu of %zu passed in %.2f s on %u threads\n", passed, programs.size(), seconds,
+           std::min<unsigned>(pool.Threads(), unsigned(programs.size())));
+    if (cache)
+        cache->Report(std::cout);
+    return passed == programs.size() ? 0 : 1;
+}
@@ -0,0 +1,388 @@
+#include "../src/ResultCache.h"
+#include "../src/Simulation.h"
+#include "../src/WorkStealingPool.h"
+#include "ProgramList.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Design-space exploration of the caches. Every parameter takes a comma
+// separated list of values; every combination of them is built and each
+// program is simulated on it, in parallel. The result is one row per
+// configuration with the cycles and instructions summed over the programs
+// and the miss rates of both caches over all their accesses. Every point
+// finished is appended to a journal; a sweep started again with the same
+// journal only runs the points missing from it, so an interrupted sweep
+// resumes and a grid can be widened without redoing what is known. A point
+// is journaled under Describe(SimOptions), the program and a hash of its
+// ELF file and of the simulator binary, so changing any option, the
+// program or the simulator runs it again. Points cut off by -max-time are
+// not journaled, since they depend on the host.
+// -cache, -cache-dir and -verify-sample use a ResultCache as riscv_run
+// does, which lets different sweeps share their points.
+// usage: riscv_sweep [-line list] [-sets list] [-ways list] [-code-sets list] [-code-ways list]
+//                    [-miss-latency list] [-hit-latency list] [-policy lru,fifo,random]
+//                    [-exact-latency 0,1] [-jobs n] [-max-cycles n] [-max-time seconds]
+//                    [-journal file] [-csv file] [-cache] [-cache-dir dir]
+//                    [-verify-sample fraction] <elf | dir | glob>...
+
+static int Usage()
+{
+    fprintf(stderr, "usage: riscv_sweep [-line list] [-sets list] [-ways list] [-code-sets list] [-code-ways list] "
+            "[-miss-latency list] [-hit-latency list] [-policy lru,fifo,random] [-exact-latency 0,1] [-jobs n] "
+            "[-max-cycles n] [-max-time seconds] [-journal file] [-csv file] [-cache] [-cache-dir dir] "
+            "[-verify-sample fraction] <elf | dir | glob>...\n");
+    return 2;
+}
+
+static std::vector<std::string> Split(const std::string& text, char separator)
+{
+    std::vector<std::string> parts;
+    std::stringstream in(text);
+    std::string part;
+    while (std::getline(in, part, separator))
+        parts.push_back(part);
+    return parts;
+}
+
+static std::vector<unsigned> ParseList(const std::string& text)
+{
+    std::vector<unsigned> values;
+    for (const std::string& value : Split(text, ','))
+        values.push_back(std::stoul(value));
+    return values;
+}
+
+static std::vector<Replacement> ParsePolicies(const std::string& text)
+{
+    std::vector<Replacement> policies;
+    for (const std::string& name : Split(text, ','))
+    {
+        size_t i = 0;
+        while (i < std::size(replacementNames) && name != replacementNames[i])
+            i++;
+        if (i == std::size(replacementNames))
+            throw std::invalid_argument("unknown policy " + name);
+        policies.push_back(Replacement(i));
+    }
+    return policies;
+}
+
+struct Grid
+{
+    std::vector<unsigned> lineBytes{unsigned(CacheConfig().lineBytes)};
+    std::vector<unsigned> dataSets{CacheConfig().dataSets};
+    std::vector<unsigned> dataWays{CacheConfig().dataWays};
+    std::vector<unsigned> codeSets{CacheConfig().codeSets};
+    std::vector<unsigned> codeWays{CacheConfig().codeWays};
+    std::vector<unsigned> missLatency{CacheConfig().missLatency};
+    std::vector<unsigned> hitLatency{CacheConfig().hitLatency};
+    std::vector<Replacement> replacement{CacheConfig().replacement};
+    std::vector<unsigned> exactLatency{CacheConfig().exactLatency};
+
+    // Every valid combination, the first parameter varying slowest
+    std::vector<CacheConfig> Configs() const
+    {
+        std::vector<CacheConfig> configs(1);
+        auto expand = [&](const auto& values, auto set) {
+            std::vector<CacheConfig> expanded;
+            for (const CacheConfig& config : configs)
+            {
+                for (const auto& value : values)
+                {
+                    expanded.push_back(config);
+                    set(expanded.back(), value);
+                }
+            }
+            configs = expanded;
+        };
+        expand(lineBytes, [](CacheConfig& c, unsigned v) { c.lineBytes = v; });
+        expand(dataSets, [](CacheConfig& c, unsigned v) { c.dataSets = v; });
+        expand(dataWays, [](CacheConfig& c, unsigned v) { c.dataWays = v; });
+        expand(codeSets, [](CacheConfig& c, unsigned v) { c.codeSets = v; });
+        expand(codeWays, [](CacheConfig& c, unsigned v) { c.codeWays = v; });
+        expand(missLatency, [](CacheConfig& c, unsigned v) { c.missLatency = v; });
+        expand(hitLatency, [](CacheConfig& c, unsigned v) { c.hitLatency = v; });
+        expand(replacement, [](CacheConfig& c, Replacement v) { c.replacement = v; });
+        expand(exactLatency, [](CacheConfig& c, unsigned v) { c.exactLatency = v != 0; });
+
+        std::vector<CacheConfig> valid;
+        for (const CacheConfig& config : configs)
+        {
+            if (config.IsValid())
+                valid.push_back(config);
+            else
+                fprintf(stderr, "WARNING: skipping invalid configuration %s\n", Describe(config).c_str());
+        }
+        return valid;
+    }
+};
+
+// What the journal keeps of a point
+struct Point
+{
+    SimStatus status = SimStatus::LoadError;
+    int exitCode = -1;
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t codeAccesses = 0;
+    uint64_t codeMisses = 0;
+    uint64_t dataAccesses = 0;
+    uint64_t dataMisses = 0;
+};
+
+// A hash of the program's ELF file and of the simulator binary
+static std::string ProgramVersion(const std::string& program)
+{
+    std::vector<char> elf = ResultCache::ReadFile(program);
+    uint64_t buildId = ResultCache::BuildId();
+    uint64_t hash = ResultCache::Hash(&buildId, sizeof(buildId), ResultCache::Hash(elf.data(), elf.size()));
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016" PRIx64, hash);
+    return buf;
+}
+
+static std::string PointKey(const SimOptions& options, const std::string& program, const std::string& version)
+{
+    return Describe(options) + "\t" + program + "\t" + version;
+}
+
+// One point per line: options, program, program version, status, exit
+// code, cycles, instructions, I-cache accesses and misses, D-cache accesses
+// and misses, separated by tabs. A line cut short by an interrupted write,
+// or one in an older format, is skipped.
+static std::map<std::string, Point> ReadJournal(const std::string& file)
+{
+    std::map<std::string, Point> points;
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::vector<std::string> fields = Split(line, '\t');
+        if (fields.size() != 11)
+            continue;
+        Point p;
+        size_t status = 0;
+        while (status < std::size(simStatusNames) && fields[3] != simStatusNames[status])
+            status++;
+        if (status == std::size(simStatusNames))
+            continue;
+        p.status = SimStatus(status);
+        try
+        {
+            p.exitCode = std::stoi(fields[4]);
+            p.cycles = std::stoull(fields[5]);
+            p.instructions = std::stoull(fields[6]);
+            p.codeAccesses = std::stoull(fields[7]);
+            p.codeMisses = std::stoull(fields[8]);
+            p.dataAccesses = std::stoull(fields[9]);
+            p.dataMisses = std::stoull(fields[10]);
+        }
+        catch (const std::exception&)
+        {
+            continue;
+        }
+        points[fields[0] + "\t" + fields[1] + "\t" + fields[2]] = p;
+    }
+    return points;
+}
+
+static void WriteJournal(std::ofstream& out, const std::string& key, const Point& p)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "\t%s\t%d\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\n", simStatusNames[size_t(p.status)],
+             p.exitCode, (unsigned long)p.cycles, (unsigned long)p.instructions, (unsigned long)p.codeAccesses,
+             (unsigned long)p.codeMisses, (unsigned long)p.dataAccesses, (unsigned long)p.dataMisses);
+    out << key << buf;
+    out.flush();
+}
+
+// A configuration's points, summed
+struct Row
+{
+    size_t passed = 0;
+    size_t missing = 0;
+    Point total;
+};
+
+static double Percent(uint64_t part, uint64_t whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+int main(int argc, char** argv)
+{
+    Grid grid;
+    SimOptions options;
+    unsigned jobs = WorkStealingPool::DefaultThreads();
+    std::string journalFile = "sweep.journal";
+    std::string csvFile;
+    std::string cacheDir;
+    double verifyRate = 0.0;
+    std::vector<std::string> programs;
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "-line" && hasValue)
+                grid.lineBytes = ParseList(argv[++i]);
+            else if (arg == "-sets" && hasValue)
+                grid.dataSets = ParseList(argv[++i]);
+            else if (arg == "-ways" && hasValue)
+                grid.dataWays = ParseList(argv[++i]);
+            else if (arg == "-code-sets" && hasValue)
+                grid.codeSets = ParseList(argv[++i]);
+            else if (arg == "-code-ways" && hasValue)
+                grid.codeWays = ParseList(argv[++i]);
+            else if (arg == "-miss-latency" && hasValue)
+                grid.missLatency = ParseList(argv[++i]);
+            else if (arg == "-hit-latency" && hasValue)
+                grid.hitLatency = ParseList(argv[++i]);
+            else if (arg == "-policy" && hasValue)
+                grid.replacement = ParsePolicies(argv[++i]);
+            else if (arg == "-exact-latency" && hasValue)
+                grid.exactLatency = ParseList(argv[++i]);
+            else if (arg == "-jobs" && hasValue)
+                jobs = std::stoul(argv[++i]);
+            else if (arg == "-max-cycles" && hasValue)
+                options.maxCycles = std::stoull(argv[++i]);
+            else if (arg == "-max-time" && hasValue)
+                options.maxSeconds = std::stod(argv[++i]);
+            else if (arg == "-journal" && hasValue)
+                journalFile = argv[++i];
+            else if (arg == "-csv" && hasValue)
+                csvFile = argv[++i];
+            else if (arg == "-cache")
+                cacheDir = ResultCache::DefaultDirectory();
+            else if (arg == "-cache-dir" && hasValue)
+                cacheDir = argv[++i];
+            else if (arg == "-verify-sample" && hasValue)
+                verifyRate = std::stod(argv[++i]);
+            else if (!arg.empty() && arg[0] != '-')
+                AddPrograms(arg, programs);
+            else
+                return Usage();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "ERROR: %s\n", e.what());
+        return Usage();
+    }
+    std::vector<CacheConfig> configs = grid.Configs();
+    if (programs.empty() || configs.empty())
+        return Usage();
+
+    // the options of every configuration, and the version of every program
+    std::vector<SimOptions> configOptions(configs.size(), options);
+    for (size_t c = 0; c < configs.size(); c++)
+        configOptions[c].cache = configs[c];
+    std::vector<std::string> versions;
+    for (const std::string& program : programs)
+        versions.push_back(ProgramVersion(program));
+
+    std::map<std::string, Point> points = ReadJournal(journalFile);
+    std::vector<std::pair<size_t, size_t>> todo;
+    for (size_t c = 0; c < configs.size(); c++)
+    {
+        for (size_t p = 0; p < programs.size(); p++)
+        {
+            if (!points.count(PointKey(configOptions[c], programs[p], versions[p])))
+                todo.emplace_back(c, p);
+        }
+    }
+    fprintf(stderr, "%zu configurations x %zu programs: %zu points journaled in %s, %zu to run\n", configs.size(),
+            programs.size(), configs.size() * programs.size() - todo.size(), journalFile.c_str(), todo.size());
+
+    std::ofstream journal(journalFile, std::ios::app);
+    if (!journal)
+    {
+        fprintf(stderr, "ERROR: failed opening \"%s\"\n", journalFile.c_str());
+        return 1;
+    }
+    std::unique_ptr<ResultCache> cache;
+    if (!cacheDir.empty())
+    {
+        cache = std::make_unique<ResultCache>(cacheDir);
+        cache->SetVerifyRate(verifyRate);
+    }
+    std::mutex mutex;
+    WorkStealingPool pool(jobs);
+    pool.Run(todo.size(), [&](size_t i) {
+        auto [c, p] = todo[i];
+        const SimOptions& pointOptions = configOptions[c];
+        SimResult r = cache ? cache->Simulate(programs[p], pointOptions) : SimulateFile(programs[p], pointOptions);
+        Point point{r.status, r.exitCode, r.cycles, r.instructions, r.codeStats.accesses, r.codeStats.misses,
+                    r.dataStats.accesses, r.dataStats.misses};
+        std::string key = PointKey(pointOptions, programs[p], versions[p]);
+        std::lock_guard<std::mutex> lock(mutex);
+        points[key] = point;
+        if (r.status != SimStatus::TimeBudget)
+            WriteJournal(journal, key, point);
+    });
+
+    std::ofstream csv;
+    if (!csvFile.empty())
+    {
+        csv.open(csvFile);
+        csv << "line,dsets,dways,isets,iways,miss,hit,policy,exact,passed,programs,cycles,instructions,ipc,"
+               "icache_miss_pct,dcache_miss_pct\n";
+    }
+    printf("%5s %5s %5s %5s %5s %5s %4s %-6s %5s %7s %14s %14s %6s %7s %7s\n", "line", "dsets", "dways", "isets",
+           "iways", "miss", "hit", "policy", "exact", "passed", "cycles", "instret", "IPC", "I-miss", "D-miss");
+    for (size_t c = 0; c < configs.size(); c++)
+    {
+        const CacheConfig& config = configs[c];
+        Row row;
+        for (size_t i = 0; i < programs.size(); i++)
+        {
+            auto it = points.find(PointKey(configOptions[c], programs[i], versions[i]));
+            if (it == points.end())
+            {
+                row.missing++;
+                continue;
+            }
+            const Point& p = it->second;
+            row.passed += p.status == SimStatus::Passed;
+            row.total.cycles += p.cycles;
+            row.total.instructions += p.instructions;
+            row.total.codeAccesses += p.codeAccesses;
+            row.total.codeMisses += p.codeMisses;
+            row.total.dataAccesses += p.dataAccesses;
+            row.total.dataMisses += p.dataMisses;
+        }
+        const Point& t = row.total;
+        double ipc = t.cycles ? double(t.instructions) / t.cycles : 0.0;
+        char passed[32];
+        snprintf(passed, sizeof(passed), "%zu/%zu", row.passed, programs.size());
+        printf("%5zu %5u %5u %5u %5u %5u %4u %-6s %5d %7s %14lu %14lu %6.3f %6.2f%% %6.2f%%\n", config.lineBytes,
+               config.dataSets, config.dataWays, config.codeSets, config.codeWays, config.missLatency,
+               config.hitLatency, replacementNames[size_t(config.replacement)], int(config.exactLatency), passed,
+               (unsigned long)t.cycles, (unsigned long)t.instructions, ipc, Percent(t.codeMisses, t.codeAccesses),
+               Percent(t.dataMisses, t.dataAccesses));
+        if (csv.is_open())
+        {
+            char buf[512];
+            snprintf(buf, sizeof(buf), "%zu,%u,%u,%u,%u,%u,%u,%s,%d,%zu,%zu,%lu,%lu,%.4f,%.4f,%.4f\n",
+                     config.lineBytes, config.dataSets, config.dataWays, config.codeSets, config.codeWays,
+                     config.missLatency, config.hitLatency, replacementNames[size_t(config.replacement)],
+                     int(config.exactLatency), row.passed, programs.size(), (unsigned long)t.cycles,
+                     (unsigned long)t.instructions, ipc, Percent(t.codeMisses, t.codeAccesses),
+                     Percent(t.dataMisses, t.dataAccesses));
+            csv << buf;
+        }
+    }
+    if (cache)
+        cache->Report(std::cerr);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "../src/LiveStats.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+// Shows the live statistics of every simulation on this machine started
+// with -live, refreshing them until interrupted. MIPS is given over the
+// whole run and over the last refresh.
+// usage: riscv_top [-once] [-interval <seconds>]
+
+struct Simulation
+{
+    std::string program;
+    uint64_t values[LiveStats::FieldCount];
+    bool alive;
+};
+
+static bool ReadSimulation(const std::string& path, Simulation& sim)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    void* mapping = MAP_FAILED;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(LiveStats::Segment))
+        mapping = mmap(nullptr, sizeof(LiveStats::Segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+    const auto& segment = *static_cast<const LiveStats::Segment*>(mapping);
+    bool ok = memcmp(segment.magic, LiveStats::magic, sizeof(LiveStats::magic)) == 0 &&
+              LiveStats::Read(segment, sim.values);
+    if (ok)
+    {
+        sim.program = std::string(segment.program, strnlen(segment.program, sizeof(segment.program)));
+        sim.program = std::filesystem::path(sim.program).filename().string();
+        // a file left behind by a simulation that crashed
+        sim.alive = kill(pid_t(sim.values[LiveStats::Pid]), 0) == 0 || errno == EPERM;
+    }
+    munmap(mapping, sizeof(LiveStats::Segment));
+    return ok;
+}
+
+static std::vector<Simulation> ReadAll()
+{
+    std::vector<Simulation> sims;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(LiveStats::Directory(), error))
+    {
+        if (entry.path().filename().string().rfind(LiveStats::filePrefix, 0) != 0)
+            continue;
+        Simulation sim;
+        if (ReadSimulation(entry.path().string(), sim))
+            sims.push_back(sim);
+    }
+    std::sort(sims.begin(), sims.end(), [](const Simulation& a, const Simulation& b) {
+        return a.values[LiveStats::Pid] < b.values[LiveStats::Pid];
+    });
+    return sims;
+}
+
+static double Percent(uint64_t part, uint64_t whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void Print(const std::vector<Simulation>& sims, std::map<uint64_t, Simulation>& previous)
+{
+    printf("%8s %-20s %-8s %14s %14s %8s %8s %5s %7s %7s %10s %9s\n", "pid", "program", "state", "cycles",
+           "instret", "MIPS", "now", "IPC", "I-miss", "D-miss", "pc", "elapsed");
+    for (const Simulation& sim : sims)
+    {
+        const uint64_t* v = sim.values;
+        double recent = 0.0;
+        auto it = previous.find(v[LiveStats::Pid]);
+        if (it != previous.end() && v[LiveStats::UpdateNs] > it->second.values[LiveStats::UpdateNs])
+        {
+            recent = 1e3 * (v[LiveStats::Instructions] - it->second.values[LiveStats::Instructions]) /
+                     (v[LiveStats::UpdateNs] - it->second.values[LiveStats::UpdateNs]);
+        }
+        const char* state = v[LiveStats::Finished] ? "exited" : sim.alive ? "running" : "dead";
+        printf("%8" PRIu64 " %-20.20s %-8s %14" PRIu64 " %14" PRIu64 " %8.2f %8.2f %5.2f %6.2f%% %6.2f%% %#10" PRIx64
+               " %8.1fs\n", v[LiveStats::Pid], sim.program.c_str(), state, v[LiveStats::Cycles],
+               v[LiveStats::Instructions], v[LiveStats::InstructionsPerSecond] / 1e6, recent,
+               v[LiveStats::Cycles] ? double(v[LiveStats::Instructions]) / v[LiveStats::Cycles] : 0.0,
+               Percent(v[LiveStats::ICacheMisses], v[LiveStats::ICacheAccesses]),
+               Percent(v[LiveStats::DCacheMisses], v[LiveStats::DCacheAccesses]), v[LiveStats::Ip],
+               (v[LiveStats::UpdateNs] - v[LiveStats::StartNs]) / 1e9);
+    }
+    previous.clear();
+    for (const Simulation& sim : sims)
+        previous[sim.values[LiveStats::Pid]] = sim;
+}
+
+int main(int argc, char** argv)
+{
+    bool once = false;
+    double interval = 1.0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-once")
+            once = true;
+        else if (arg == "-interval" && i + 1 < argc)
+            interval = std::stod(argv[++i]);
+        else
+        {
+            fprintf(stderr, "usage: riscv_top [-once] [-interval <seconds>]\n");
+            return 1;
+        }
+    }
+
+    std::map<uint64_t, Simulation> previous;
+    while (true)
+    {
+        std::vector<Simulation> sims = ReadAll();
+        if (!once)
+            printf("\033[H\033[J");
+        printf("%zu simulations in %s\n", sims.size(), LiveStats::Directory().c_str());
+        Print(sims, previous);
+        fflush(stdout);
+        if (once)
+            return 0;
+        std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+    }
+}